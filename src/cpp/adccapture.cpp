@@ -0,0 +1,312 @@
+#include "adccapture.h"
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+
+namespace SPIW {
+
+CaptureWriter::CaptureWriter()
+    : fd(-1)
+    , map(NULL)
+    , mapBytes(0)
+    , capacity(0)
+    , count(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+int CaptureWriter::open(const char *path, DAQC2Plate *board)
+{
+    close();
+    if( board == NULL )
+        return SPIERROR;
+
+    // everything that needs the bus first, the stream may be running a moment later
+    PlateCalibration cal = board->getCalibration();
+    char id[PP_ID_SIZE];
+    board->getID(id, sizeof(id));
+    uint8_t fw = board->getFWRevisionByte();
+
+    std::lock_guard<std::mutex> guard(lock);
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if( fd < 0 )
+    {
+        PP_ERROR() << "Unable to create capture" << path << strerror(errno);
+        return SPIERROR;
+    }
+
+    capacity = PP_CAPTURE_CHUNK;
+    mapBytes = sizeof(CaptureHeader) + capacity * sizeof(CaptureRecord);
+    if( ftruncate(fd, mapBytes) != 0 )
+    {
+        PP_ERROR() << "Unable to size capture" << path << strerror(errno);
+        ::close(fd);
+        fd = -1;
+        return SPIERROR;
+    }
+    void* mem = mmap(NULL, mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if( mem == MAP_FAILED )
+    {
+        PP_ERROR() << "Unable to map capture" << path << strerror(errno);
+        ::close(fd);
+        fd = -1;
+        return SPIERROR;
+    }
+    map = (uint8_t*)mem;
+    count = 0;
+
+    CaptureHeader* h = header();
+    ::memset(h, 0, sizeof(*h));
+    ::memcpy(h->magic, PP_CAPTURE_MAGIC, sizeof(h->magic));
+    h->version = PP_CAPTURE_VERSION;
+    h->headerBytes = sizeof(CaptureHeader);
+    h->recordBytes = sizeof(CaptureRecord);
+    h->address = board->getAddress();
+    h->fwRevision = fw;
+    h->channels = PP_MAX_ANALOG_IN;
+    h->rawBytes = PP_ADC_FRAME_BYTES;
+    snprintf(h->id, sizeof(h->id), "%s", id);
+    h->startUs = board->getBus().transport()->nowMicroseconds();
+    h->startTime = (int64_t)time(NULL);
+    h->cal = cal;
+    h->records = 0;
+    return 0;
+}
+
+CaptureRecord *CaptureWriter::slot()
+{
+    if( map == NULL )
+        return NULL;
+    if( count == capacity )
+    {
+        size_t bytes = mapBytes + PP_CAPTURE_CHUNK * sizeof(CaptureRecord);
+        if( ftruncate(fd, bytes) != 0 )
+        {
+            PP_ERROR() << "Unable to grow capture" << strerror(errno);
+            return NULL;
+        }
+        void* mem = mremap(map, mapBytes, bytes, MREMAP_MAYMOVE);
+        if( mem == MAP_FAILED )
+        {
+            PP_ERROR() << "Unable to remap capture" << strerror(errno);
+            return NULL;
+        }
+        map = (uint8_t*)mem;
+        mapBytes = bytes;
+        capacity += PP_CAPTURE_CHUNK;
+    }
+    return (CaptureRecord*)(map + sizeof(CaptureHeader)) + count;
+}
+
+void CaptureWriter::commit()
+{
+    // the record is in place before the count that publishes it
+    count++;
+    __atomic_store_n(&header()->records, count, __ATOMIC_RELEASE);
+}
+
+int CaptureWriter::appendAdc(uint64_t timestampUs, uint64_t sequence, const uint8_t raw[])
+{
+    std::lock_guard<std::mutex> guard(lock);
+    CaptureRecord* record = slot();
+    if( record == NULL )
+        return SPIERROR;
+    record->timestampUs = timestampUs;
+    record->sequence = (uint32_t)sequence;
+    record->kind = PP_RECORD_ADC;
+    record->address = header()->address;
+    record->pin = 0;
+    record->din = 0;
+    ::memcpy(record->raw, raw, PP_ADC_FRAME_BYTES);
+    commit();
+    return 0;
+}
+
+int CaptureWriter::appendDin(const DinEvent &event, uint8_t din)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    CaptureRecord* record = slot();
+    if( record == NULL )
+        return SPIERROR;
+    record->timestampUs = event.timestampUs;
+    record->sequence = 0;
+    record->kind = PP_RECORD_DIN;
+    record->address = event.address;
+    record->pin = (uint8_t)event.pin;
+    record->din = din;
+    ::memset(record->raw, 0, sizeof(record->raw));
+    commit();
+    return 0;
+}
+
+DinCallback CaptureWriter::dinRecorder(DAQC2Plate *board)
+{
+    return [this, board](const DinEvent &event)
+    {
+        int inputs = 0;
+        if( board->getAllBits(inputs) == SPIERROR )
+            return;
+        appendDin(event, (uint8_t)inputs);
+    };
+}
+
+int CaptureWriter::sync()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if( map == NULL )
+        return SPIERROR;
+    size_t used = sizeof(CaptureHeader) + count * sizeof(CaptureRecord);
+    if( msync(map, used, MS_SYNC) != 0 )
+        return SPIERROR;
+    return 0;
+}
+
+void CaptureWriter::close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if( map == NULL )
+        return;
+    munmap(map, mapBytes);
+    map = NULL;
+
+    // drop the unused tail of the last chunk
+    if( ftruncate(fd, sizeof(CaptureHeader) + count * sizeof(CaptureRecord)) != 0 )
+        PP_ERROR() << "Unable to trim capture" << strerror(errno);
+    ::close(fd);
+    fd = -1;
+    mapBytes = 0;
+    capacity = 0;
+}
+
+CaptureReader::CaptureReader()
+    : fd(-1)
+    , map(NULL)
+    , mapBytes(0)
+    , count(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+int CaptureReader::open(const char *path)
+{
+    close();
+    fd = ::open(path, O_RDONLY);
+    if( fd < 0 )
+    {
+        PP_ERROR() << "Unable to open capture" << path << strerror(errno);
+        return SPIERROR;
+    }
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CaptureHeader) )
+    {
+        PP_ERROR() << "Not a capture" << path;
+        close();
+        return SPIERROR;
+    }
+    mapBytes = st.st_size;
+    void* mem = mmap(NULL, mapBytes, PROT_READ, MAP_SHARED, fd, 0);
+    if( mem == MAP_FAILED )
+    {
+        PP_ERROR() << "Unable to map capture" << path << strerror(errno);
+        mapBytes = 0;
+        close();
+        return SPIERROR;
+    }
+    map = (const uint8_t*)mem;
+
+    const CaptureHeader &h = header();
+    if( ::memcmp(h.magic, PP_CAPTURE_MAGIC, sizeof(h.magic)) != 0 || h.version != PP_CAPTURE_VERSION
+        || h.recordBytes != sizeof(CaptureRecord) || h.headerBytes < sizeof(CaptureHeader)
+        || h.headerBytes > mapBytes || h.rawBytes != PP_ADC_FRAME_BYTES )
+    {
+        PP_ERROR() << "Not a capture or an unknown version" << path;
+        close();
+        return SPIERROR;
+    }
+
+    // a writer that died leaves the count and the file size apart, trust the smaller
+    uint64_t whole = (mapBytes - h.headerBytes) / h.recordBytes;
+    uint64_t committed = __atomic_load_n(&h.records, __ATOMIC_ACQUIRE);
+    count = committed < whole ? committed : whole;
+    return 0;
+}
+
+void CaptureReader::close()
+{
+    if( map != NULL )
+        munmap((void*)map, mapBytes);
+    if( fd >= 0 )
+        ::close(fd);
+    map = NULL;
+    fd = -1;
+    mapBytes = 0;
+    count = 0;
+}
+
+bool CaptureReader::toFrame(const CaptureRecord &record, AdcFrame &frame) const
+{
+    if( record.kind != PP_RECORD_ADC )
+        return false;
+    frame.timestampUs = record.timestampUs;
+    frame.sequence = record.sequence;
+    convertAdcFrames(record.raw, 1, header().cal, frame.volts);
+    return true;
+}
+
+bool CaptureReader::toEvent(const CaptureRecord &record, DinEvent &event) const
+{
+    if( record.kind != PP_RECORD_DIN )
+        return false;
+    event.address = record.address;
+    event.pin = record.pin;
+    event.timestampUs = record.timestampUs;
+    return true;
+}
+
+uint64_t CaptureReader::replay(const AdcFrameCallback &onAdc, const DinCallback &onDin, double speed)
+{
+    if( map == NULL )
+        return 0;
+
+    const CaptureRecord* record = records();
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    uint64_t delivered = 0;
+    for( uint64_t i = 0; i < count; ++i, ++record )
+    {
+        if( speed > 0 )
+        {
+            // DIN records come from another thread and can be a little out of order
+            double offsetUs = (double)(int64_t)(record->timestampUs - records()->timestampUs) / speed;
+            std::this_thread::sleep_until( begin + std::chrono::microseconds((int64_t)offsetUs) );
+        }
+
+        AdcFrame frame;
+        DinEvent event;
+        if( toFrame(*record, frame) )
+        {
+            if( onAdc )
+                onAdc(frame);
+        }
+        else if( toEvent(*record, event) )
+        {
+            if( onDin )
+                onDin(event);
+        }
+        else
+            continue;
+        delivered++;
+    }
+    return delivered;
+}
+
+}
@@ -0,0 +1,222 @@
+#ifndef ADCCAPTURE_H
+#define ADCCAPTURE_H
+
+#include "adcconvert.h"
+#include "adcstream.h"
+#include "interruptdispatcher.h"
+#include <functional>
+#include <mutex>
+
+namespace SPIW {
+
+/// first bytes of a capture file and the layout version after them
+#define PP_CAPTURE_MAGIC        "PPCAPT\r\n"
+#define PP_CAPTURE_VERSION      1
+
+/// records the writer grows the file by, 1 MiB at a time
+#define PP_CAPTURE_CHUNK        32768
+
+/// CaptureRecord::kind
+#define PP_RECORD_ADC           1
+#define PP_RECORD_DIN           2
+
+/**
+ * @brief The CaptureHeader struct  Start of a capture file, the board and how to read the records.
+ *
+ * Everything is in the byte order of the machine that wrote it, little endian on a Pi.
+ */
+struct CaptureHeader
+{
+    char     magic[8];
+    uint32_t version;
+
+    /// records start at headerBytes and are recordBytes apart
+    uint32_t headerBytes;
+    uint32_t recordBytes;
+
+    /// DAQC2 address 32..39 and raw firmware byte
+    uint8_t  address;
+    uint8_t  fwRevision;
+
+    /// ADC channels and raw bytes per ADC record, 8 and 16
+    uint8_t  channels;
+    uint8_t  rawBytes;
+
+    /// board id, zero terminated
+    char     id[48];
+
+    /// transport clock and wall clock (unix seconds) when the capture was opened
+    uint64_t startUs;
+    int64_t  startTime;
+
+    /// calibration the raw ADC words are converted with
+    PlateCalibration cal;
+
+    /// records committed so far, written after the record itself
+    uint64_t records;
+
+    uint8_t  reserved[32];
+};
+
+/**
+ * @brief The CaptureRecord struct  One timestamped ADC frame or DIN change, fixed size.
+ */
+struct CaptureRecord
+{
+    /// transport clock, monotonic micro seconds
+    uint64_t timestampUs;
+
+    /// AdcFrame::sequence, low 32 bits, 0 for DIN
+    uint32_t sequence;
+
+    /// PP_RECORD_ADC or PP_RECORD_DIN
+    uint8_t  kind;
+    uint8_t  address;
+
+    /// DIN only, the pin that fired and all 8 inputs read after it
+    uint8_t  pin;
+    uint8_t  din;
+
+    /// ADC only, the 0x31 response, high byte first
+    uint8_t  raw[PP_ADC_FRAME_BYTES];
+};
+
+static_assert( sizeof(CaptureHeader) == 320, "capture header layout changed" );
+static_assert( sizeof(CaptureRecord) == 32, "capture record layout changed" );
+
+typedef std::function<void (const AdcFrame &)> AdcFrameCallback;
+
+/**
+ * @brief The CaptureWriter class  Appends records to a memory mapped capture file.
+ *
+ * A record is copied into the mapping and then counted in the header, so a reader never sees half
+ * of one. The file grows PP_CAPTURE_CHUNK records at a time, that is the only system call on the
+ * way; close() trims it to the records written.
+ */
+class CaptureWriter
+{
+private :
+
+    std::mutex     lock;
+    int            fd;
+    uint8_t*       map;
+    size_t         mapBytes;
+    uint64_t       capacity;
+    uint64_t       count;
+
+    CaptureHeader* header()
+    {
+        return (CaptureHeader*)map;
+    }
+
+    /// next free record, grows the file when full, NULL on error
+    CaptureRecord* slot();
+
+    void commit();
+
+    CaptureWriter( const CaptureWriter& );
+    CaptureWriter& operator=( const CaptureWriter& );
+
+public:
+
+    CaptureWriter();
+
+    /// closes the file
+    ~CaptureWriter();
+
+    /// creates path and writes the header of board into it, returns 0 or SPIERROR
+    int open( const char* path, DAQC2Plate* board );
+
+    /// one raw 0x31 response, returns 0 or SPIERROR
+    int appendAdc( uint64_t timestampUs, uint64_t sequence, const uint8_t raw[PP_ADC_FRAME_BYTES] );
+
+    /// one DIN interrupt and the inputs read for it, returns 0 or SPIERROR
+    int appendDin( const DinEvent &event, uint8_t din );
+
+    /// a callback for InterruptDispatcher::onPin that reads the inputs of board and records them
+    DinCallback dinRecorder( DAQC2Plate* board );
+
+    /// flushes the records so far to the disk, returns 0 or SPIERROR
+    int sync();
+
+    /// trims the file and unmaps it
+    void close();
+
+    bool isOpen() const
+    {
+        return map != NULL;
+    }
+
+    /// records written
+    uint64_t records() const
+    {
+        return count;
+    }
+};
+
+/**
+ * @brief The CaptureReader class  Maps a capture file read only and replays it.
+ *
+ * Records are served straight from the mapping. Replay converts the ADC words with the calibration
+ * in the header through convertAdcFrames, the same path AdcStream uses, and hands out AdcFrames and
+ * DinEvents as if the board were there.
+ */
+class CaptureReader
+{
+private :
+
+    int            fd;
+    const uint8_t* map;
+    size_t         mapBytes;
+    uint64_t       count;
+
+    CaptureReader( const CaptureReader& );
+    CaptureReader& operator=( const CaptureReader& );
+
+public:
+
+    CaptureReader();
+
+    ~CaptureReader();
+
+    /// maps path and checks the header, returns 0 or SPIERROR
+    int open( const char* path );
+
+    void close();
+
+    bool isOpen() const
+    {
+        return map != NULL;
+    }
+
+    const CaptureHeader &header() const
+    {
+        return *(const CaptureHeader*)map;
+    }
+
+    /// committed records, a file cut short counts only the whole ones
+    uint64_t size() const
+    {
+        return count;
+    }
+
+    /// the records in the mapping, valid until close
+    const CaptureRecord* records() const
+    {
+        return (const CaptureRecord*)(map + header().headerBytes);
+    }
+
+    /// ADC record to the frame AdcStream would have produced, false for a DIN record
+    bool toFrame( const CaptureRecord &record, AdcFrame &frame ) const;
+
+    /// DIN record to the event InterruptDispatcher would have delivered, false for an ADC record
+    bool toEvent( const CaptureRecord &record, DinEvent &event ) const;
+
+    /// delivers every record in order, either callback may be empty, speed 1 keeps the recorded
+    /// spacing, 2 twice as fast, 0 as fast as possible, returns the records delivered
+    uint64_t replay( const AdcFrameCallback &onAdc, const DinCallback &onDin, double speed = 0 );
+};
+
+}
+
+#endif // ADCCAPTURE_H
@@ -0,0 +1,149 @@
+#include "adcconvert.h"
+
+#include <math.h>
+
+/// PP_ADC_PORTABLE forces the plain C++ kernel, armv7 NEON has no doubles so it always uses it
+#if !defined(PP_ADC_PORTABLE) && defined(__SSE2__)
+#define PP_ADC_SSE2
+#include <emmintrin.h>
+#elif !defined(PP_ADC_PORTABLE) && defined(__aarch64__) && defined(__ARM_NEON)
+#define PP_ADC_NEON
+#include <arm_neon.h>
+#endif
+
+namespace SPIW {
+
+const char *adcKernelName()
+{
+#if defined(PP_ADC_SSE2)
+    return "sse2";
+#elif defined(PP_ADC_NEON)
+    return "neon";
+#else
+    return "portable";
+#endif
+}
+
+#if defined(PP_ADC_SSE2)
+
+/// 8 channels of one frame to volts, two lanes at a time, same operations and order as adcVolts
+static inline void convertFrame(const uint8_t* raw, const PlateCalibration &cal, double* out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128d full = _mm_set1_pd(24.0);
+    const __m128d steps = _mm_set1_pd(65536.0);
+    const __m128d half = _mm_set1_pd(12.0);
+
+    // big endian 16 bit samples to native, then widen to 32 bit
+    __m128i bytes = _mm_loadu_si128((const __m128i*)raw);
+    __m128i samples = _mm_or_si128(_mm_slli_epi16(bytes, 8), _mm_srli_epi16(bytes, 8));
+    __m128i low = _mm_unpacklo_epi16(samples, zero);
+    __m128i high = _mm_unpackhi_epi16(samples, zero);
+
+    __m128d v[4];
+    v[0] = _mm_cvtepi32_pd(low);
+    v[1] = _mm_cvtepi32_pd(_mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+    v[2] = _mm_cvtepi32_pd(high);
+    v[3] = _mm_cvtepi32_pd(_mm_shuffle_epi32(high, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    for( int k = 0; k < 4; ++k )
+    {
+        __m128d value = _mm_sub_pd(_mm_div_pd(_mm_mul_pd(v[k], full), steps), half);
+        value = _mm_add_pd(_mm_mul_pd(value, _mm_loadu_pd(cal.scale + 2*k)), _mm_loadu_pd(cal.offset + 2*k));
+        _mm_storeu_pd(out + 2*k, value);
+    }
+}
+
+#elif defined(PP_ADC_NEON)
+
+static inline void convertFrame(const uint8_t* raw, const PlateCalibration &cal, double* out)
+{
+    const float64x2_t full = vdupq_n_f64(24.0);
+    const float64x2_t steps = vdupq_n_f64(65536.0);
+    const float64x2_t half = vdupq_n_f64(12.0);
+
+    // big endian 16 bit samples to native, then widen to 64 bit
+    uint16x8_t samples = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(raw)));
+    uint32x4_t low = vmovl_u16(vget_low_u16(samples));
+    uint32x4_t high = vmovl_u16(vget_high_u16(samples));
+
+    float64x2_t v[4];
+    v[0] = vcvtq_f64_u64(vmovl_u32(vget_low_u32(low)));
+    v[1] = vcvtq_f64_u64(vmovl_u32(vget_high_u32(low)));
+    v[2] = vcvtq_f64_u64(vmovl_u32(vget_low_u32(high)));
+    v[3] = vcvtq_f64_u64(vmovl_u32(vget_high_u32(high)));
+
+    for( int k = 0; k < 4; ++k )
+    {
+        float64x2_t value = vsubq_f64(vdivq_f64(vmulq_f64(v[k], full), steps), half);
+        value = vaddq_f64(vmulq_f64(value, vld1q_f64(cal.scale + 2*k)), vld1q_f64(cal.offset + 2*k));
+        vst1q_f64(out + 2*k, value);
+    }
+}
+
+#else
+
+static inline void convertFrame(const uint8_t* raw, const PlateCalibration &cal, double* out)
+{
+    for( int i = 0; i < 8; ++i )
+        out[i] = adcVolts(raw[2*i], raw[2*i+1], cal.scale[i], cal.offset[i]);
+}
+
+#endif
+
+void convertAdcFrames(const uint8_t *raw, size_t frames, const PlateCalibration &cal, double *out)
+{
+    for( size_t f = 0; f < frames; ++f )
+        convertFrame(raw + f * PP_ADC_FRAME_BYTES, cal, out + f * 8);
+}
+
+void convertAdcFrames(const uint8_t *raw, size_t frames, const PlateCalibration &cal, float *out)
+{
+    double volts[8];
+    for( size_t f = 0; f < frames; ++f )
+    {
+        convertFrame(raw + f * PP_ADC_FRAME_BYTES, cal, volts);
+        float* dest = out + f * 8;
+#if defined(PP_ADC_SSE2)
+        _mm_storeu_ps(dest, _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(volts)), _mm_cvtpd_ps(_mm_loadu_pd(volts + 2))));
+        _mm_storeu_ps(dest + 4, _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(volts + 4)), _mm_cvtpd_ps(_mm_loadu_pd(volts + 6))));
+#elif defined(PP_ADC_NEON)
+        vst1q_f32(dest, vcombine_f32(vcvt_f32_f64(vld1q_f64(volts)), vcvt_f32_f64(vld1q_f64(volts + 2))));
+        vst1q_f32(dest + 4, vcombine_f32(vcvt_f32_f64(vld1q_f64(volts + 4)), vcvt_f32_f64(vld1q_f64(volts + 6))));
+#else
+        for( int i = 0; i < 8; ++i )
+            dest[i] = (float)volts[i];
+#endif
+    }
+}
+
+void convertAdcFrames(const uint8_t *raw, size_t frames, const PlateCalibration &cal, int32_t *microVolts)
+{
+    double volts[8];
+    for( size_t f = 0; f < frames; ++f )
+    {
+        convertFrame(raw + f * PP_ADC_FRAME_BYTES, cal, volts);
+        int32_t* dest = microVolts + f * 8;
+#if defined(PP_ADC_SSE2)
+        const __m128d micro = _mm_set1_pd(1e6);
+        for( int k = 0; k < 4; ++k )
+        {
+            // cvtpd rounds with the current mode, nearest even unless someone changed it, like lrint
+            __m128i rounded = _mm_cvtpd_epi32(_mm_mul_pd(_mm_loadu_pd(volts + 2*k), micro));
+            _mm_storel_epi64((__m128i*)(dest + 2*k), rounded);
+        }
+#elif defined(PP_ADC_NEON)
+        const float64x2_t micro = vdupq_n_f64(1e6);
+        for( int k = 0; k < 4; ++k )
+        {
+            int64x2_t rounded = vcvtnq_s64_f64(vmulq_f64(vld1q_f64(volts + 2*k), micro));
+            vst1_s32(dest + 2*k, vmovn_s64(rounded));
+        }
+#else
+        for( int i = 0; i < 8; ++i )
+            dest[i] = (int32_t)lrint(volts[i] * 1e6);
+#endif
+    }
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef ADCCONVERT_H
+#define ADCCONVERT_H
+
+#include "daqc2plate.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace SPIW {
+
+/// bytes of one all ADC (0x31) response, 8 channels high byte first
+#define PP_ADC_FRAME_BYTES      16
+
+/**
+ * One ADC sample to volts, the reference every batch kernel matches bit for bit.
+ * The build turns off fp contraction, a fused multiply add would round differently.
+ */
+inline double adcVolts( uint8_t hi, uint8_t lo, double scale, double offset )
+{
+    double value = (256*hi+lo);
+    value = (value*24.0/65536)-12.0;
+    return value*scale+offset;
+}
+
+/// converts frames raw 0x31 responses to volts, out gets 8 values per frame
+void convertAdcFrames( const uint8_t* raw, size_t frames, const PlateCalibration &cal, double* out );
+
+/// as above, each value is the double result rounded to float
+void convertAdcFrames( const uint8_t* raw, size_t frames, const PlateCalibration &cal, float* out );
+
+/// as above in micro volts, the double result times 1e6 rounded to nearest even
+void convertAdcFrames( const uint8_t* raw, size_t frames, const PlateCalibration &cal, int32_t* microVolts );
+
+/// the kernel this build uses, "sse2", "neon" or "portable"
+const char* adcKernelName();
+
+}
+
+#endif // ADCCONVERT_H
@@ -0,0 +1,181 @@
+#include "adcstream.h"
+#include "adcconvert.h"
+#include "adccapture.h"
+
+namespace SPIW {
+
+static size_t roundUpPow2(size_t value)
+{
+    size_t size = 1;
+    while( size < value )
+        size <<= 1;
+    return size;
+}
+
+AdcRing::AdcRing(size_t capacity)
+    : frames(roundUpPow2(capacity < 2 ? 2 : capacity))
+    , mask(frames.size() - 1)
+    , head(0)
+    , tail(0)
+{
+}
+
+bool AdcRing::push(const AdcFrame &frame)
+{
+    uint64_t write = head.load(std::memory_order_relaxed);
+    if( write - tail.load(std::memory_order_acquire) > mask )
+        return false;
+    frames[write & mask] = frame;
+    head.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+size_t AdcRing::pop(AdcFrame *out, size_t max)
+{
+    uint64_t read = tail.load(std::memory_order_relaxed);
+    uint64_t ready = head.load(std::memory_order_acquire) - read;
+    size_t count = ready < max ? (size_t)ready : max;
+    for( size_t i = 0; i < count; ++i )
+        out[i] = frames[(read + i) & mask];
+    tail.store(read + count, std::memory_order_release);
+    return count;
+}
+
+size_t AdcRing::size() const
+{
+    return (size_t)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+}
+
+AdcStream::AdcStream(DAQC2Plate *x_board, size_t capacity)
+    : board(x_board)
+    , ring(capacity)
+    , capture(NULL)
+    , running(false)
+    , rateHz(0)
+    , frames(0)
+    , overruns(0)
+    , missed(0)
+    , errors(0)
+    , jitterTotalUs(0)
+    , jitterMaxUs(0)
+    , startUs(0)
+    , lastUs(0)
+{
+}
+
+AdcStream::~AdcStream()
+{
+    stop();
+}
+
+bool AdcStream::start(double hz)
+{
+    if( running || hz <= 0 || board == NULL )
+        return false;
+
+    rateHz = hz;
+    frames = 0;
+    overruns = 0;
+    missed = 0;
+    errors = 0;
+    jitterTotalUs = 0;
+    jitterMaxUs = 0;
+
+    uint64_t periodUs = (uint64_t)(1000000.0 / hz);
+    if( periodUs == 0 )
+        periodUs = 1;
+
+    // the calibration read would stall the first samples
+    cal = board->getCalibration();
+
+    running = true;
+    sampler = std::thread(&AdcStream::run, this, periodUs);
+    return true;
+}
+
+void AdcStream::stop()
+{
+    running = false;
+    if( sampler.joinable() )
+        sampler.join();
+}
+
+size_t AdcStream::read(AdcFrame *out, size_t max)
+{
+    return ring.pop(out, max);
+}
+
+void AdcStream::run(uint64_t periodUs)
+{
+    SPITransport* bus = board->getBus().transport();
+    uint64_t start = bus->nowMicroseconds();
+    uint64_t sequence = 0;
+    startUs = start;
+    lastUs = start;
+
+    while( running )
+    {
+        uint64_t due = start + sequence * periodUs;
+        uint64_t now = bus->nowMicroseconds();
+        if( now < due )
+        {
+            uint64_t wait = due - now;
+            bus->delayMicroseconds( wait < PP_STREAM_SLICE ? (uint32_t)wait : PP_STREAM_SLICE );
+            continue;
+        }
+
+        // a whole period late, skip to the grid point we are in
+        uint64_t behind = (now - due) / periodUs;
+        if( behind > 0 )
+        {
+            missed += behind;
+            sequence += behind;
+            due = start + sequence * periodUs;
+        }
+
+        AdcFrame frame;
+        frame.timestampUs = now;
+        frame.sequence = sequence++;
+        uint64_t late = now - due;
+        jitterTotalUs += late;
+        uint64_t seen = jitterMaxUs.load();
+        while( late > seen && !jitterMaxUs.compare_exchange_weak(seen, late) )
+            ;
+
+        // same words and conversion as getADCall, the raw ones go to the capture as well
+        uint8_t raw[PP_ADC_FRAME_BYTES];
+        if( board->getADCallRaw(raw) != 0 )
+        {
+            errors++;
+            continue;
+        }
+        convertAdcFrames(raw, 1, cal, frame.volts);
+        CaptureWriter* writer = capture;
+        if( writer != NULL )
+            writer->appendAdc(frame.timestampUs, frame.sequence, raw);
+        if( ring.push(frame) )
+            frames++;
+        else
+            overruns++;
+        lastUs = bus->nowMicroseconds();
+    }
+}
+
+AdcStreamStats AdcStream::stats() const
+{
+    AdcStreamStats s;
+    s.requestedHz = rateHz;
+    s.frames = frames;
+    s.overruns = overruns;
+    s.missed = missed;
+    s.errors = errors;
+
+    uint64_t sampled = s.frames + s.overruns + s.errors;
+    uint64_t elapsed = lastUs - startUs;
+    s.achievedHz = elapsed > 0 ? (double)(s.frames + s.overruns) * 1000000.0 / elapsed : 0;
+    s.jitterMeanUs = sampled > 0 ? (double)jitterTotalUs / sampled : 0;
+    s.jitterMaxUs = jitterMaxUs;
+    return s;
+}
+
+}
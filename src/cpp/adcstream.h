@@ -0,0 +1,164 @@
+#ifndef ADCSTREAM_H
+#define ADCSTREAM_H
+
+#include "daqc2plate.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace SPIW {
+
+class CaptureWriter;
+
+/// default ring size in frames, rounded up to a power of two
+#define PP_STREAM_CAPACITY      4096
+
+/// longest single sleep of the sampler, so stop() is quick at low rates, usec
+#define PP_STREAM_SLICE         100000
+
+/**
+ * @brief The AdcFrame struct  One timestamped reading of the 8 ADC channels.
+ */
+struct AdcFrame
+{
+    /// transport clock at the start of the read, monotonic micro seconds
+    uint64_t timestampUs;
+
+    /// counts every scheduled sample, a gap means samples were missed or dropped
+    uint64_t sequence;
+
+    double   volts[8];
+};
+
+/**
+ * @brief The AdcStreamStats struct  Counters of an AdcStream since start.
+ */
+struct AdcStreamStats
+{
+    double   requestedHz;
+    double   achievedHz;
+
+    /// frames read and put in the ring
+    uint64_t frames;
+
+    /// frames read while the ring was full, lost because the consumer is behind
+    uint64_t overruns;
+
+    /// sample times skipped because the sampler fell a whole period behind
+    uint64_t missed;
+
+    /// failed ADC reads
+    uint64_t errors;
+
+    /// start of the read against its scheduled time, usec
+    double   jitterMeanUs;
+    uint64_t jitterMaxUs;
+};
+
+/**
+ * @brief The AdcRing class  Single producer, single consumer ring of AdcFrames, no locks.
+ */
+class AdcRing
+{
+private :
+
+    std::vector<AdcFrame> frames;
+    size_t                mask;
+
+    /// written only by the producer and the consumer respectively
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+
+public:
+
+    explicit AdcRing( size_t capacity );
+
+    /// producer side, false if the ring is full
+    bool push( const AdcFrame &frame );
+
+    /// consumer side, copies up to max frames, returns the number copied
+    size_t pop( AdcFrame* out, size_t max );
+
+    /// frames waiting for the consumer
+    size_t size() const;
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+};
+
+/**
+ * @brief The AdcStream class  Samples all 8 ADCs of a DAQC2 at a fixed rate on its own thread.
+ *
+ * Sample times are on a fixed grid from start(), so a late read does not shift the ones after it.
+ * When the sampler falls a whole period behind it skips to the next grid point and counts the
+ * skipped ones as missed. One consumer reads the frames without blocking.
+ */
+class AdcStream
+{
+private :
+
+    DAQC2Plate*           board;
+    AdcRing               ring;
+    PlateCalibration      cal;
+    std::atomic<CaptureWriter*> capture;
+    std::thread           sampler;
+    std::atomic<bool>     running;
+    double                rateHz;
+
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint64_t> missed;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> jitterTotalUs;
+    std::atomic<uint64_t> jitterMaxUs;
+    std::atomic<uint64_t> startUs;
+    std::atomic<uint64_t> lastUs;
+
+    void run( uint64_t periodUs );
+
+    AdcStream( const AdcStream& );
+    AdcStream& operator=( const AdcStream& );
+
+public:
+
+    /// capacity in frames of the ring
+    AdcStream( DAQC2Plate* x_board, size_t capacity = PP_STREAM_CAPACITY );
+
+    /// stops the sampler
+    ~AdcStream();
+
+    /// starts sampling at hz, false if already running or hz is not positive
+    bool start( double hz );
+
+    /// stops and joins the sampler, frames already in the ring stay readable
+    void stop();
+
+    bool isRunning() const
+    {
+        return running;
+    }
+
+    /// also appends the raw words of every frame to writer, NULL stops recording
+    void setCapture( CaptureWriter* writer )
+    {
+        capture = writer;
+    }
+
+    /// copies up to max frames, oldest first, never blocks
+    size_t read( AdcFrame* out, size_t max );
+
+    /// frames ready to read
+    size_t available() const
+    {
+        return ring.size();
+    }
+
+    /// counters so far
+    AdcStreamStats stats() const;
+};
+
+}
+
+#endif // ADCSTREAM_H
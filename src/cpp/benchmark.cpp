@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include "adcconvert.h"
+#include "spibase.h"
+#include "relayplate.h"
+#include "daqc2plate.h"
+#include "plateregistry.h"
+#include "simtransport.h"
+
+/**
+ * Latency and throughput of the per command calls, written as JSON so runs can be compared.
+ *
+ * Times come from the bus clock: the monotonic clock on the real bus, the virtual clock on the
+ * simulated one, so a run against the simulator gives the same numbers every time. --sim uses the
+ * simulated stack of PIPLATE_SIM_BOARDS, --latency-us is its per transfer device latency and --ack-us
+ * the DAQC2 ack time. make bench or the raspberry-piplates-bench.pro project builds it.
+ *
+ * --selftest touches no bus, it runs random frames through the batch ADC kernel and checks every
+ * value against adcVolts, exit status 1 on the first difference. make selftest runs it once with
+ * the kernel of the build and once with PP_ADC_PORTABLE.
+ *
+ *   piplates-bench [--sim] [--latency-us N] [--ack-us N] [--realtime] [--iterations N] [--slow-iterations N] [--out FILE]
+ *   piplates-bench --selftest
+ */
+
+namespace {
+
+/// one measured operation
+struct BenchResult
+{
+    std::string name;
+    int         address;
+    std::string skipped;
+    uint64_t    errors;
+    std::vector<uint64_t> samplesUs;
+    uint64_t    totalUs;
+
+    BenchResult() : address(-1), errors(0), totalUs(0) {}
+};
+
+/// runs op count times after a few warm up calls, op returns false on an error
+BenchResult measure( const char* name, int address, int count, const std::function<bool ()> &op )
+{
+    SPIW::SPITransport* bus = SPIW::SPIBase::transport();
+    BenchResult result;
+    result.name = name;
+    result.address = address;
+
+    for( int i = 0; i < std::min(count, 3); ++i )
+        op();
+
+    result.samplesUs.reserve(count);
+    uint64_t begin = bus->nowMicroseconds();
+    for( int i = 0; i < count; ++i )
+    {
+        uint64_t start = bus->nowMicroseconds();
+        if( !op() )
+            result.errors++;
+        result.samplesUs.push_back( bus->nowMicroseconds() - start );
+    }
+    result.totalUs = bus->nowMicroseconds() - begin;
+    return result;
+}
+
+/// the same bits, so -0.0 against 0.0 or two NaNs differ as they would for a caller
+template<typename T>
+bool sameBits( T a, T b )
+{
+    return ::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+/// convertAdcFrames against the scalar conversion for double, float and micro volt output, 0 or 1
+int selftest()
+{
+    const size_t frames = 4096;
+    std::mt19937 random(0x31);
+    std::uniform_real_distribution<double> scale(0.96, 1.04);
+    std::uniform_real_distribution<double> offset(-0.2, 0.2);
+
+    // the first frames are all 0x00 and all 0xFF, the ends of the range, the rest random
+    std::vector<uint8_t> raw(frames * PP_ADC_FRAME_BYTES);
+    for( size_t i = 0; i < raw.size(); ++i )
+        raw[i] = i < PP_ADC_FRAME_BYTES ? 0x00 : i < 2 * PP_ADC_FRAME_BYTES ? 0xFF : (uint8_t)random();
+
+    std::vector<double> volts(frames * 8);
+    std::vector<float> single(frames * 8);
+    std::vector<int32_t> micro(frames * 8);
+    for( int round = 0; round < 16; ++round )
+    {
+        // round 0 is the default calibration, later ones random like the board stores
+        SPIW::PlateCalibration cal;
+        for( int i = 0; i < 8; ++i )
+        {
+            cal.scale[i] = round == 0 ? 1.0 : scale(random);
+            cal.offset[i] = round == 0 ? 0.0 : offset(random);
+            cal.dac[i] = 1.0;
+        }
+        SPIW::convertAdcFrames(&raw[0], frames, cal, &volts[0]);
+        SPIW::convertAdcFrames(&raw[0], frames, cal, &single[0]);
+        SPIW::convertAdcFrames(&raw[0], frames, cal, &micro[0]);
+
+        for( size_t f = 0; f < frames; ++f )
+        {
+            for( int i = 0; i < 8; ++i )
+            {
+                const uint8_t* sample = &raw[f * PP_ADC_FRAME_BYTES + 2 * i];
+                double expected = SPIW::adcVolts(sample[0], sample[1], cal.scale[i], cal.offset[i]);
+                size_t n = f * 8 + i;
+                if( !sameBits(volts[n], expected) || !sameBits(single[n], (float)expected)
+                    || micro[n] != (int32_t)lrint(expected * 1e6) )
+                {
+                    fprintf(stderr, "%s kernel differs, round %d frame %u channel %d raw %02x%02x: %.17g %.9g %d, expected %.17g %.9g %d\n",
+                            SPIW::adcKernelName(), round, (unsigned)f, i, sample[0], sample[1],
+                            volts[n], single[n], micro[n], expected, (float)expected, (int32_t)lrint(expected * 1e6));
+                    return 1;
+                }
+            }
+        }
+    }
+    printf("%s kernel matches adcVolts, %u frames x 16 calibrations\n", SPIW::adcKernelName(), (unsigned)frames);
+    return 0;
+}
+
+BenchResult skipped( const char* name, const char* why )
+{
+    BenchResult result;
+    result.name = name;
+    result.skipped = why;
+    return result;
+}
+
+std::string jsonString( const std::string &text )
+{
+    std::string out = "\"";
+    for( size_t i = 0; i < text.size(); ++i )
+    {
+        char c = text[i];
+        if( c == '"' || c == '\\' )
+            out += '\\';
+        if( (unsigned char)c < 0x20 )
+            continue;
+        out += c;
+    }
+    return out + "\"";
+}
+
+/// nearest rank percentile of sorted samples
+uint64_t percentile( const std::vector<uint64_t> &sorted, double p )
+{
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    if( rank > 0 )
+        rank--;
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+void writeResult( FILE* out, BenchResult &result, bool last )
+{
+    fprintf(out, "    { \"op\": %s", jsonString(result.name).c_str());
+    if( !result.skipped.empty() )
+    {
+        fprintf(out, ", \"skipped\": %s }%s\n", jsonString(result.skipped).c_str(), last ? "" : ",");
+        return;
+    }
+
+    std::vector<uint64_t> &s = result.samplesUs;
+    std::sort(s.begin(), s.end());
+    double sum = 0;
+    for( size_t i = 0; i < s.size(); ++i )
+        sum += s[i];
+    double mean = s.empty() ? 0 : sum / s.size();
+    double var = 0;
+    for( size_t i = 0; i < s.size(); ++i )
+        var += (s[i] - mean) * (s[i] - mean);
+    double stddev = s.size() > 1 ? sqrt(var / (s.size() - 1)) : 0;
+
+    // no bus time at all, getPINSTATECached on the virtual clock, has no rate
+    char opsPerSec[32] = "null";
+    if( result.totalUs > 0 )
+        snprintf(opsPerSec, sizeof(opsPerSec), "%.1f", s.size() * 1000000.0 / result.totalUs);
+
+    fprintf(out, ", \"address\": %d, \"iterations\": %d, \"errors\": %llu, \"opsPerSec\": %s,\n",
+            result.address, (int)s.size(), (unsigned long long)result.errors, opsPerSec);
+    fprintf(out, "      \"latencyUs\": { \"min\": %llu, \"mean\": %.1f, \"stddev\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu } }%s\n",
+            (unsigned long long)(s.empty() ? 0 : s.front()), mean, stddev,
+            (unsigned long long)(s.empty() ? 0 : percentile(s, 50)),
+            (unsigned long long)(s.empty() ? 0 : percentile(s, 90)),
+            (unsigned long long)(s.empty() ? 0 : percentile(s, 99)),
+            (unsigned long long)(s.empty() ? 0 : s.back()), last ? "" : ",");
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    bool sim = false;
+    bool realTime = false;
+    long latencyUs = -1;
+    long ackUs = -1;
+    int iterations = 1000;
+    int slowIterations = 20;
+    const char* outPath = NULL;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        if( strcmp(argv[i], "--sim") == 0 )
+            sim = true;
+        else if( strcmp(argv[i], "--realtime") == 0 )
+            realTime = true;
+        else if( strcmp(argv[i], "--latency-us") == 0 && i + 1 < argc )
+            latencyUs = atol(argv[++i]);
+        else if( strcmp(argv[i], "--ack-us") == 0 && i + 1 < argc )
+            ackUs = atol(argv[++i]);
+        else if( strcmp(argv[i], "--iterations") == 0 && i + 1 < argc )
+            iterations = std::max(1, atoi(argv[++i]));
+        else if( strcmp(argv[i], "--slow-iterations") == 0 && i + 1 < argc )
+            slowIterations = std::max(1, atoi(argv[++i]));
+        else if( strcmp(argv[i], "--out") == 0 && i + 1 < argc )
+            outPath = argv[++i];
+        else if( strcmp(argv[i], "--selftest") == 0 )
+            return selftest();
+        else
+        {
+            fprintf(stderr, "usage: %s [--sim] [--latency-us N] [--ack-us N] [--realtime] [--iterations N] [--slow-iterations N] [--out FILE] | --selftest\n", argv[0]);
+            return 2;
+        }
+    }
+
+    SPIW::SimulatedTransport* simBus = NULL;
+    if( sim )
+    {
+        // device latency is paid by every spi transfer, the DAQC2 ack comes on top of it; the
+        // response time stays put, the default frame timing would drop slower RELAY answers
+        simBus = SPIW::SimulatedTransport::fromEnvironment();
+        SPIW::SimTiming timing = simBus->getTiming();
+        if( latencyUs >= 0 )
+            timing.ioctlUs = (uint32_t)latencyUs;
+        if( ackUs >= 0 )
+            timing.ackUs = (uint32_t)ackUs;
+        simBus->setTiming(timing);
+        simBus->setRealTime(realTime);
+        SPIW::SPIBase::setTransport(simBus);
+    }
+
+    // PIPLATE_TRANSPORT=sim picks the simulator too
+    if( simBus == NULL )
+        simBus = dynamic_cast<SPIW::SimulatedTransport*>( SPIW::SPIBase::transport() );
+
+    SPIW::PlateRegistry &registry = SPIW::PlateRegistry::instance();
+    registry.discover();
+
+    SPIW::RELAYPlate* relay = NULL;
+    SPIW::DAQC2Plate* adc = NULL;
+    for( int board = 0; board < PP_MAX_BOARDS; ++board )
+    {
+        if( relay == NULL )
+            relay = registry.relay(board);
+        if( adc == NULL )
+            adc = registry.daqc2(board);
+    }
+
+    std::vector<BenchResult> results;
+    if( relay != NULL )
+    {
+        int address = relay->getAddress();
+        results.push_back( measure("setBit", address, iterations, [relay]() { return relay->setBit(1, STATE_TOGGLE) != STATE_ERROR; }) );
+        // getPINSTATE answers from the shadow, the bus read it stands for is a refresh (0x14)
+        results.push_back( measure("getPINSTATE", address, iterations, [relay]() { return relay->refresh() != STATE_ERROR && relay->getPINSTATE(1) != STATE_ERROR; }) );
+        results.push_back( measure("getPINSTATECached", address, iterations, [relay]() { return relay->getPINSTATE(1) != STATE_ERROR; }) );
+        relay->setBit(1, STATE_OFF);
+    }
+    else
+    {
+        results.push_back( skipped("setBit", "no RELAY plate") );
+        results.push_back( skipped("getPINSTATE", "no RELAY plate") );
+        results.push_back( skipped("getPINSTATECached", "no RELAY plate") );
+    }
+
+    SPIW::SPIBase* any = relay != NULL ? (SPIW::SPIBase*)relay : (SPIW::SPIBase*)adc;
+    if( any != NULL )
+    {
+        int address = any->getAddress();
+        results.push_back( measure("getBoardAddress", address, iterations, [any, address]() { return any->getBoardAddress() == address; }) );
+        results.push_back( measure("getID", address, iterations, [any]() { char id[PP_ID_SIZE]; return any->getID(id, sizeof(id)) >= 0; }) );
+    }
+    else
+    {
+        results.push_back( skipped("getBoardAddress", "no plate") );
+        results.push_back( skipped("getID", "no plate") );
+    }
+
+    if( adc != NULL )
+    {
+        int address = adc->getAddress();
+
+        // keep the snapshot hook out of the calibration numbers, it writes a file
+        adc->onCalibrated( SPIW::CalibrationCallback() );
+        results.push_back( measure("calibration", address, slowIterations, [adc]() { adc->ppCal(); return adc->isCalibrated(); }) );
+
+        double values[8];
+        double value;
+        int step = 0;
+        results.push_back( measure("getADCall", address, iterations, [adc, &values]() { return adc->getADCall(values) == 0; }) );
+        results.push_back( measure("getADC", address, iterations, [adc, &value]() { return adc->getADC(0, value) == 0; }) );
+        results.push_back( measure("setDAC", address, iterations, [adc, &step]() { return adc->setDAC(0, (step++ & 1) ? 2.0 : 1.0) == 0; }) );
+        adc->setDAC(0, 0);
+    }
+    else
+    {
+        const char* ops[] = { "calibration", "getADCall", "getADC", "setDAC" };
+        for( int i = 0; i < 4; ++i )
+            results.push_back( skipped(ops[i], "no DAQC2 plate") );
+    }
+
+    // last, a rescan deletes the plates used above
+    results.push_back( measure("discovery", -1, slowIterations, [&registry]() { return registry.discover(true) >= 0; }) );
+    results.push_back( measure("discoveryWarm", -1, slowIterations, [&registry]() { registry.shutdown(); return registry.discover() >= 0; }) );
+    registry.shutdown();
+
+    FILE* out = stdout;
+    if( outPath != NULL && (out = fopen(outPath, "w")) == NULL )
+    {
+        fprintf(stderr, "Unable to write %s\n", outPath);
+        return 1;
+    }
+    fprintf(out, "{\n  \"transport\": %s,\n", simBus != NULL ? "\"sim\"" : "\"spidev\"");
+    if( simBus != NULL )
+        fprintf(out, "  \"simLatencyUs\": %u,\n  \"simAckUs\": %u,\n", simBus->getTiming().ioctlUs, simBus->getTiming().ackUs);
+    fprintf(out, "  \"clock\": %s,\n  \"iterations\": %d,\n  \"slowIterations\": %d,\n  \"results\": [\n",
+            simBus != NULL && !realTime ? "\"virtual\"" : "\"monotonic\"", iterations, slowIterations);
+    for( size_t i = 0; i < results.size(); ++i )
+        writeResult(out, results[i], i + 1 == results.size());
+    fprintf(out, "  ]\n}\n");
+    if( out != stdout )
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include "busexecutor.h"
+
+namespace SPIW {
+
+/// how long the idle bus thread sleeps before it looks at running again, ms
+#define PP_EXECUTOR_IDLE        100
+
+/// the executor whose bus thread this is, set once by run()
+static thread_local BusExecutor* busThreadOf = NULL;
+
+/// the bus whose lock execute holds on this thread
+static thread_local PlateBus* heldBus = NULL;
+
+template <typename T>
+static void raiseMax(std::atomic<T> &max, T value)
+{
+    T seen = max.load();
+    while( value > seen && !max.compare_exchange_weak(seen, value) )
+        ;
+}
+
+BusExecutor::BusExecutor(PlateBus *x_bus)
+    : head(&stub)
+    , tail(&stub)
+    , bus(x_bus != NULL ? x_bus : &PlateBus::defaultBus())
+    , running(false)
+    , closed(true)
+    , entering(0)
+    , sleeping(false)
+    , submitted(0)
+    , completed(0)
+    , depth(0)
+    , maxDepth(0)
+    , waitTotalUs(0)
+    , waitMaxUs(0)
+    , serviceTotalUs(0)
+    , serviceMaxUs(0)
+{
+}
+
+BusExecutor::~BusExecutor()
+{
+    stop();
+}
+
+BusExecutor *BusExecutor::active()
+{
+    return PlateBus::defaultBus().executor();
+}
+
+uint64_t BusExecutor::nowMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+bool BusExecutor::start()
+{
+    if( running )
+        return true;
+    if( worker.joinable() )
+        worker.join();
+    closed = false;
+    running = true;
+    worker = std::thread(&BusExecutor::run, this);
+    bus->attachExecutor(this);
+    return true;
+}
+
+void BusExecutor::stop()
+{
+    if( !running )
+    {
+        bus->detachExecutor(this);
+        return;
+    }
+    running = false;
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        wake.notify_all();
+    }
+    if( worker.joinable() )
+        worker.join();
+}
+
+bool BusExecutor::onBusThread() const
+{
+    return busThreadOf == this;
+}
+
+bool BusExecutor::holdsLock(const PlateBus *x_bus)
+{
+    return heldBus == x_bus;
+}
+
+void BusExecutor::push(BusRequest *request)
+{
+    request->next.store(NULL, std::memory_order_relaxed);
+    BusRequest* prev = head.exchange(request, std::memory_order_acq_rel);
+    prev->next.store(request, std::memory_order_release);
+}
+
+BusRequest *BusExecutor::pop()
+{
+    BusRequest* first = tail;
+    BusRequest* next = first->next.load(std::memory_order_acquire);
+    if( first == &stub )
+    {
+        if( next == NULL )
+            return NULL;
+        tail = next;
+        first = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if( next != NULL )
+    {
+        tail = next;
+        return first;
+    }
+
+    // first is the last node, a producer may be half way through linking after it
+    if( first != head.load(std::memory_order_acquire) )
+        return NULL;
+
+    push(&stub);
+    next = first->next.load(std::memory_order_acquire);
+    if( next != NULL )
+    {
+        tail = next;
+        return first;
+    }
+    return NULL;
+}
+
+void BusExecutor::enqueue(BusRequest *request)
+{
+    request->submitUs = nowMicroseconds();
+    submitted++;
+    raiseMax(maxDepth, ++depth);
+
+    // the bus thread drains everything pushed before it saw closed, later requests run here under the bus lock
+    entering++;
+    if( closed.load() )
+    {
+        entering--;
+        execute(request);
+        return;
+    }
+    push(request);
+    entering--;
+
+    if( sleeping.load() )
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        wake.notify_one();
+    }
+}
+
+std::future<rtnStructure> BusExecutor::submit(SPIBase *board, const cmdStructure &cmd, int readbackBytes, bool stopAt0)
+{
+    BusRequest* request = new BusRequest();
+    request->board = board;
+    request->cmd = cmd;
+    request->readbackBytes = readbackBytes;
+    request->stopAt0 = stopAt0;
+    request->wantsFuture = true;
+    std::future<rtnStructure> result = request->result.get_future();
+    enqueue(request);
+    return result;
+}
+
+void BusExecutor::submit(SPIBase *board, const cmdStructure &cmd, int readbackBytes, bool stopAt0, BusCallback cb)
+{
+    BusRequest* request = new BusRequest();
+    request->board = board;
+    request->cmd = cmd;
+    request->readbackBytes = readbackBytes;
+    request->stopAt0 = stopAt0;
+    request->callback = cb;
+    enqueue(request);
+}
+
+std::future<void> BusExecutor::post(std::function<void ()> job)
+{
+    BusRequest* request = new BusRequest();
+    request->job = job;
+    std::future<void> done = request->done.get_future();
+    enqueue(request);
+    return done;
+}
+
+void BusExecutor::execute(BusRequest *request)
+{
+    depth--;
+    uint64_t start = nowMicroseconds();
+    uint64_t waited = start - request->submitUs;
+    waitTotalUs += waited;
+    raiseMax(waitMaxUs, waited);
+
+    // callers that found no executor, while it starts or stops, take the same lock
+    rtnStructure rtn;
+    {
+        std::lock_guard<std::mutex> guard(bus->lock());
+        PlateBus* outer = heldBus;
+        heldBus = bus;
+        if( request->job )
+            request->job();
+        else
+            rtn = request->board->SendCommand(request->cmd, request->readbackBytes, request->stopAt0);
+        heldBus = outer;
+    }
+
+    if( request->job )
+        request->done.set_value();
+    else if( request->wantsFuture )
+        request->result.set_value(rtn);
+    else if( request->callback )
+        request->callback(rtn);
+
+    uint64_t service = nowMicroseconds() - start;
+    serviceTotalUs += service;
+    raiseMax(serviceMaxUs, service);
+    completed++;
+    delete request;
+}
+
+void BusExecutor::run()
+{
+    busThreadOf = this;
+    while( true )
+    {
+        BusRequest* request = pop();
+        if( request != NULL )
+        {
+            execute(request);
+            continue;
+        }
+
+        // drain everything submitted before stop
+        if( !running && depth.load() == 0 )
+            break;
+
+        std::unique_lock<std::mutex> guard(sleepLock);
+        sleeping = true;
+        if( depth.load() == 0 && running )
+            wake.wait_for(guard, std::chrono::milliseconds(PP_EXECUTOR_IDLE));
+        sleeping = false;
+    }
+
+    // new callers take the mutex path, those already past the executor check are pushed or run inline
+    bus->detachExecutor(this);
+    closed = true;
+    while( entering.load() != 0 )
+        std::this_thread::yield();
+    for( BusRequest* request = pop(); request != NULL; request = pop() )
+        execute(request);
+}
+
+BusExecutorStats BusExecutor::stats() const
+{
+    BusExecutorStats s;
+    s.submitted = submitted;
+    s.completed = completed;
+    s.depth = depth;
+    s.maxDepth = maxDepth;
+    s.waitTotalUs = waitTotalUs;
+    s.waitMaxUs = waitMaxUs;
+    s.serviceTotalUs = serviceTotalUs;
+    s.serviceMaxUs = serviceMaxUs;
+    return s;
+}
+
+}
@@ -0,0 +1,168 @@
+#ifndef BUSEXECUTOR_H
+#define BUSEXECUTOR_H
+
+#include "spibase.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <thread>
+
+namespace SPIW {
+
+typedef std::function<void (const rtnStructure &)> BusCallback;
+
+/**
+ * @brief The BusRequest struct  One queued command, or a job to run on the bus thread.
+ */
+struct BusRequest
+{
+    std::atomic<BusRequest*>    next;
+
+    SPIBase*                    board;
+    cmdStructure                cmd;
+    int                         readbackBytes;
+    bool                        stopAt0;
+
+    /// set for a job instead of a single command
+    std::function<void ()>      job;
+
+    /// exactly one of these completes the request
+    std::promise<rtnStructure>  result;
+    std::promise<void>          done;
+    BusCallback                 callback;
+    bool                        wantsFuture;
+
+    /// monotonic usec at submit
+    uint64_t                    submitUs;
+
+    BusRequest()
+        : next(NULL)
+        , board(NULL)
+        , readbackBytes(0)
+        , stopAt0(false)
+        , wantsFuture(false)
+        , submitUs(0)
+    {
+    }
+};
+
+/**
+ * @brief The BusExecutorStats struct  Snapshot of the executor counters, times in micro seconds.
+ */
+struct BusExecutorStats
+{
+    uint64_t submitted;
+    uint64_t completed;
+
+    /// requests waiting right now and the most ever seen
+    uint32_t depth;
+    uint32_t maxDepth;
+
+    /// submit to start of execution
+    uint64_t waitTotalUs;
+    uint64_t waitMaxUs;
+
+    /// execution on the bus
+    uint64_t serviceTotalUs;
+    uint64_t serviceMaxUs;
+};
+
+/**
+ * @brief The BusExecutor class  Single owner thread of one PlateBus.
+ *
+ * Any thread submits commands through a lock free multi producer queue and gets a future or a
+ * callback back. While an executor runs, SPIBase::SendCommand from other threads to boards on its
+ * bus is routed through it, so frames never interleave and callers never sit on a mutex held across
+ * the frame delays. Each bus has its own, independent stacks transfer in parallel.
+ *
+ * Every request runs under the bus lock, so a caller that found no executor while it starts or stops
+ * never overlaps it. stop() drains the queue and detaches; a request submitted once the thread is
+ * gone, or before start, runs on the submitting thread under the bus lock. A caller may still hold the
+ * pointer PlateBus::executor gave it after stop, so an executor that was ever started must outlive every
+ * thread sending on its bus; PlateBus::startExecutor keeps its own until the bus goes.
+ */
+class BusExecutor
+{
+private :
+
+    /// Vyukov intrusive MPSC queue, producers exchange head, the bus thread owns tail
+    std::atomic<BusRequest*> head;
+    BusRequest*              tail;
+    BusRequest               stub;
+
+    /// the bus this thread owns
+    PlateBus*                bus;
+
+    std::thread              worker;
+    std::atomic<bool>        running;
+
+    /// set once the bus thread stopped taking requests, submitters then run theirs themselves
+    std::atomic<bool>        closed;
+    std::atomic<int>         entering;
+
+    /// only used to park the bus thread while the queue is empty
+    std::atomic<bool>        sleeping;
+    std::mutex               sleepLock;
+    std::condition_variable  wake;
+
+    std::atomic<uint64_t>    submitted;
+    std::atomic<uint64_t>    completed;
+    std::atomic<uint32_t>    depth;
+    std::atomic<uint32_t>    maxDepth;
+    std::atomic<uint64_t>    waitTotalUs;
+    std::atomic<uint64_t>    waitMaxUs;
+    std::atomic<uint64_t>    serviceTotalUs;
+    std::atomic<uint64_t>    serviceMaxUs;
+
+    void push( BusRequest* request );
+    BusRequest* pop();
+    void enqueue( BusRequest* request );
+    void execute( BusRequest* request );
+    void run();
+
+    BusExecutor( const BusExecutor& );
+    BusExecutor& operator=( const BusExecutor& );
+
+public:
+
+    /// the executor of x_bus, the default bus when NULL
+    BusExecutor( PlateBus* x_bus = NULL );
+
+    /// stops the thread after draining the queue
+    ~BusExecutor();
+
+    /// the running executor of the default bus, NULL when its commands run on the caller's thread
+    static BusExecutor* active();
+
+    /// monotonic clock the latency metrics use, usec
+    static uint64_t nowMicroseconds();
+
+    /// starts the bus thread and makes this the executor SendCommand routes through for its bus
+    bool start();
+
+    /// drains the queue, stops the thread, then detaches from the bus
+    void stop();
+
+    /// true when called from the bus thread of this executor
+    bool onBusThread() const;
+
+    /// true inside a request on x_bus, the bus lock is already held
+    static bool holdsLock( const PlateBus* x_bus );
+
+    /// queues a command, the future holds the response
+    std::future<rtnStructure> submit( SPIBase* board, const cmdStructure &cmd, int readbackBytes, bool stopAt0 = false );
+
+    /// queues a command, cb runs on the bus thread with the response
+    void submit( SPIBase* board, const cmdStructure &cmd, int readbackBytes, bool stopAt0, BusCallback cb );
+
+    /// runs job on the bus thread, for sequences that must not be split by other commands
+    std::future<void> post( std::function<void ()> job );
+
+    /// counters and latencies so far
+    BusExecutorStats stats() const;
+};
+
+}
+
+#endif // BUSEXECUTOR_H
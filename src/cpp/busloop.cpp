@@ -0,0 +1,285 @@
+#include "busloop.h"
+
+#ifdef PP_COROUTINES
+
+#include "pplog.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace SPIW {
+
+/// most fd events taken per runOnce
+#define PP_LOOP_EVENTS          16
+
+static std::atomic<BusLoop*> activeLoop(NULL);
+
+BusLoop::BusLoop()
+    : epollFd(-1)
+    , timerFd(-1)
+    , wakeFd(-1)
+    , timerSeq(0)
+    , armedUs(0)
+    , stopping(false)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if( !isValid() )
+    {
+        PP_ERROR() << "BusLoop: unable to create its fds, errno" << errno;
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = timerFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+    ev.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+    BusLoop* none = NULL;
+    activeLoop.compare_exchange_strong(none, this);
+}
+
+BusLoop::~BusLoop()
+{
+    BusLoop* self = this;
+    activeLoop.compare_exchange_strong(self, NULL);
+
+    if( epollFd >= 0 )
+        ::close(epollFd);
+    if( timerFd >= 0 )
+        ::close(timerFd);
+    if( wakeFd >= 0 )
+        ::close(wakeFd);
+}
+
+BusLoop *BusLoop::active()
+{
+    return activeLoop.load();
+}
+
+void BusLoop::activate()
+{
+    activeLoop.store(this);
+}
+
+uint64_t BusLoop::nowMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+bool BusLoop::isValid() const
+{
+    return epollFd >= 0 && timerFd >= 0 && wakeFd >= 0;
+}
+
+int BusLoop::fd() const
+{
+    return epollFd;
+}
+
+void BusLoop::armTimer()
+{
+    uint64_t next = timers.empty() ? 0 : timers.begin()->first.first;
+    if( next == armedUs )
+        return;
+    armedUs = next;
+
+    // absolute, a deadline already gone fires at once; all zero disarms
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if( next != 0 )
+    {
+        its.it_value.tv_sec = next / 1000000ULL;
+        its.it_value.tv_nsec = (next % 1000000ULL) * 1000;
+    }
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+BusLoop::TimerId BusLoop::addTimer(uint64_t deadlineUs, std::function<void ()> fn)
+{
+    // 0 means disarmed to armTimer
+    if( deadlineUs == 0 )
+        deadlineUs = 1;
+    TimerId id(deadlineUs, ++timerSeq);
+    timers[id] = fn;
+    armTimer();
+    return id;
+}
+
+void BusLoop::cancelTimer(const TimerId &id)
+{
+    timers.erase(id);
+    armTimer();
+}
+
+void BusLoop::runTimers()
+{
+    uint64_t now = nowMicroseconds();
+    while( !timers.empty() && timers.begin()->first.first <= now )
+    {
+        // off the map first, the handler may add or cancel timers
+        std::function<void ()> fn = timers.begin()->second;
+        timers.erase(timers.begin());
+        fn();
+    }
+    armedUs = 0;
+    armTimer();
+}
+
+void BusLoop::post(std::function<void ()> job)
+{
+    {
+        std::lock_guard<std::mutex> guard(postLock);
+        posted.push_back(job);
+    }
+    uint64_t one = 1;
+    if( ::write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN )
+        PP_ERROR() << "BusLoop: wakeup failed, errno" << errno;
+}
+
+void BusLoop::runPosted()
+{
+    uint64_t count;
+    while( ::read(wakeFd, &count, sizeof(count)) == (ssize_t)sizeof(count) )
+        ;
+
+    std::vector<std::function<void ()> > jobs;
+    {
+        std::lock_guard<std::mutex> guard(postLock);
+        jobs.swap(posted);
+    }
+    for( size_t i = 0; i < jobs.size(); ++i )
+        jobs[i]();
+}
+
+bool BusLoop::watch(int x_fd, uint32_t events, FdCallback cb)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = x_fd;
+    bool known = watches.find(x_fd) != watches.end();
+    if( epoll_ctl(epollFd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, x_fd, &ev) < 0 )
+    {
+        PP_ERROR() << "BusLoop: unable to watch fd" << x_fd << "errno" << errno;
+        return false;
+    }
+    watches[x_fd] = cb;
+    return true;
+}
+
+void BusLoop::unwatch(int x_fd)
+{
+    if( watches.erase(x_fd) == 0 )
+        return;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, x_fd, NULL);
+}
+
+int BusLoop::runOnce(int timeoutMs)
+{
+    struct epoll_event events[PP_LOOP_EVENTS];
+    int n = epoll_wait(epollFd, events, PP_LOOP_EVENTS, timeoutMs);
+    if( n < 0 )
+        return errno == EINTR ? 0 : -1;
+
+    int handled = 0;
+    bool timersDue = false;
+    for( int i = 0; i < n; ++i )
+    {
+        int x_fd = events[i].data.fd;
+        if( x_fd == timerFd )
+        {
+            uint64_t expirations;
+            while( ::read(timerFd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations) )
+                ;
+            timersDue = true;
+            continue;
+        }
+        if( x_fd == wakeFd )
+        {
+            runPosted();
+            handled++;
+            continue;
+        }
+
+        // looked up again, an earlier handler may have dropped the watch
+        std::map<int, FdCallback>::iterator it = watches.find(x_fd);
+        if( it == watches.end() )
+            continue;
+        FdCallback cb = it->second;
+        cb(events[i].events);
+        handled++;
+    }
+
+    // a short delay may be due before its timerfd wakeup was read
+    if( timersDue || (!timers.empty() && timers.begin()->first.first <= nowMicroseconds()) )
+    {
+        runTimers();
+        handled++;
+    }
+    return handled;
+}
+
+void BusLoop::run()
+{
+    stopping = false;
+    while( !stopping.load() )
+    {
+        if( runOnce(-1) < 0 )
+        {
+            PP_ERROR() << "BusLoop: epoll_wait failed, errno" << errno;
+            break;
+        }
+    }
+}
+
+void BusLoop::stop()
+{
+    post( [this]() { stopping = true; } );
+}
+
+void BusLoop::releaseBus(const void *key)
+{
+    Gate &gate = gates[key];
+    if( gate.waiters.empty() )
+    {
+        gate.held = false;
+        return;
+    }
+
+    // the bus passes straight on, the resume waits for the next turn so frames do not nest
+    std::coroutine_handle<> next = gate.waiters.front();
+    gate.waiters.pop_front();
+    addTimer(nowMicroseconds(), [next]() { next.resume(); });
+}
+
+void BusLoop::Readable::await_suspend(std::coroutine_handle<> h)
+{
+    handle = h;
+    Readable* self = this;
+    timer = loop->addTimer(nowMicroseconds() + usec, [self]()
+    {
+        self->loop->unwatch(self->fd);
+        self->ready = false;
+        self->handle.resume();
+    });
+    loop->watch(fd, EPOLLIN | EPOLLPRI, [self](uint32_t)
+    {
+        self->loop->unwatch(self->fd);
+        self->loop->cancelTimer(self->timer);
+        self->ready = true;
+        self->handle.resume();
+    });
+}
+
+}
+
+#endif // PP_COROUTINES
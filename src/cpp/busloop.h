@@ -0,0 +1,215 @@
+#ifndef BUSLOOP_H
+#define BUSLOOP_H
+
+#ifdef PP_COROUTINES
+
+#include "platetask.h"
+#include "spitransport.h"
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace SPIW {
+
+/// delays shorter than this run inline, a timer wakeup costs about as much, usec
+#define PP_LOOP_MIN_SLEEP       50
+
+/// told the epoll events of a watched fd
+typedef std::function<void (uint32_t events)> FdCallback;
+
+/**
+ * @brief The BusLoop class  Single threaded event loop the awaitable plate commands run on.
+ *
+ * Frame delays are timerfd wakeups and the DAQC2 ack wait is an fd readiness wait on the ppACK edge, so
+ * one thread drives every plate in the stack. watch() serves any other fd on the same thread, or fd()
+ * goes into an outer loop that calls runOnce(0) when it turns readable. Frames of one bus go out one at a
+ * time in await order, frames of different buses overlap; while a BusExecutor owns a bus, its commands
+ * are queued to it and resume here when done.
+ * Blocking plate calls on the loop thread stall every awaiting command, keep them off it.
+ */
+class BusLoop
+{
+private :
+
+    int epollFd;
+    int timerFd;
+    int wakeFd;
+
+    /// timers by deadline usec on the monotonic clock, the sequence keeps equal deadlines apart
+    std::map<std::pair<uint64_t, uint64_t>, std::function<void ()> > timers;
+    uint64_t timerSeq;
+    uint64_t armedUs;
+
+    std::map<int, FdCallback> watches;
+
+    /// jobs from other threads, run on the loop thread
+    std::mutex                          postLock;
+    std::vector<std::function<void ()> > posted;
+
+    std::atomic<bool> stopping;
+
+    /// per bus, frames waiting for it in await order
+    struct Gate
+    {
+        bool                                 held;
+        std::deque<std::coroutine_handle<> > waiters;
+
+        Gate() : held(false) {}
+    };
+    std::map<const void*, Gate> gates;
+
+    void armTimer();
+    void runTimers();
+    void runPosted();
+
+    BusLoop( const BusLoop& );
+    BusLoop& operator=( const BusLoop& );
+
+public:
+
+    /// a timer handed back by addTimer, for cancelTimer
+    typedef std::pair<uint64_t, uint64_t> TimerId;
+
+    /// creates the epoll, timer and wakeup fds, the first loop created becomes the active one
+    BusLoop();
+
+    ~BusLoop();
+
+    /// the loop command<> runs on, NULL when commands complete on the calling thread
+    static BusLoop* active();
+
+    /// makes this the loop command<> runs on
+    void activate();
+
+    /// monotonic clock of the timers, usec
+    static uint64_t nowMicroseconds();
+
+    /// false when the fds could not be created, nothing runs on such a loop
+    bool isValid() const;
+
+    /// epoll fd, readable when runOnce has work, for nesting in another loop
+    int fd() const;
+
+    /// waits up to timeoutMs (-1 forever) and runs what is ready, returns the handlers run or < 0 on error
+    int runOnce( int timeoutMs = -1 );
+
+    /// runs until stop
+    void run();
+
+    /// makes run return, safe from any thread
+    void stop();
+
+    /// runs job on the loop thread, safe from any thread
+    void post( std::function<void ()> job );
+
+    /// calls cb on the loop thread while fd has events (level triggered), replaces an earlier watch of fd
+    bool watch( int fd, uint32_t events, FdCallback cb );
+
+    void unwatch( int fd );
+
+    /// calls fn on the loop thread once at deadlineUs
+    TimerId addTimer( uint64_t deadlineUs, std::function<void ()> fn );
+
+    void cancelTimer( const TimerId &id );
+
+    /// co_await suspends for usec, inline when the bus clock is virtual or the delay is under PP_LOOP_MIN_SLEEP
+    struct Delay
+    {
+        BusLoop*      loop;
+        SPITransport* bus;
+        uint32_t      usec;
+
+        bool await_ready()
+        {
+            if( bus != NULL && (!bus->realTimeDelays() || usec < PP_LOOP_MIN_SLEEP) )
+            {
+                bus->delayMicroseconds(usec);
+                return true;
+            }
+            return usec == 0;
+        }
+
+        void await_suspend( std::coroutine_handle<> h )
+        {
+            loop->addTimer(nowMicroseconds() + usec, [h]() { h.resume(); });
+        }
+
+        void await_resume() {}
+    };
+
+    /// co_await is true once fd is readable, false after usec without
+    struct Readable
+    {
+        BusLoop*                loop;
+        int                     fd;
+        uint32_t                usec;
+        bool                    ready;
+        TimerId                 timer;
+        std::coroutine_handle<> handle;
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        void await_suspend( std::coroutine_handle<> h );
+
+        bool await_resume()
+        {
+            return ready;
+        }
+    };
+
+    /// co_await holds a bus, any key naming it, frames queue in await order, give it back with releaseBus
+    struct BusGate
+    {
+        Gate* gate;
+
+        bool await_ready()
+        {
+            if( gate->held )
+                return false;
+            gate->held = true;
+            return true;
+        }
+
+        void await_suspend( std::coroutine_handle<> h )
+        {
+            gate->waiters.push_back(h);
+        }
+
+        void await_resume() {}
+    };
+
+    Delay delay( SPITransport* bus, uint32_t usec )
+    {
+        return Delay { this, bus, usec };
+    }
+
+    Delay sleep( uint32_t usec )
+    {
+        return Delay { this, NULL, usec };
+    }
+
+    Readable readable( int x_fd, uint32_t usec )
+    {
+        return Readable { this, x_fd, usec, false, TimerId(), std::coroutine_handle<>() };
+    }
+
+    BusGate acquireBus( const void* key )
+    {
+        return BusGate { &gates[key] };
+    }
+
+    /// hands the bus to the next waiting frame, which resumes on a later turn of the loop
+    void releaseBus( const void* key );
+};
+
+}
+
+#endif // PP_COROUTINES
+
+#endif // BUSLOOP_H
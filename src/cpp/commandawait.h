@@ -0,0 +1,159 @@
+#ifndef COMMANDAWAIT_H
+#define COMMANDAWAIT_H
+
+#ifdef PP_COROUTINES
+
+#include "busloop.h"
+#include "commandframe.h"
+
+namespace SPIW {
+
+/*
+ * The awaitable send path of SPIBase, built with CONFIG += pp_coroutines (C++20). A command awaited on
+ * the BusLoop thread runs there: ppFRAME setup and hold, the RELAY post write delay and the DAQC2 ack
+ * waits suspend the command instead of the thread. The spi transfers themselves stay blocking ioctls of a
+ * few tens of usec. References handed to an awaitable must live until it completes.
+ */
+
+/// queues a command to the BusExecutor, the bus thread completes it and the loop resumes the awaiter
+struct ExecutorAwaiter
+{
+    BusLoop*      loop;
+    BusExecutor*  executor;
+    SPIBase*      board;
+    cmdStructure  cmd;
+    int           readbackBytes;
+    bool          stopAt0;
+    rtnStructure  rtn;
+
+    bool await_ready()
+    {
+        return false;
+    }
+
+    void await_suspend( std::coroutine_handle<> h )
+    {
+        ExecutorAwaiter* self = this;
+        executor->submit(board, cmd, readbackBytes, stopAt0, [self, h](const rtnStructure &result)
+        {
+            self->rtn = result;
+            self->loop->post( [h]() { h.resume(); } );
+        });
+    }
+
+    rtnStructure await_resume()
+    {
+        return rtn;
+    }
+};
+
+template<bool Ack, bool Reads, bool StopAt0>
+PlateTask<rtnStructure> SPIBase::frameAsync(BusLoop &loop, cmdStructure cmd, int readbackBytes)
+{
+    const int wireBytes = Reads ? readbackBytes + (Ack ? 1 : 0) : 0;
+    rtnStructure rtn(wireBytes);
+    cmd.txbuff[0] += getAddress();
+
+    if( busTransport()->getFd() < 0 )
+    {
+        rtn.nbr_rtn = 0;
+        rtn.valid = false;
+        PP_ERROR() << 1400 << "Unable to open SPI bus device. Make sure SPI is enabled by raspi-config tool.";
+        co_return rtn;
+    }
+
+    // frames of this loop queue on the gate of the bus, a blocking caller on another thread is polled off it
+    uint64_t since = busTransport()->nowMicroseconds();
+    co_await loop.acquireBus(_bus);
+    while( !busLock().try_lock() )
+        co_await loop.sleep(PP_ACK_POLL);
+    if( TraceRing::enabled() )
+        FrameProbe::busWait(busTransport(), cmd, getAddress(), since);
+
+    if( Ack && !getAckPin() )
+        PP_DEBUG() << "ppACK still low from last move.";
+    FrameProbe probe(busTransport(), cmd, getAddress());
+
+    busTransport()->setFrame(true);
+    co_await loop.delay(busTransport(), _timing.frameSetupUs);
+    probe.split(TraceFrameRaise);
+    if( !busTransport()->getFrame() )
+        PP_ERROR() << "Unable to Enable a ppFRAME";
+    probe.mark(PhaseFrameUp);
+
+    int rw = busTransport()->write(cmd.txbuff, cmd.cmdSize());
+    probe.mark(PhaseWrite);
+    if( rw < 0 )
+    {
+        PP_ERROR() << "failed transport()->write(cmd.txbuff, cmd.cmdSize());";
+        rtn.nbr_rtn = 0;
+        rtn.valid = false;
+    }
+    else
+    {
+        bool acked = true;
+        if( Ack )
+            acked = co_await waitOnAckAsync(loop, PP_ACK_TIMEOUT);
+        else
+            co_await loop.delay(busTransport(), _timing.postWriteUs);
+
+        if( Reads && acked )
+        {
+            if( Ack )
+                acked = co_await waitOnAckAsync(loop, PP_ACK_READ_TIMEOUT);
+            probe.mark(PhaseAckWait);
+            if( acked && readResponse(rtn, wireBytes, StopAt0) < 0 )
+                PP_ERROR() << "spiRead Error";
+            probe.mark(PhaseReadback);
+        }
+        else
+        {
+            probe.mark(PhaseAckWait);
+            rtn.nbr_rtn = 0;
+        }
+        if( !acked )
+            probe.ackTimeout();
+    }
+
+    busTransport()->setFrame(false);
+    co_await loop.delay(busTransport(), _timing.frameHoldUs);
+    if( busTransport()->getFrame() )
+        PP_ERROR() << "Unable to Disable a ppFRAME";
+    probe.mark(PhaseFrameDown);
+    probe.done(rtn);
+
+    busLock().unlock();
+    loop.releaseBus(_bus);
+    co_return rtn;
+}
+
+template<PlateCommand C>
+PlateTask<rtnStructure> SPIBase::command(uint8_t arg1, uint8_t arg2, uint8_t unit)
+{
+    typedef CommandTraits<C> T;
+    static_assert( T::readback <= PP_MAX_READBACK, "readback beyond PP_MAX_READBACK" );
+    if( !T::accepts(arg1, arg2, unit) )
+    {
+        rtnStructure rtn(0);
+        rtn.valid = false;
+        co_return rtn;
+    }
+    cmdStructure cmd(T::opcode + unit, arg1, arg2);
+
+    BusLoop* loop = BusLoop::active();
+    if( loop == NULL )
+        co_return route<T::ack, T::reads, T::stopAt0>(cmd, T::readback);
+
+    // the bus thread owns the transport, the loop only waits for its answer
+    BusExecutor* executor = _bus->executor();
+    if( executor != NULL && !executor->onBusThread() )
+        co_return co_await ExecutorAwaiter { loop, executor, this, cmd, T::readback, T::stopAt0, rtnStructure() };
+
+    co_return co_await frameAsync<T::ack, T::reads, T::stopAt0>(*loop, cmd, T::readback);
+}
+
+}
+
+#endif // PP_COROUTINES
+
+#endif // COMMANDAWAIT_H
@@ -0,0 +1,157 @@
+#ifndef COMMANDFRAME_H
+#define COMMANDFRAME_H
+
+#include "busexecutor.h"
+#include "frameprobe.h"
+#include "spibase.h"
+
+namespace SPIW {
+
+/*
+ * The typed send path of SPIBase. Only the plate sources include this, every frame shape they use is
+ * instantiated there.
+ */
+
+template<bool Ack, bool Reads, bool StopAt0>
+rtnStructure SPIBase::frame(cmdStructure cmd, int readbackBytes)
+{
+    if( Ack && !getAckPin() )
+        PP_DEBUG() << "ppACK still low from last move.";
+
+    // a DAQC2 sends one byte more after ppACK
+    const int wireBytes = Reads ? readbackBytes + (Ack ? 1 : 0) : 0;
+    rtnStructure rtn(wireBytes);
+    cmd.txbuff[0] += getAddress();
+    FrameProbe probe(busTransport(), cmd, getAddress());
+
+    if( busTransport()->getFd() < 0 )
+    {
+        rtn.nbr_rtn = 0;
+        rtn.valid = false;
+        PP_ERROR() << 1400 << "Unable to open SPI bus device. Make sure SPI is enabled by raspi-config tool.";
+        probe.done(rtn);
+        return rtn;
+    }
+
+    enableFrame(&probe);
+    probe.mark(PhaseFrameUp);
+    int rw = busTransport()->write(cmd.txbuff, cmd.cmdSize());
+    probe.mark(PhaseWrite);
+    if( rw < 0 )
+    {
+        PP_ERROR() << "failed transport()->write(cmd.txbuff, cmd.cmdSize());";
+        rtn.nbr_rtn = 0;
+        rtn.valid = false;
+    }
+    else
+    {
+        // the RELAY has no ack line, the post write delay is its wait
+        bool acked = true;
+        if( Ack )
+            acked = waitOnAck(PP_ACK_TIMEOUT);
+        else
+            busTransport()->delayMicroseconds(_timing.postWriteUs);
+
+        if( Reads && acked )
+        {
+            if( Ack )
+                acked = waitOnAck(PP_ACK_READ_TIMEOUT);
+            probe.mark(PhaseAckWait);
+            if( acked && readResponse(rtn, wireBytes, StopAt0) < 0 )
+            {
+                PP_ERROR() << "spiRead Error";
+                probe.invalidResponse();
+            }
+            probe.mark(PhaseReadback);
+        }
+        else
+        {
+            probe.mark(PhaseAckWait);
+            rtn.nbr_rtn = 0;
+        }
+        // no ppACK means the board never took the frame, nothing it sent back is data
+        if( !acked )
+        {
+            rtn.nbr_rtn = 0;
+            rtn.valid = false;
+            probe.ackTimeout();
+        }
+    }
+    disableFrame();
+    probe.mark(PhaseFrameDown);
+    probe.done(rtn);
+    return rtn;
+}
+
+template<bool Ack, bool Reads, bool StopAt0>
+rtnStructure SPIBase::route(const cmdStructure &cmd, int readbackBytes)
+{
+    // the bus thread owns the transport, everyone else queues
+    BusExecutor* executor = _bus->executor();
+    if( executor != NULL && !executor->onBusThread() )
+    {
+        rtnStructure rtn;
+        executor->post( [this, &cmd, readbackBytes, &rtn]() { rtn = frame<Ack, Reads, StopAt0>(cmd, readbackBytes); } ).get();
+        return rtn;
+    }
+
+    // inside a queued request the bus lock is already held
+    if( BusExecutor::holdsLock(_bus) )
+        return frame<Ack, Reads, StopAt0>(cmd, readbackBytes);
+
+    if( !TraceRing::enabled() )
+    {
+        std::lock_guard<std::mutex> guard(busLock());
+        return frame<Ack, Reads, StopAt0>(cmd, readbackBytes);
+    }
+
+    // show who held the bus up in the trace
+    uint64_t since = busTransport()->nowMicroseconds();
+    std::lock_guard<std::mutex> guard(busLock());
+    FrameProbe::busWait(busTransport(), cmd, getAddress(), since);
+    return frame<Ack, Reads, StopAt0>(cmd, readbackBytes);
+}
+
+template<PlateCommand C>
+rtnStructure SPIBase::send(uint8_t arg1, uint8_t arg2, uint8_t unit)
+{
+    typedef CommandTraits<C> T;
+    static_assert( T::readback <= PP_MAX_READBACK, "readback beyond PP_MAX_READBACK" );
+    if( !T::accepts(arg1, arg2, unit) )
+    {
+        rtnStructure rtn(0);
+        rtn.valid = false;
+        return rtn;
+    }
+    cmdStructure cmd(T::opcode + unit, arg1, arg2);
+    return route<T::ack, T::reads, T::stopAt0>(cmd, T::readback);
+}
+
+template<PlateCommand C, uint8_t Arg1, uint8_t Arg2>
+rtnStructure SPIBase::send()
+{
+    typedef CommandTraits<C> T;
+    static_assert( T::readback <= PP_MAX_READBACK, "readback beyond PP_MAX_READBACK" );
+    static_assert( T::accepts(Arg1, Arg2, 0), "argument out of the range plateCommands gives" );
+    cmdStructure cmd(T::opcode, Arg1, Arg2);
+    return route<T::ack, T::reads, T::stopAt0>(cmd, T::readback);
+}
+
+template<PlateCommand C>
+rtnStructure SPIBase::exchange(uint8_t arg1, uint8_t arg2, uint8_t unit)
+{
+    typedef CommandTraits<C> T;
+    static_assert( T::readback <= PP_MAX_READBACK, "readback beyond PP_MAX_READBACK" );
+    if( !T::accepts(arg1, arg2, unit) )
+    {
+        rtnStructure rtn(0);
+        rtn.valid = false;
+        return rtn;
+    }
+    cmdStructure cmd(T::opcode + unit, arg1, arg2);
+    return frame<T::ack, T::reads, T::stopAt0>(cmd, T::readback);
+}
+
+}
+
+#endif // COMMANDFRAME_H
@@ -1,36 +1,327 @@
+#include <coreexports.h>
 #include <relayplate.h>
+#include <plateregistry.h>
+#include <metrics.h>
+#include <tracering.h>
 
-int SetPinState(uint8_t boardId, uint8_t pin, uint8_t state)
+/// the handle is the registry of a bus plus its open count, nothing is allocated per caller
+struct PiPlatesContext
 {
-    SPIW::RELAYPlate relay(24 + boardId);
-    if (state == 1)
+    SPIW::PlateRegistry* registry;
+    int opens;
+};
+
+/// one handle per bus, the default bus first
+static PiPlatesContext contexts[PP_MAX_BUSES];
+
+static PiPlatesContext* contextFor(SPIW::PlateRegistry &registry)
+{
+    PiPlatesContext* free = NULL;
+    for ( int i = 0; i < PP_MAX_BUSES; ++i )
+    {
+        if (contexts[i].registry == &registry)
+        {
+            return &contexts[i];
+        }
+        if (free == NULL && contexts[i].registry == NULL)
+        {
+            free = &contexts[i];
+        }
+    }
+    if (free != NULL)
     {
-        relay.setBit(pin, STATE_ON);
+        free->registry = &registry;
     }
-    else
+    return free;
+}
+
+/// the registry behind a handle from PlatesOpen or PlatesOpenBus, NULL for anything else
+static SPIW::PlateRegistry* registryOf(PiPlatesContext* context)
+{
+    if (context < &contexts[0] || context >= &contexts[PP_MAX_BUSES])
+    {
+        return NULL;
+    }
+    return context->registry;
+}
+
+static PiPlatesContext* openRegistry(SPIW::PlateRegistry &registry)
+{
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex());
+
+    // discovery opens the device, a stack without a spi bus has nothing to hand out
+    registry.discover();
+    if (registry.getBus().transport()->getFd() < 0)
+    {
+        return NULL;
+    }
+    PiPlatesContext* context = contextFor(registry);
+    if (context != NULL)
+    {
+        context->opens++;
+    }
+    return context;
+}
+
+PiPlatesContext* PlatesOpen(void)
+{
+    return openRegistry(SPIW::PlateRegistry::instance());
+}
+
+PiPlatesContext* PlatesOpenBus(uint8_t pinFrame, uint8_t pinSRQ, uint8_t pinACK, int device, int spiBus)
+{
+    SPIW::PlateBus* bus = SPIW::PlateBus::forConfig(SPIW::BusConfig(pinFrame, pinSRQ, pinACK, device, spiBus));
+    if (bus == NULL)
+    {
+        return NULL;
+    }
+    return openRegistry(SPIW::PlateRegistry::forBus(*bus));
+}
+
+void PlatesClose(PiPlatesContext* context)
+{
+    SPIW::PlateRegistry* registry = registryOf(context);
+    if (registry == NULL)
+    {
+        return;
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(registry->mutex());
+    if (context->opens > 0 && --context->opens == 0)
+    {
+        registry->shutdown();
+    }
+}
+
+int PlatesRelayCount(PiPlatesContext* context)
+{
+    SPIW::PlateRegistry* registry = registryOf(context);
+    if (registry == NULL)
     {
-        relay.setBit(pin, STATE_OFF);
+        return SPIERROR;
     }
-    return 0;
+    return registry->relaysAvailable();
 }
 
-int RelaysAvailable()
+int PlatesSetRelays(PiPlatesContext* context, const PiPlatesRelayOp* ops, int count, int* status)
 {
-    int boardsAvailable = 0;
-    for ( int adr = 24; adr < 24 +8; ++adr )
+    SPIW::PlateRegistry* bound = registryOf(context);
+    if (bound == NULL || ops == NULL || count < 0)
     {
-        if( SPIW::RELAYPlate::isRelayValid(adr ) )
+        return SPIERROR;
+    }
+
+    SPIW::PlateRegistry &registry = *bound;
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex());
+
+    // fold the ops into the image in order, later ops on a relay win
+    SPIW::RelayImage image = registry.relayImage();
+    int rtn = 0;
+    for ( int i = 0; i < count; ++i )
+    {
+        const PiPlatesRelayOp &op = ops[i];
+        bool valid = op.board < PP_MAX_BOARDS && op.pin >= 1 && op.pin <= 7 && op.state <= STATE_TOGGLE
+                && registry.relay(op.board) != NULL;
+        if (status != NULL)
+        {
+            status[i] = valid ? 0 : SPIERROR;
+        }
+        if (!valid)
+        {
+            rtn = SPIERROR;
+            continue;
+        }
+
+        size_t bit = op.board * 7 + op.pin - 1;
+        if (op.state == STATE_TOGGLE)
         {
-            qDebug() << "FOUND RELAY CARD AT ADDRESS " << adr;
-            SPIW::RELAYPlate relay(adr);
-            if( relay.ValidBoard())
+            image.flip(bit);
+        }
+        else
+        {
+            image.set(bit, op.state == STATE_ON);
+        }
+    }
+
+    int results[PP_MAX_BOARDS];
+    if (registry.applyImage(image, results) != 0)
+    {
+        rtn = SPIERROR;
+    }
+
+    // an op fails with the frame of its board
+    if (status != NULL)
+    {
+        for ( int i = 0; i < count; ++i )
+        {
+            if (status[i] == 0 && results[ops[i].board] == SPIERROR)
             {
-                qDebug() << relay.getFWRevision() << "   " << relay.getHWRevision() << relay.getID();
+                status[i] = SPIERROR;
             }
-
-            boardsAvailable++;
         }
     }
+    return rtn;
+}
+
+int PlatesGetRelays(PiPlatesContext* context, uint8_t* masks, int count)
+{
+    SPIW::PlateRegistry* bound = registryOf(context);
+    if (bound == NULL || masks == NULL || count < 0)
+    {
+        return SPIERROR;
+    }
+
+    SPIW::PlateRegistry &registry = *bound;
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex());
+
+    if (count > PP_MAX_BOARDS)
+    {
+        count = PP_MAX_BOARDS;
+    }
+    SPIW::RelayImage image = registry.relayImage();
+    for ( int board = 0; board < count; ++board )
+    {
+        masks[board] = (uint8_t)((image >> (board * 7)).to_ulong() & PP_RELAY_MASK);
+    }
+    return count;
+}
+
+int PlatesRescan(PiPlatesContext* context)
+{
+    SPIW::PlateRegistry* registry = registryOf(context);
+    if (registry == NULL)
+    {
+        return SPIERROR;
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(registry->mutex());
+    return registry->discover(true);
+}
+
+/// the masks of boards 0..7 as one image
+static SPIW::RelayImage imageOf(const uint8_t *masks)
+{
+    SPIW::RelayImage image;
+    for ( int board = 0; board < PP_MAX_BOARDS; ++board )
+    {
+        image |= SPIW::RelayImage(masks[board] & PP_RELAY_MASK) << (board * 7);
+    }
+    return image;
+}
+
+int PlatesApplyRelays(PiPlatesContext* context, const uint8_t* masks, int* results)
+{
+    SPIW::PlateRegistry* registry = registryOf(context);
+    if (registry == NULL || masks == NULL)
+    {
+        return SPIERROR;
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(registry->mutex());
+    return registry->applyImage(imageOf(masks), results);
+}
+
+int SetPinState(uint8_t boardId, uint8_t pin, uint8_t state)
+{
+    SPIW::PlateRegistry &registry = SPIW::PlateRegistry::instance();
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex());
+
+    SPIW::RELAYPlate *relay = registry.relay(boardId);
+    if (relay == NULL)
+    {
+        return SPIERROR;
+    }
+
+    int rtn;
+    if (state == 1)
+    {
+        rtn = relay->setBit(pin, STATE_ON);
+    }
+    else
+    {
+        rtn = relay->setBit(pin, STATE_OFF);
+    }
+    return rtn == STATE_ERROR ? SPIERROR : 0;
+}
+
+int RelaysAvailable(void)
+{
+    // one echo per address, id and revisions wait until somebody asks
+    return SPIW::PlateRegistry::instance().relaysAvailable();
+}
+
+int RescanRelays(void)
+{
+    SPIW::PlateRegistry &registry = SPIW::PlateRegistry::instance();
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex());
+    registry.discover(true);
+    return registry.relaysAvailable();
+}
+
+int ApplyRelayImage(const uint8_t *masks, int *results)
+{
+    if (masks == NULL)
+    {
+        return SPIERROR;
+    }
+
+    SPIW::PlateRegistry &registry = SPIW::PlateRegistry::instance();
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex());
+    return registry.applyImage(imageOf(masks), results);
+}
 
-    return boardsAvailable;
-}
\ No newline at end of file
+static_assert( PIPLATES_METRIC_PHASES == SPIW::PhaseCount && PIPLATES_METRIC_BUCKETS == PP_METRIC_BUCKETS
+               && PIPLATES_METRIC_OPCODES == PP_METRIC_OPCODES && PIPLATES_METRIC_BOARDS == PP_METRIC_BOARDS,
+               "PiPlatesMetrics out of step with MetricsSnapshot" );
+
+int PlatesGetMetrics(PiPlatesMetrics* metrics, int size)
+{
+    if (metrics == NULL || size != (int)sizeof(PiPlatesMetrics))
+    {
+        return SPIERROR;
+    }
+
+    SPIW::MetricsSnapshot snap;
+    SPIW::Metrics::snapshot(snap);
+    metrics->frames = snap.frames;
+    metrics->errors = snap.errors;
+    metrics->ackTimeouts = snap.ackTimeouts;
+    metrics->invalidResponses = snap.invalidResponses;
+    metrics->retries = snap.retries;
+    memcpy(metrics->phaseCount, snap.phaseCount, sizeof(metrics->phaseCount));
+    memcpy(metrics->phaseSumUs, snap.phaseSumUs, sizeof(metrics->phaseSumUs));
+    memcpy(metrics->phaseBuckets, snap.phaseBuckets, sizeof(metrics->phaseBuckets));
+    memcpy(metrics->opcodeFrames, snap.opcodeFrames, sizeof(metrics->opcodeFrames));
+    memcpy(metrics->opcodeErrors, snap.opcodeErrors, sizeof(metrics->opcodeErrors));
+    memcpy(metrics->boardFrames, snap.boardFrames, sizeof(metrics->boardFrames));
+    memcpy(metrics->boardErrors, snap.boardErrors, sizeof(metrics->boardErrors));
+    memcpy(metrics->boardAckTimeouts, snap.boardAckTimeouts, sizeof(metrics->boardAckTimeouts));
+    return snap.enabled ? 1 : 0;
+}
+
+void PlatesResetMetrics(void)
+{
+    SPIW::Metrics::reset();
+}
+
+void PlatesTraceEnable(int on)
+{
+    SPIW::TraceRing::instance().enable(on != 0);
+}
+
+void PlatesTraceClear(void)
+{
+    SPIW::TraceRing::instance().clear();
+}
+
+int PlatesTraceDump(const char* path)
+{
+    if (path == NULL)
+        return -1;
+    return SPIW::TraceRing::instance().dumpChrome(path);
+}
+
+void ShutdownPlates(void)
+{
+    SPIW::PlateRegistry::instance().shutdown();
+}
@@ -1,3 +1,121 @@
-export "C" int SetPinState(uint8_t boardId, uint8_t pin, uint8_t state);
+#ifndef COREEXPORTS_H
+#define COREEXPORTS_H
 
-export "C" int int RelaysAvailable();
\ No newline at end of file
+#include <stdint.h>
+
+/*
+ * C ABI of libRelayPlate for managed callers.
+ *
+ * Every entry point works on caller owned memory and allocates nothing. The batch calls take a
+ * whole set of relay changes in one call, so a P/Invoke caller pays one transition per batch.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// opaque handle of a plate stack, from PlatesOpen or PlatesOpenBus
+typedef struct PiPlatesContext PiPlatesContext;
+
+/// one relay change of a batch, state 0 off, 1 on, 2 toggle
+typedef struct PiPlatesRelayOp
+{
+    uint8_t board;
+    uint8_t pin;
+    uint8_t state;
+    uint8_t reserved;
+} PiPlatesRelayOp;
+
+/// discovers the stack on first use, returns NULL when there is no spi bus, pair with PlatesClose
+PiPlatesContext* PlatesOpen(void);
+
+/// same for the stack on these wiringPi pins, chip select and spi controller (0 or 1), every
+/// handle of a stack is the same, returns NULL when there is no such bus
+PiPlatesContext* PlatesOpenBus(uint8_t pinFrame, uint8_t pinSRQ, uint8_t pinACK, int device, int spiBus);
+
+/// releases the handle, the last close of a stack releases its plates and spi device
+void PlatesClose(PiPlatesContext* context);
+
+/// number of relay plates of the stack
+int PlatesRelayCount(PiPlatesContext* context);
+
+/// scans every address again and rewrites the snapshot, for plates added or removed while the
+/// process runs, returns the number of plates or -1; plates handed out before are gone
+int PlatesRescan(PiPlatesContext* context);
+
+/// applies count relay changes, one RELAYALL frame per board that changes, status gets 0 or -1
+/// per op, returns 0 or -1 if any op failed
+int PlatesSetRelays(PiPlatesContext* context, const PiPlatesRelayOp* ops, int count, int* status);
+
+/// copies the relay masks of boards 0..count-1 (bit n-1 is relay n, absent boards 0) into masks,
+/// returns the number of boards written or -1
+int PlatesGetRelays(PiPlatesContext* context, uint8_t* masks, int count);
+
+/// switches every board to its mask of masks[8] in one go, results[8] gets 0 unchanged, 1 written,
+/// 2 absent or -1 failed per board, returns 0 or -1
+int PlatesApplyRelays(PiPlatesContext* context, const uint8_t* masks, int* results);
+
+/// sizes of the PiPlatesMetrics tables
+#define PIPLATES_METRIC_PHASES   6
+#define PIPLATES_METRIC_BUCKETS  32
+#define PIPLATES_METRIC_OPCODES  256
+#define PIPLATES_METRIC_BOARDS   64
+
+/// frame counters of the library, phases are frame up, write, ack wait, readback, frame down and
+/// the whole frame, bucket 0 counts 0 usec, bucket n 2^(n-1) up to 2^n - 1 usec. errors counts every
+/// invalid frame, ackTimeouts and invalidResponses (failed readbacks) are the causes; retries counts
+/// the RELAYALL writes the coalescing worker tried again after a failure
+typedef struct PiPlatesMetrics
+{
+    uint64_t frames;
+    uint64_t errors;
+    uint64_t ackTimeouts;
+    uint64_t invalidResponses;
+    uint64_t retries;
+
+    uint64_t phaseCount[PIPLATES_METRIC_PHASES];
+    uint64_t phaseSumUs[PIPLATES_METRIC_PHASES];
+    uint64_t phaseBuckets[PIPLATES_METRIC_PHASES][PIPLATES_METRIC_BUCKETS];
+
+    uint64_t opcodeFrames[PIPLATES_METRIC_OPCODES];
+    uint64_t opcodeErrors[PIPLATES_METRIC_OPCODES];
+
+    /// by bus address, RELAY 24..31, DAQC2 32..39
+    uint64_t boardFrames[PIPLATES_METRIC_BOARDS];
+    uint64_t boardErrors[PIPLATES_METRIC_BOARDS];
+    uint64_t boardAckTimeouts[PIPLATES_METRIC_BOARDS];
+} PiPlatesMetrics;
+
+/// copies the counters into metrics, size is sizeof(PiPlatesMetrics) of the caller, returns 1,
+/// 0 when the library was built without metrics (all counters 0) or -1
+int PlatesGetMetrics(PiPlatesMetrics* metrics, int size);
+
+/// sets every counter back to 0
+void PlatesResetMetrics(void);
+
+/// starts (on != 0) or stops recording bus transactions into the trace ring
+void PlatesTraceEnable(int on);
+
+/// drops every recorded transaction
+void PlatesTraceClear(void);
+
+/// writes the trace ring to path in chrome://tracing JSON, returns 0 or -1
+int PlatesTraceDump(const char* path);
+
+/// single relay calls kept for existing callers
+int SetPinState(uint8_t boardId, uint8_t pin, uint8_t state);
+
+int RelaysAvailable(void);
+
+/// PlatesRescan of the default stack, returns the number of relay plates
+int RescanRelays(void);
+
+int ApplyRelayImage(const uint8_t* masks, int* results);
+
+void ShutdownPlates(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COREEXPORTS_H
@@ -0,0 +1,248 @@
+#include "dacwaveform.h"
+
+namespace SPIW {
+
+/// value of generator at fraction p 0..1 of its period
+static double generatorVolts(const WaveformGenerator &generator, double p)
+{
+    switch( generator.shape )
+    {
+    case WaveformGenerator::sine:
+        return generator.offset + generator.amplitude * sin(2 * M_PI * p);
+    case WaveformGenerator::square:
+        return generator.offset + (p < generator.duty ? generator.amplitude : -generator.amplitude);
+    case WaveformGenerator::triangle:
+        return generator.offset + generator.amplitude * (p < 0.5 ? 4 * p - 1 : 3 - 4 * p);
+    case WaveformGenerator::ramp:
+        return generator.offset + generator.amplitude * (2 * p - 1);
+    default:
+        return generator.offset;
+    }
+}
+
+DacWaveform::DacWaveform(DAQC2Plate *x_board)
+    : board(x_board)
+    , loaded(0)
+    , generated(0)
+    , compiledHz(0)
+    , running(false)
+    , looping(true)
+    , rateHz(0)
+    , updates(0)
+    , missed(0)
+    , errors(0)
+    , jitterTotalUs(0)
+    , jitterMaxUs(0)
+    , startUs(0)
+    , lastUs(0)
+{
+}
+
+DacWaveform::~DacWaveform()
+{
+    stop();
+}
+
+int DacWaveform::load(int channel, const double *volts, size_t count)
+{
+    if( running || channel < 0 || channel >= PP_MAX_DAC || volts == NULL || count == 0 )
+        return SPIERROR;
+    samples[channel].assign(volts, volts + count);
+    loaded |= 1 << channel;
+    generated &= ~(1 << channel);
+    compiledHz = 0;
+    return 0;
+}
+
+int DacWaveform::load(int channel, const WaveformGenerator &generator)
+{
+    if( running || channel < 0 || channel >= PP_MAX_DAC || generator.frequencyHz < 0 )
+        return SPIERROR;
+    samples[channel].clear();
+    generators[channel] = generator;
+    loaded |= 1 << channel;
+    generated |= 1 << channel;
+    compiledHz = 0;
+    return 0;
+}
+
+int DacWaveform::unload(int channel)
+{
+    if( running || channel < 0 || channel >= PP_MAX_DAC )
+        return SPIERROR;
+    samples[channel].clear();
+    tables[channel].clear();
+    loaded &= ~(1 << channel);
+    generated &= ~(1 << channel);
+    return 0;
+}
+
+int DacWaveform::compile(double hz)
+{
+    if( running || board == NULL || hz <= 0 )
+        return SPIERROR;
+
+    for( int channel = 0; channel < PP_MAX_DAC; ++channel )
+    {
+        tables[channel].clear();
+        if( (loaded & (1 << channel)) == 0 )
+            continue;
+
+        std::vector<double> volts;
+        if( generated & (1 << channel) )
+        {
+            // one whole period in updates, a constant needs a single one
+            const WaveformGenerator &generator = generators[channel];
+            size_t count = 1;
+            if( generator.shape != WaveformGenerator::constant && generator.frequencyHz > 0 )
+                count = std::max(1L, lround(hz / generator.frequencyHz));
+            volts.resize(count);
+            for( size_t k = 0; k < count; ++k )
+            {
+                double p = (double)k / count + generator.phase;
+                volts[k] = generatorVolts(generator, p - floor(p));
+            }
+        }
+        else
+            volts = samples[channel];
+
+        // calibration and rounding once here instead of on every update
+        tables[channel].resize(volts.size());
+        for( size_t k = 0; k < volts.size(); ++k )
+        {
+            uint16_t code = board->dacCode(channel, volts[k]);
+            tables[channel][k].hi = code >> 8;
+            tables[channel][k].lo = code & 0xff;
+        }
+    }
+    compiledHz = hz;
+    return 0;
+}
+
+bool DacWaveform::start(double hz, bool loop)
+{
+    if( running || hz <= 0 || board == NULL || loaded == 0 )
+        return false;
+    if( player.joinable() )
+        player.join();
+    if( compiledHz != hz && compile(hz) != 0 )
+        return false;
+
+    rateHz = hz;
+    looping = loop;
+    updates = 0;
+    missed = 0;
+    errors = 0;
+    jitterTotalUs = 0;
+    jitterMaxUs = 0;
+
+    uint64_t periodUs = (uint64_t)(1000000.0 / hz);
+    if( periodUs == 0 )
+        periodUs = 1;
+
+    running = true;
+    player = std::thread(&DacWaveform::run, this, periodUs);
+    return true;
+}
+
+void DacWaveform::stop()
+{
+    running = false;
+    if( player.joinable() )
+        player.join();
+}
+
+void DacWaveform::run(uint64_t periodUs)
+{
+    SPITransport* bus = board->getBus().transport();
+    uint64_t start = bus->nowMicroseconds();
+    uint64_t tick = 0;
+    startUs = start;
+    lastUs = start;
+
+    size_t longest = 0;
+    for( int channel = 0; channel < PP_MAX_DAC; ++channel )
+        longest = std::max(longest, tables[channel].size());
+
+    // nothing sent yet, the first tick writes every loaded channel
+    uint16_t sent[PP_MAX_DAC] = { 0xffff, 0xffff, 0xffff, 0xffff };
+
+    while( running )
+    {
+        uint64_t due = start + tick * periodUs;
+        uint64_t now = bus->nowMicroseconds();
+        if( now < due )
+        {
+            uint64_t wait = due - now;
+            bus->delayMicroseconds( wait < PP_WAVE_SLICE ? (uint32_t)wait : PP_WAVE_SLICE );
+            continue;
+        }
+
+        // a whole period late, skip to the update we are in so the output keeps its phase
+        uint64_t behind = (now - due) / periodUs;
+        if( behind > 0 )
+        {
+            missed += behind;
+            tick += behind;
+            due = start + tick * periodUs;
+        }
+        if( !looping && tick >= longest )
+            break;
+
+        uint64_t late = now - due;
+        jitterTotalUs += late;
+        uint64_t seen = jitterMaxUs.load();
+        while( late > seen && !jitterMaxUs.compare_exchange_weak(seen, late) )
+            ;
+
+        uint16_t codes[PP_MAX_DAC];
+        uint8_t mask = 0;
+        for( int channel = 0; channel < PP_MAX_DAC; ++channel )
+        {
+            const std::vector<DacCode> &codesOf = tables[channel];
+            if( codesOf.empty() )
+                continue;
+
+            // a table that ran out holds its last code until the longest one is done
+            size_t index = looping ? tick % codesOf.size() : std::min<size_t>(tick, codesOf.size() - 1);
+            codes[channel] = (codesOf[index].hi << 8) | codesOf[index].lo;
+            if( codes[channel] != sent[channel] )
+                mask |= 1 << channel;
+        }
+        tick++;
+
+        if( mask != 0 && board->setDACcodes(codes, mask) != 0 )
+        {
+            errors++;
+            for( int channel = 0; channel < PP_MAX_DAC; ++channel )
+                sent[channel] = 0xffff;
+            continue;
+        }
+        for( int channel = 0; channel < PP_MAX_DAC; ++channel )
+        {
+            if( mask & (1 << channel) )
+                sent[channel] = codes[channel];
+        }
+        updates++;
+        lastUs = bus->nowMicroseconds();
+    }
+    running = false;
+}
+
+DacWaveformStats DacWaveform::stats() const
+{
+    DacWaveformStats s;
+    s.requestedHz = rateHz;
+    s.updates = updates;
+    s.missed = missed;
+    s.errors = errors;
+
+    uint64_t ticks = s.updates + s.errors;
+    uint64_t elapsed = lastUs - startUs;
+    s.achievedHz = elapsed > 0 ? (double)s.updates * 1000000.0 / elapsed : 0;
+    s.jitterMeanUs = ticks > 0 ? (double)jitterTotalUs / ticks : 0;
+    s.jitterMaxUs = jitterMaxUs;
+    return s;
+}
+
+}
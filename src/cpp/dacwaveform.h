@@ -0,0 +1,163 @@
+#ifndef DACWAVEFORM_H
+#define DACWAVEFORM_H
+
+#include "daqc2plate.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace SPIW {
+
+/// longest single sleep of the player, so stop() is quick at low rates, usec
+#define PP_WAVE_SLICE           100000
+
+/**
+ * @brief The WaveformGenerator struct  A periodic output described instead of sampled.
+ *
+ * The output swings amplitude volts around offset. One period is sampled at the update rate and
+ * rounded to a whole number of updates, so the frequency played is rate / round(rate / frequency).
+ */
+struct WaveformGenerator
+{
+    enum shapes { constant = 0, sine, square, triangle, ramp };
+
+    shapes  shape;
+    double  frequencyHz;
+    double  amplitude;
+    double  offset;
+
+    /// start of the period, 0..1
+    double  phase;
+
+    /// square only, part of the period spent high, 0..1
+    double  duty;
+
+    WaveformGenerator( shapes x_shape = constant, double x_frequencyHz = 0, double x_amplitude = 0, double x_offset = 0 )
+        : shape(x_shape)
+        , frequencyHz(x_frequencyHz)
+        , amplitude(x_amplitude)
+        , offset(x_offset)
+        , phase(0)
+        , duty(0.5)
+    {
+    }
+};
+
+/**
+ * @brief The DacCode struct  One calibrated DAC update, the two bytes of the 0x40 frame.
+ */
+struct DacCode
+{
+    uint8_t hi;
+    uint8_t lo;
+};
+
+/**
+ * @brief The DacWaveformStats struct  Counters of a DacWaveform since start.
+ */
+struct DacWaveformStats
+{
+    double   requestedHz;
+    double   achievedHz;
+
+    /// updates played, channels whose code did not change are not sent again
+    uint64_t updates;
+
+    /// update times skipped because the player fell a whole period behind
+    uint64_t missed;
+
+    /// failed DAC writes
+    uint64_t errors;
+
+    /// start of the write against its deadline, usec
+    double   jitterMeanUs;
+    uint64_t jitterMaxUs;
+};
+
+/**
+ * @brief The DacWaveform class  Plays precomputed DAC codes on a DAQC2 at a fixed update rate.
+ *
+ * Channels are loaded as volts, either sample arrays or generators, and compile() turns them into
+ * calibrated hi/lo codes once, so playback does no math. The player keeps a deadline grid from start()
+ * like AdcStream; every tick writes the channels that changed back to back in one bus hold, on the bus
+ * thread when a BusExecutor runs. A tick that is a whole period late is skipped, the table index
+ * moves on with time so the output keeps its phase, and the skip is counted as missed.
+ */
+class DacWaveform
+{
+private :
+
+    DAQC2Plate*           board;
+
+    /// what was loaded, volts per update or a generator
+    std::vector<double>   samples[PP_MAX_DAC];
+    WaveformGenerator     generators[PP_MAX_DAC];
+    uint8_t               loaded;
+    uint8_t               generated;
+
+    /// compiled codes and the rate they were compiled for
+    std::vector<DacCode>  tables[PP_MAX_DAC];
+    double                compiledHz;
+
+    std::thread           player;
+    std::atomic<bool>     running;
+    bool                  looping;
+    double                rateHz;
+
+    std::atomic<uint64_t> updates;
+    std::atomic<uint64_t> missed;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> jitterTotalUs;
+    std::atomic<uint64_t> jitterMaxUs;
+    std::atomic<uint64_t> startUs;
+    std::atomic<uint64_t> lastUs;
+
+    void run( uint64_t periodUs );
+
+    DacWaveform( const DacWaveform& );
+    DacWaveform& operator=( const DacWaveform& );
+
+public:
+
+    explicit DacWaveform( DAQC2Plate* x_board );
+
+    /// stops the player
+    ~DacWaveform();
+
+    /// channel 0..3 plays volts, one value per update, returns 0 or SPIERROR
+    int load( int channel, const double* volts, size_t count );
+
+    /// channel 0..3 plays the generator, returns 0 or SPIERROR
+    int load( int channel, const WaveformGenerator &generator );
+
+    /// channel stops being updated
+    int unload( int channel );
+
+    /// turns what is loaded into DAC codes for updates at hz, start() does it when needed,
+    /// returns 0 or SPIERROR
+    int compile( double hz );
+
+    /// the compiled codes of channel, empty when not loaded
+    const std::vector<DacCode> &table( int channel ) const
+    {
+        return tables[channel & (PP_MAX_DAC - 1)];
+    }
+
+    /// plays at hz, loop false stops after the longest table, false if already running or nothing loaded
+    bool start( double hz, bool loop = true );
+
+    /// stops and joins the player, the outputs stay at their last code
+    void stop();
+
+    bool isRunning() const
+    {
+        return running;
+    }
+
+    /// counters so far
+    DacWaveformStats stats() const;
+};
+
+}
+
+#endif // DACWAVEFORM_H
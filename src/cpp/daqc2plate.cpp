@@ -1,126 +1,33 @@
-#include <QTime>
-#include <QString>
-#include <QVariant>
-
 #include "daqc2plate.h"
+#include "adcconvert.h"
+#include "commandframe.h"
+#ifdef PP_COROUTINES
+#include "commandawait.h"
+#endif
 
 namespace SPIW {
 
-rtnStructure DAQC2Plate::SendCommand(cmdStructure cmd, int readbackBytes, bool stopAt0)
+int DAQC2Plate::getADCall(double values[8])
 {
-   if (!getAckPin())
-       qDebug() << "ppACK still low from last move.";
-
-    rtnStructure rtn(readbackBytes + 1);
-    cmd.txbuff[0] += getAddress();
-
-    //int fd =  wiringPiSPISetup (getODevice(), PP_SPI_BUS_SPEED);
-    int fd =  wiringPiSPIGetFd(getODevice());
-    if(fd < 0)
-    {
-        rtn.nbr_rtn = 0;
-        qDebug() << 1400 << "Unable to open SPI bus device. Make sure SPI is enabled by raspi-config tool.";
-    }
-    else
-    {
-        bool DataGood = true;
-        enableFrame();
-        int rw = wiringPiSPIDataRW(getODevice(), cmd.txbuff, cmd.cmdSize());
-        if( rw < 0)
-        {
-           rtn.valid = false;
-           qDebug() << " DAQC2 failed wiringPiSPIDataRW(getODevice(), cmd.txbuff, cmd.cmdSize());";
-           return rtn;
-        }
-
-        DataGood = waitOnAck(50);
-
-        if( (readbackBytes > 0  || stopAt0) && DataGood)
-        {
-            readbackBytes++;
-            DataGood = waitOnAck(80);
-
-            int i = 0;
-            uint8_t byte[1] = {0x00};
-            uint32_t mode = SPI_CPHA | SPI_RX_DUAL | SPI_TX_DUAL | SPI_NO_CS;
-
-            while(i < readbackBytes && i < rtn.maxRtnSize() && DataGood )
-            {
-                if ( spiRead(fd, &byte[0], 1, PP_SPI_BUS_SPEED, mode, 20) < 0)
-                {
-                    qDebug() << "spiRead Error";
-                    rtn.nbr_rtn = i;
-                    rtn.valid = false;
-                    break;
-                }
-                // stop at zero terminator
-                if((byte[0] == 0x0) && stopAt0)
-                {
-                    rtn.nbr_rtn = i;
-                    rtn.rtn[i] = byte[0];
-                    if ( spiRead(fd, &byte[0], 1, PP_SPI_BUS_SPEED, mode, 20) < 0)
-                    {
-                          qDebug() << "spiRead Error";
-                          rtn.valid = false;
-                    }
-                    else
-                    {
-                         rtn.rtn[++i] = byte[0];
-                    }
-                    rtn.nbr_rtn = i;
-                    break;
-
-                }
-                rtn.rtn[i] = byte[0];
-                i++;
-            }
-        }
-        else
-        {
-           rtn.nbr_rtn = 0;
-        }
-    }
-    disableFrame();
-    return rtn;
-}
+    ::memset(values, 0, sizeof(values[0]) * 8);
+    uint8_t resp[PP_ADC_FRAME_BYTES];
+    if( getADCallRaw(resp) != 0 )
+        return SPIERROR;
 
-bool DAQC2Plate::waitOnAck(int usec )
-{
-    QTime v;
-    bool Wait = true;
-    v.start();
-    while( Wait)
-    {
-        if( !getAckPin() )
-        {
-           return true;
-        }
-        if(v.elapsed() > usec)
-        {
-           break;
-        }
-     }
-    return false;
+    ensureCal();
+    for(int i = 0; i < 8; i++)
+        values[i] = adcVolts(resp[2*i], resp[2*i+1], calScale[i], calOffset[i]);
+    return 0;
 }
 
-
-int DAQC2Plate::getADCall(double values[8])
+int DAQC2Plate::getADCallRaw(uint8_t raw[16])
 {
-    cmdStructure cmd(0x31);
-    rtnStructure rtn = SendCommand( cmd, 16, false );
-    ::memset(values, 0, sizeof(values[0]) * 8);
-    if( rtn.valid)
-    {
-        uint8_t *resp = rtn.rtn;
-        for(int i = 0; i < 8; i++)
-        {
-            values[i]=(256*resp[2*i]+resp[2*i+1]);
-            values[i]=(values[i]*24.0/65536)-12.0;
-            values[i]=values[i]*calScale[i]+calOffset[i];
-        }
-        return 0;
-    }
-    return SPIERROR;
+    static_assert( CommandTraits<Daqc2GetAdcAll>::readback == PP_ADC_FRAME_BYTES, "getADCall answers one ADC frame" );
+    rtnStructure rtn = send<Daqc2GetAdcAll>();
+    if( !rtn.valid)
+        return SPIERROR;
+    ::memcpy(raw, rtn.rtn, PP_ADC_FRAME_BYTES);
+    return 0;
 }
 
 int DAQC2Plate::getADC(int channel, double &value)
@@ -129,24 +36,24 @@ int DAQC2Plate::getADC(int channel, double &value)
         ;
     else
         return SPIERROR;
+    if( channel < 8 )
+        ensureCal();
 
     // ppCMD(addr,0x30,channel,0,2);
-    cmdStructure cmd(0x30,channel,0);
-    rtnStructure rtn = SendCommand( cmd, 2, false );
+    rtnStructure rtn = send<Daqc2GetAdc>(channel);
     if( !rtn.valid)
     {
         return SPIERROR;
     }
     uint8_t *resp = rtn.rtn;
-    value=(256*resp[0]+resp[1]);
 
     if (channel==8)
-        value=value*5.0*2.4/65536;
-    else
     {
-        value=(value*24.0/65536)-12.0;
-        value=value*calScale[channel]+calOffset[channel];
+        value=(256*resp[0]+resp[1]);
+        value=value*5.0*2.4/65536;
     }
+    else
+        value=adcVolts(resp[0], resp[1], calScale[channel], calOffset[channel]);
 
     return 0;
 }
@@ -154,8 +61,7 @@ int DAQC2Plate::getADC(int channel, double &value)
 uint8_t DAQC2Plate::CalGetByte(int ptr)
 {
     // resp=ppCMD(addr,0xFD,2,ptr,1)
-    cmdStructure cmd(0xfd,2,ptr);
-    rtnStructure rtn = SendCommand( cmd, 1, false );
+    rtnStructure rtn = send<Daqc2ReadCal>(2, ptr);
     if( rtn.valid)
         return( rtn.rtn[0]);
     return 0;
@@ -164,73 +70,151 @@ uint8_t DAQC2Plate::CalGetByte(int ptr)
 
 int DAQC2Plate::setDAC(int channel, double volts)
 {
-    double percent;
-    uint16_t digval;
-    uint8_t hibyte = 0;
-    uint8_t lobyte = 0;
-
-    if(volts < 0)
-        volts = 0;
-    else if ( volts >= 4.095)
-        volts = 4.095;
-
-    int ichannel = channel;
-
-    if (ichannel >= 0 && ichannel < 4)
+    if (channel >= 0 && channel < PP_MAX_DAC)
         ;
     else
     {
-        qDebug() <<  "ERROR: DAC channel %d must be 0, 1, or 3 ";
+        PP_ERROR() <<  "ERROR: DAC channel must be 0, 1, 2 or 3 " << channel;
         return SPIERROR;
     }
 
-   percent = volts * 100.0 / PP_MAX_DAC_VOLT;
-   digval = round(percent * PP_MAX_DAC_BITRES / 100.0);
+    return setDACcode(channel, dacCode(channel, volts));
+}
+
+uint16_t DAQC2Plate::dacCode(int channel, double volts)
+{
+    if( channel >= 0 && channel < PP_MAX_DAC )
+        ensureCal();
+    return codeFor(channel, volts);
+}
+
+uint16_t DAQC2Plate::codeFor(int channel, double volts)
+{
+    if(volts < 0)
+        volts = 0;
+    else if ( volts >= PP_DAQC2_DAC_VOLT)
+        volts = PP_DAQC2_DAC_VOLT;
+
+    // the DAC takes milli volts, calDAC is the factory gain of the channel
+    double dac = 1;
+    if( channel >= 0 && channel < PP_MAX_DAC && calDAC[channel] > 0 )
+        dac = calDAC[channel];
+    long digval = lround(volts / dac * 1000.0);
+    if (digval > PP_DAQC2_DAC_CODE)
+        digval = PP_DAQC2_DAC_CODE;
+    return (uint16_t)digval;
+}
 
-   if (digval > 4095)
-        digval =4095;
+int DAQC2Plate::setDACcode(int channel, uint16_t code)
+{
+    if (channel >= 0 && channel < PP_MAX_DAC && code <= PP_DAQC2_DAC_CODE)
+        ;
+    else
+        return SPIERROR;
 
-   hibyte = digval >> 8;
-   lobyte = digval - (hibyte << 8);
+   uint8_t hibyte = code >> 8;
+   uint8_t lobyte = code & 0xff;
 
-   cmdStructure cmd(0x40+channel,hibyte,lobyte);
-   rtnStructure rtn = SendCommand( cmd, 0, false );
+   rtnStructure rtn = send<Daqc2SetDac>(hibyte, lobyte, channel);
    if( !rtn.valid)
    {
-       qDebug() << "Error DAC command failed";
+       PP_ERROR() << "Error DAC command failed";
        return SPIERROR;
    }
    return 0;
 }
 
-void DAQC2Plate::ppCal()
+int DAQC2Plate::setDACcodes(const uint16_t codes[], uint8_t mask)
 {
-    short values[6];
-    for( int i = 0; i < 8; ++i)
+    int rtn = 0;
+    exclusive( [this, codes, mask, &rtn]()
     {
-        for( int j = 0; j < 6; j++)
+        for( int channel = 0; channel < PP_MAX_DAC; ++channel )
         {
-            values[j]=CalGetByte(6*i+j);
+            if( (mask & (1 << channel)) == 0 )
+                continue;
+            if( !exchange<Daqc2SetDac>((codes[channel] >> 8) & 0x0f, codes[channel] & 0xff, channel).valid )
+                rtn = SPIERROR;
         }
-        short cSign=values[0] & 0x80;
-        calScale[i]=0.04*((values[0]&0x7F)*256+values[1])/32767;
-        if (cSign != 0)
-            calScale[i] *= -1;
-        calScale[i]+=1;
+    });
+    return rtn;
+}
 
-        cSign=values[2]&0x80;
-        calOffset[i]=0.2*((values[2]&0x7F)*256+values[3])/32767;  // #16 bit signed offset calibration values - range is +/- 0.1
+bool DAQC2Plate::CalGetBlock(int start, int count, uint8_t *buff)
+{
+    // the firmware answers one byte per 0xFD, so the block is count frames with nothing between them
+    bool valid = true;
+    exclusive( [&]()
+    {
+        for( int i = 0; i < count && valid; ++i )
+        {
+            rtnStructure rtn = exchange<Daqc2ReadCal>(2, start + i);
+            valid = rtn.valid;
+            buff[i] = rtn.rtn[0];
+        }
+    } );
+    return valid;
+}
 
-        if (cSign != 0)
-            calOffset[i] *= -1;
-        cSign=values[4] & 0x80;
-        calDAC[i]=0.04*((values[4]&0x7F)*256+values[5])/32767; //#16 bit signed DAC calibration values - range is +/-4%
+void DAQC2Plate::ppCal()
+{
+    uint8_t block[CalBytes];
+    if( !CalGetBlock(0, CalBytes, block) )
+    {
+        PP_WARN() << "DAQC2 at" << getAddress() << "calibration read failed, using defaults";
+        return;
+    }
+    applyCal(block);
+}
 
-        if (cSign != 0)
-            calDAC[i] *= -1;
-        calDAC[i] += 1;
+/// one 16 bit calibration word, sign bit and 15 bit magnitude over range
+static double calWord(const uint8_t *word, double range)
+{
+    double value = range*((word[0]&0x7F)*256+word[1])/32767;
+    if( (word[0] & 0x80) != 0 )
+        value *= -1;
+    return value;
+}
 
+void DAQC2Plate::applyCal(const uint8_t *block)
+{
+    for( int i = 0; i < 8; ++i)
+    {
+        const uint8_t* values = block + CalBytesPerChannel * i;
+        calScale[i] = calWord(values, 0.04) + 1;
+        calOffset[i] = calWord(values + 2, 0.2);  // #16 bit signed offset calibration values - range is +/- 0.1
+        calDAC[i] = calWord(values + 4, 0.04) + 1; //#16 bit signed DAC calibration values - range is +/-4%
     }
+    calibrated = true;
+    if( calibratedCb )
+        calibratedCb(*this);
+}
+
+bool DAQC2Plate::matchesCalibration(const PlateCalibration &cal)
+{
+    // scale and offset of channel 0, decoded as applyCal does, so equal means the same bytes
+    uint8_t words[4];
+    if( !CalGetBlock(0, 4, words) )
+        return false;
+    return calWord(words, 0.04) + 1 == cal.scale[0] && calWord(words + 2, 0.2) == cal.offset[0];
+}
+
+PlateCalibration DAQC2Plate::getCalibration()
+{
+    ensureCal();
+    PlateCalibration cal;
+    std::copy( &calScale[0], &calScale[8], cal.scale );
+    std::copy( &calOffset[0], &calOffset[8], cal.offset );
+    std::copy( &calDAC[0], &calDAC[8], cal.dac );
+    return cal;
+}
+
+void DAQC2Plate::setCalibration(const PlateCalibration &cal)
+{
+    std::copy( &cal.scale[0], &cal.scale[8], calScale );
+    std::copy( &cal.offset[0], &cal.offset[8], calOffset );
+    std::copy( &cal.dac[0], &cal.dac[8], calDAC );
+    calibrated = true;
 }
 
 int DAQC2Plate::setBit(int pin, int state)
@@ -239,23 +223,21 @@ int DAQC2Plate::setBit(int pin, int state)
         ;
     else
         return STATE_ERROR;
-    uint8_t _state;
+    rtnStructure rtn;
 
     switch (state) {
     case STATE_OFF:
-        _state = 0x11;
+        rtn = send<Daqc2ClearDout>(pin);
         break;
     case STATE_ON:
-        _state = 0x10;
+        rtn = send<Daqc2SetDout>(pin);
         break;
     case STATE_TOGGLE:
-        _state = 0x12;
+        rtn = send<Daqc2ToggleDout>(pin);
         break;
     default:
          return( STATE_ERROR);
     }
-    cmdStructure cmd(_state, pin, 0);
-    rtnStructure rtn = SendCommand( cmd, 0, false );
     if( !rtn.valid)
         return( STATE_ERROR);
 
@@ -270,8 +252,7 @@ int DAQC2Plate::getBit(int pin, int &bit)
     else
         return STATE_ERROR;
 
-    cmdStructure cmd(0x20, bit, 0);
-    rtnStructure rtn = SendCommand( cmd, 1, false );
+    rtnStructure rtn = send<Daqc2GetDin>(pin);
     if( !rtn.valid)
         return( STATE_ERROR);
 
@@ -282,8 +263,7 @@ int DAQC2Plate::getBit(int pin, int &bit)
 int DAQC2Plate::getAllBits(int &inputByte)
 {
 
-    cmdStructure cmd(0x25, 0, 0);
-    rtnStructure rtn = SendCommand( cmd, 1, false );
+    rtnStructure rtn = send<Daqc2GetDinAll>();
     if( !rtn.valid)
         return( STATE_ERROR);
 
@@ -299,23 +279,21 @@ int DAQC2Plate::enableDinIRQ(int pin, int when)
     else
         return STATE_ERROR;
 
-    uint8_t _cmd;
+    rtnStructure rtn;
 
     switch (when) {
     case INT_EDGE_FALLING:
-        _cmd = 0x21;
+        rtn = send<Daqc2DinIrqFalling>(pin);
         break;
     case INT_EDGE_RISING:
-        _cmd = 0x22;
+        rtn = send<Daqc2DinIrqRising>(pin);
         break;
     case INT_EDGE_BOTH :
-         _cmd = 0x23;
+        rtn = send<Daqc2DinIrqBoth>(pin);
         break;
     default:
        return STATE_ERROR;
     }
-    cmdStructure cmd(_cmd, pin, 0);
-    rtnStructure rtn = SendCommand( cmd, 0, false );
     if( !rtn.valid)
         return( STATE_ERROR);
     return 0;
@@ -328,8 +306,7 @@ int DAQC2Plate::disableDinIRQ(int pin)
         ;
     else
         return STATE_ERROR;
-    cmdStructure cmd(0x24, pin, 0);
-    rtnStructure rtn = SendCommand( cmd, 0, false );
+    rtnStructure rtn = send<Daqc2DinIrqOff>(pin);
     if( !rtn.valid)
         return( STATE_ERROR);
     return 0;
@@ -337,8 +314,7 @@ int DAQC2Plate::disableDinIRQ(int pin)
 
 int DAQC2Plate::intEnable()
 {
-    cmdStructure cmd(0x04, 0, 0);
-    rtnStructure rtn = SendCommand( cmd, 0, false );
+    rtnStructure rtn = send<Daqc2IntEnable>();
     if( !rtn.valid)
         return( STATE_ERROR);
     return 0;
@@ -346,8 +322,7 @@ int DAQC2Plate::intEnable()
 
 int DAQC2Plate::intDisable()
 {
-    cmdStructure cmd(0x05, 0, 0);
-    rtnStructure rtn = SendCommand( cmd, 0, false );
+    rtnStructure rtn = send<Daqc2IntDisable>();
     if( !rtn.valid)
         return( STATE_ERROR);
     return 0;
@@ -355,8 +330,7 @@ int DAQC2Plate::intDisable()
 
 int DAQC2Plate::getINTflags(unsigned short &reg)
 {
-    cmdStructure cmd(0x04, 0, 0);
-    rtnStructure rtn = SendCommand( cmd, 2, false );
+    rtnStructure rtn = send<Daqc2GetIntFlags>();
     if( !rtn.valid)
         return( STATE_ERROR);
 
@@ -370,8 +344,7 @@ int DAQC2Plate::setLedCondition(DAQC2Plate::leds led)
 
     int x_led = 0;
     x_led += led;  /// for debugging purposes
-    cmdStructure cmd(0x60, x_led, 0);
-    rtnStructure rtn = SendCommand( cmd, 0, false );
+    rtnStructure rtn = send<Daqc2SetLed>(x_led);
     if( !rtn.valid)
         return( STATE_ERROR);
     return 0;
@@ -379,8 +352,7 @@ int DAQC2Plate::setLedCondition(DAQC2Plate::leds led)
 
 int DAQC2Plate::getLedCondition(DAQC2Plate::leds &led)
 {
-    cmdStructure cmd(0x63, 0, 0);
-    rtnStructure rtn = SendCommand( cmd, 1, false );
+    rtnStructure rtn = send<Daqc2GetLed>();
     if( !rtn.valid)
         return( STATE_ERROR);
 
@@ -388,6 +360,122 @@ int DAQC2Plate::getLedCondition(DAQC2Plate::leds &led)
     return 0;
 }
 
+#ifdef PP_COROUTINES
+PlateTask<int> DAQC2Plate::ppCalAsync()
+{
+    uint8_t block[CalBytes];
+    for( int i = 0; i < CalBytes; ++i )
+    {
+        rtnStructure rtn = co_await command<Daqc2ReadCal>(2, i);
+        if( !rtn.valid )
+        {
+            PP_WARN() << "DAQC2 at" << getAddress() << "calibration read failed, using defaults";
+            co_return SPIERROR;
+        }
+        block[i] = rtn.rtn[0];
+    }
+    applyCal(block);
+    co_return 0;
+}
+
+PlateTask<int> DAQC2Plate::getADCAsync(int channel, double &value)
+{
+    if( channel < 0 || channel > 8 )
+        co_return SPIERROR;
+    if( channel < 8 && !calibrated )
+        co_await ppCalAsync();
+
+    rtnStructure rtn = co_await command<Daqc2GetAdc>(channel);
+    if( !rtn.valid)
+        co_return SPIERROR;
+    uint8_t *resp = rtn.rtn;
+
+    if (channel==8)
+        value=(256*resp[0]+resp[1])*5.0*2.4/65536;
+    else
+        value=adcVolts(resp[0], resp[1], calScale[channel], calOffset[channel]);
+    co_return 0;
+}
+
+PlateTask<int> DAQC2Plate::getADCallAsync(double values[8])
+{
+    ::memset(values, 0, sizeof(values[0]) * 8);
+    rtnStructure rtn = co_await command<Daqc2GetAdcAll>();
+    if( !rtn.valid)
+        co_return SPIERROR;
+
+    if( !calibrated )
+        co_await ppCalAsync();
+    for(int i = 0; i < 8; i++)
+        values[i] = adcVolts(rtn.rtn[2*i], rtn.rtn[2*i+1], calScale[i], calOffset[i]);
+    co_return 0;
+}
+
+PlateTask<int> DAQC2Plate::setDACAsync(int channel, double volts)
+{
+    if (channel < 0 || channel >= PP_MAX_DAC)
+    {
+        PP_ERROR() <<  "ERROR: DAC channel must be 0, 1, 2 or 3 " << channel;
+        co_return SPIERROR;
+    }
+    if( !calibrated )
+        co_await ppCalAsync();
+
+    uint16_t code = codeFor(channel, volts);
+    rtnStructure rtn = co_await command<Daqc2SetDac>(code >> 8, code & 0xff, channel);
+    if( !rtn.valid)
+    {
+        PP_ERROR() << "Error DAC command failed";
+        co_return SPIERROR;
+    }
+    co_return 0;
+}
+
+PlateTask<int> DAQC2Plate::setBitAsync(int pin, int state)
+{
+    if( pin < 0 || pin > 7 )
+        co_return STATE_ERROR;
+    rtnStructure rtn;
+    switch (state) {
+    case STATE_OFF:
+        rtn = co_await command<Daqc2ClearDout>(pin);
+        break;
+    case STATE_ON:
+        rtn = co_await command<Daqc2SetDout>(pin);
+        break;
+    case STATE_TOGGLE:
+        rtn = co_await command<Daqc2ToggleDout>(pin);
+        break;
+    default:
+        co_return STATE_ERROR;
+    }
+
+    if( !rtn.valid)
+        co_return STATE_ERROR;
+    co_return state;
+}
+
+PlateTask<int> DAQC2Plate::getBitAsync(int pin, int &bit)
+{
+    if( pin < 0 || pin > 7 )
+        co_return STATE_ERROR;
+    rtnStructure rtn = co_await command<Daqc2GetDin>(pin);
+    if( !rtn.valid)
+        co_return STATE_ERROR;
+    bit = (int)rtn.rtn[0];
+    co_return 0;
+}
+
+PlateTask<int> DAQC2Plate::getAllBitsAsync(int &inputByte)
+{
+    rtnStructure rtn = co_await command<Daqc2GetDinAll>();
+    if( !rtn.valid)
+        co_return STATE_ERROR;
+    inputByte = (int)rtn.rtn[0];
+    co_return 0;
+}
+#endif
+
 bool DAQC2Plate::isDAQC2Valid(uint8_t addr, uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK, int Device)
 {
     DAQC2Plate TestDAQCC2(addr, PinFrame, PinSRQ,  PinACK, Device  );
@@ -6,6 +6,26 @@
 
 namespace SPIW {
 
+/// DAC outputs of a DAQC2 and their full scale
+#define PP_MAX_DAC              4
+#define PP_DAQC2_DAC_VOLT       4.095
+#define PP_DAQC2_DAC_CODE       4095
+
+/**
+ * @brief The PlateCalibration struct  Decoded factory calibration of a DAQC2, see ppCal.
+ */
+struct PlateCalibration
+{
+    double scale[8];
+    double offset[8];
+    double dac[8];
+};
+
+class DAQC2Plate;
+
+/// told when a DAQC2 has read its calibration from the board, see PlateSnapshot
+typedef std::function<void (DAQC2Plate &)> CalibrationCallback;
+
 class DAQC2Plate : public SPIBase
 {
 
@@ -19,8 +39,32 @@ private :
    double calScale[8];
    double calOffset[8];
 
+   /// calibration bytes per channel and in total
+   static const int CalBytesPerChannel = 6;
+   static const int CalBytes = 8 * CalBytesPerChannel;
+
+   /// true once ppCal or setCalibration filled the constants
+   bool calibrated;
+   CalibrationCallback calibratedCb;
+
    virtual uint8_t  CalGetByte(int ptr);
 
+   /// reads count calibration bytes from start, back to back in one bus hold, false on a bad frame
+   virtual bool  CalGetBlock(int start, int count, uint8_t* buff);
+
+   /// decodes a calibration block read from the board into the constants
+   void  applyCal(const uint8_t* block);
+
+   /// dacCode without the calibration read
+   uint16_t codeFor( int channel, double volts );
+
+   /// reads the calibration on first ADC/DAC use
+   void  ensureCal(void)
+   {
+       if( !calibrated )
+           ppCal();
+   }
+
    virtual bool okToSend( void )
    {
        if( getAckPin())
@@ -28,40 +72,85 @@ private :
        return false;
    }
 
-   virtual rtnStructure SendCommand( cmdStructure cmd, int readbackBytes, bool stopAt0 = false );
-
-   virtual bool waitOnAck(int usec);
-
 public:
 
 
 
-   /// constructor
+   /// constructor, the calibration is read on the first ADC or DAC call
    DAQC2Plate ( uint8_t addr = 32,  uint8_t PinFrame = 6,   uint8_t PinSRQ = 3,  uint8_t PinACK = 4, int Device = 1  )
-       :  SPIBase(addr)
+       :  SPIBase(addr, true)
+       ,  calibrated(false)
 
    {
        std::fill( &calDAC[0], &calDAC[8], 0 );
        std::fill( &calScale[0], &calScale[8], 1 );
        std::fill( &calOffset[0], &calOffset[8], 0 );
        initBoard( PinFrame,  PinSRQ,   PinACK,  Device);
-       ppCal();
+   }
+
+   /// constructor for a DAQC2 on bus
+   DAQC2Plate ( PlateBus &bus, uint8_t addr = 32 )
+       :  SPIBase(bus, addr, true)
+       ,  calibrated(false)
+   {
+       std::fill( &calDAC[0], &calDAC[8], 0 );
+       std::fill( &calScale[0], &calScale[8], 1 );
+       std::fill( &calOffset[0], &calOffset[8], 0 );
+       initBoard();
    }
 
    virtual ~DAQC2Plate() {}
 
+   virtual const char* boardType(void)
+   {
+       return "DAQC2";
+   }
+
    /// get all the adc at one time
    virtual int   getADCall( double values[8]);
 
+   /// the raw all ADC response, 8 channels high byte first, for convertAdcFrames
+   virtual int   getADCallRaw( uint8_t raw[16] );
+
    /// get only 1 adc, get by channel numner
    virtual int   getADC( int channel, double &value);
 
-   /// set the dac but channel number
+   /// set the dac but channel number, 0..4.095 volts
    virtual int   setDAC( int channel,   double value );
 
-   /// get the calibration constants as set by the factory, used after init board..
+   /// volts to the calibrated code setDAC would send, mV over calDAC, 0..4095
+   uint16_t dacCode( int channel, double volts );
+
+   /// sends a code from dacCode, returns 0 or SPIERROR
+   virtual int   setDACcode( int channel, uint16_t code );
+
+   /// sends the codes of the channels in mask (bit n is DAC n) back to back in one bus hold
+   virtual int   setDACcodes( const uint16_t codes[PP_MAX_DAC], uint8_t mask );
+
+   /// get the calibration constants as set by the factory, the ADC and DAC calls do it on first use
    virtual void  ppCal(void);
 
+   /// true once the calibration is in
+   bool isCalibrated(void) const
+   {
+       return calibrated;
+   }
+
+   /// the decoded calibration, reads it first if needed
+   PlateCalibration getCalibration(void);
+
+   /// installs a calibration read earlier, see PlateSnapshot
+   void setCalibration( const PlateCalibration &cal );
+
+   /// reads a few calibration bytes and checks them against cal, false on a mismatch or a bad frame
+   bool matchesCalibration( const PlateCalibration &cal );
+
+   /// cb runs after ppCal read the calibration from the board
+   void onCalibrated( CalibrationCallback cb )
+   {
+       calibratedCb = cb;
+   }
+
    /// set a bit by pin number
    virtual int   setBit( int pin, int state );
 
@@ -92,6 +181,28 @@ public:
    /// get a led current condition
    virtual int  getLedCondition( DAQC2Plate::leds &led );
 
+#ifdef PP_COROUTINES
+   /*
+    * The same calls as awaitables on the active BusLoop, see commandawait.h. The calibration is read
+    * with ppCalAsync on first use, never with a blocking ppCal.
+    */
+
+   /// ppCal one awaited frame per byte, 0 or SPIERROR
+   PlateTask<int> ppCalAsync(void);
+
+   PlateTask<int> getADCAsync( int channel, double &value );
+
+   PlateTask<int> getADCallAsync( double values[8] );
+
+   PlateTask<int> setDACAsync( int channel, double value );
+
+   PlateTask<int> setBitAsync( int pin, int state );
+
+   PlateTask<int> getBitAsync( int pin, int &bit );
+
+   PlateTask<int> getAllBitsAsync( int &inputByte );
+#endif
+
    /// static members  to determine is an address contains a board.
    static bool isDAQC2Valid(uint8_t addr = 32,  uint8_t PinFrame = 6,   uint8_t PinSRQ = 3,  uint8_t PinACK = 4, int Device = 1);
 
@@ -0,0 +1,139 @@
+#ifndef FRAMEPROBE_H
+#define FRAMEPROBE_H
+
+#include "metrics.h"
+#include "spibase.h"
+#include "tracering.h"
+#include <string.h>
+
+namespace SPIW {
+
+/**
+ * @brief The FrameProbe class  Times the phases of one transaction for Metrics and the TraceRing.
+ *
+ * frame marks the end of every phase; split() marks a finer step that only the trace shows, the
+ * frame raise before the ppFRAME check. With metrics compiled out and the trace off nothing reads
+ * the clock.
+ */
+class FrameProbe
+{
+private :
+    SPITransport* bus;
+    uint8_t       opcode;
+    uint8_t       address;
+    bool          tracing;
+    bool          timing;
+    uint64_t      start;
+    uint64_t      lastMetric;
+    uint64_t      lastTrace;
+    TraceEvent    event;
+
+    void trace( int phase, uint64_t from, uint64_t to )
+    {
+        event.phase = phase;
+        event.timestampUs = from;
+        event.durationUs = (uint32_t)(to - from);
+        TraceRing::instance().record(event);
+    }
+
+    uint64_t now()
+    {
+        return timing ? bus->nowMicroseconds() : 0;
+    }
+
+public:
+    /// cmd already carries the address in its first byte
+    FrameProbe( SPITransport* x_bus, const cmdStructure &cmd, uint8_t x_address )
+        : bus(x_bus)
+        , opcode(cmd.txbuff[1])
+        , address(x_address)
+        , tracing(TraceRing::enabled())
+#ifdef PP_METRICS
+        , timing(true)
+#else
+        , timing(tracing)
+#endif
+    {
+        start = lastMetric = lastTrace = now();
+        if( tracing )
+        {
+            ::memset(&event, 0, sizeof(event));
+            event.thread = TraceRing::threadId();
+            event.opcode = opcode;
+            event.address = address;
+            ::memcpy(event.tx, cmd.txbuff, sizeof(event.tx));
+        }
+    }
+
+    /// trace only step inside a phase
+    void split( TracePhase phase )
+    {
+        if( !tracing )
+            return;
+        uint64_t t = now();
+        trace(phase, lastTrace, t);
+        lastTrace = t;
+    }
+
+    /// end of a metric phase, frame up shows as the ppFRAME check in the trace
+    void mark( MetricPhase phase )
+    {
+        if( !timing )
+            return;
+        uint64_t t = now();
+        Metrics::phase(phase, t - lastMetric);
+        lastMetric = t;
+        if( tracing )
+        {
+            static const TracePhase traced[] = { TraceFrameCheck, TraceWrite, TraceAckWait, TraceReadback, TraceFrameDrop };
+            trace(traced[phase], lastTrace, t);
+            lastTrace = t;
+        }
+    }
+
+    /// traces the time a command waited for the bus, since on the bus clock
+    static void busWait( SPITransport* bus, const cmdStructure &cmd, uint8_t address, uint64_t since )
+    {
+        TraceEvent event;
+        ::memset(&event, 0, sizeof(event));
+        event.thread = TraceRing::threadId();
+        event.phase = TraceBusWait;
+        event.opcode = cmd.txbuff[1];
+        event.address = address;
+        event.timestampUs = since;
+        event.durationUs = (uint32_t)(bus->nowMicroseconds() - since);
+        TraceRing::instance().record(event);
+    }
+
+    void ackTimeout()
+    {
+        Metrics::ackTimeout(address);
+    }
+
+    /// the write went out but the readback failed
+    void invalidResponse()
+    {
+        Metrics::invalidResponse();
+    }
+
+    /// counts the frame and its whole time, the trace gets the frame with its readback
+    void done( const rtnStructure &rtn )
+    {
+        if( !timing )
+            return;
+        uint64_t t = now();
+        Metrics::phase(PhaseTotal, t - start);
+        Metrics::frame(opcode, address, rtn.valid);
+        if( tracing )
+        {
+            event.valid = rtn.valid;
+            event.rxLen = rtn.nbr_rtn < 0 ? 0 : (uint8_t)rtn.nbr_rtn;
+            ::memcpy(event.rx, rtn.rtn, sizeof(event.rx));
+            trace(TraceFrame, start, t);
+        }
+    }
+};
+
+}
+
+#endif // FRAMEPROBE_H
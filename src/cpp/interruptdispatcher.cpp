@@ -0,0 +1,163 @@
+#include "interruptdispatcher.h"
+
+namespace SPIW {
+
+InterruptDispatcher::InterruptDispatcher(PlateBus &x_bus)
+    : bus(x_bus)
+    , running(false)
+    , events(0)
+    , spurious(0)
+{
+}
+
+InterruptDispatcher::~InterruptDispatcher()
+{
+    stop();
+}
+
+int InterruptDispatcher::onPin(DAQC2Plate *board, int pin, int when, DinCallback cb)
+{
+    int slot = board->getAddress() - 32;
+    if( slot < 0 || slot >= 8 || pin < 0 || pin >= PP_MAX_DIGITAL_IN || !cb )
+        return STATE_ERROR;
+
+    // its interrupts come in on the ppINT of its own stack
+    if( &board->getBus() != &bus )
+    {
+        PP_ERROR() << "InterruptDispatcher: board" << board->getAddress() << "is on another bus";
+        return STATE_ERROR;
+    }
+
+    if( board->enableDinIRQ(pin, when) != 0 )
+        return STATE_ERROR;
+    if( board->intEnable() != 0 )
+        return STATE_ERROR;
+
+    std::lock_guard<std::mutex> guard(lock);
+    slots[slot].board = board;
+    slots[slot].pins[pin].push_back(cb);
+    return 0;
+}
+
+int InterruptDispatcher::removeBoard(DAQC2Plate *board)
+{
+    int slot = board->getAddress() - 32;
+    if( slot < 0 || slot >= 8 )
+        return STATE_ERROR;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slots[slot].board = NULL;
+        for( int pin = 0; pin < PP_MAX_DIGITAL_IN; ++pin )
+            slots[slot].pins[pin].clear();
+    }
+    return board->intDisable();
+}
+
+bool InterruptDispatcher::start()
+{
+    if( running )
+        return true;
+    running = true;
+    worker = std::thread(&InterruptDispatcher::run, this);
+    return true;
+}
+
+void InterruptDispatcher::stop()
+{
+    running = false;
+    if( worker.joinable() )
+        worker.join();
+}
+
+void InterruptDispatcher::run()
+{
+    SPITransport* line = bus.transport();
+    int inARow = 0;
+    useconds_t pause = PP_INT_POLL;
+    while( running )
+    {
+        int rtn = line->waitInt(PP_INT_WAIT);
+        if( rtn < 0 )
+        {
+            // no edge events on this bus, poll the level
+            rtn = line->getInt() ? 0 : 1;
+            if( rtn == 0 )
+                usleep(PP_INT_POLL);
+        }
+        if( rtn == 0 )
+        {
+            if( inARow >= PP_INT_SPURIOUS_LIMIT )
+                PP_INFO() << "InterruptDispatcher: ppINT released, servicing at full rate again";
+            inARow = 0;
+            pause = PP_INT_POLL;
+            continue;
+        }
+
+        if( service(line->nowMicroseconds()) != 0 )
+        {
+            inARow = 0;
+            pause = PP_INT_POLL;
+            continue;
+        }
+
+        // the line is held by a board nobody registered or stuck, each pass costs a frame per board
+        spurious++;
+        if( ++inARow == PP_INT_SPURIOUS_LIMIT )
+            PP_WARN() << "InterruptDispatcher: ppINT held low with no registered flag set, backing off";
+        if( inARow >= PP_INT_SPURIOUS_LIMIT )
+            pause = std::min<useconds_t>(pause * 2, PP_INT_BACKOFF_MAX);
+        usleep(pause);
+    }
+}
+
+int InterruptDispatcher::service(uint64_t timestampUs)
+{
+    DAQC2Plate* boards[8];
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for( int slot = 0; slot < 8; ++slot )
+            boards[slot] = slots[slot].board;
+    }
+
+    int asserting = 0;
+    for( int slot = 0; slot < 8; ++slot )
+    {
+        if( boards[slot] == NULL )
+            continue;
+
+        // one read per board, it also releases the board's hold on ppINT
+        unsigned short reg = 0;
+        if( boards[slot]->getINTflags(reg) != 0 )
+            continue;
+        uint8_t flags = reg & 0xff;
+        if( flags == 0 )
+            continue;
+        asserting++;
+
+        for( int pin = 0; pin < PP_MAX_DIGITAL_IN; ++pin )
+        {
+            if( (flags & (1 << pin)) == 0 )
+                continue;
+
+            std::vector<DinCallback> callbacks;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                callbacks = slots[slot].pins[pin];
+            }
+
+            DinEvent event;
+            event.address = boards[slot]->getAddress();
+            event.pin = pin;
+            event.timestampUs = timestampUs;
+            for( size_t i = 0; i < callbacks.size(); ++i )
+            {
+                callbacks[i](event);
+                events++;
+            }
+        }
+    }
+    return asserting;
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef INTERRUPTDISPATCHER_H
+#define INTERRUPTDISPATCHER_H
+
+#include "daqc2plate.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace SPIW {
+
+/// how long the dispatcher sleeps on ppINT before it checks for stop, usec
+#define PP_INT_WAIT             100000
+
+/// poll period on ppINT when the bus has no edge events, usec
+#define PP_INT_POLL             1000
+
+/// back to back wakeups with no registered flag set before the dispatcher backs off, and the
+/// longest pause between services while ppINT stays low, usec
+#define PP_INT_SPURIOUS_LIMIT   8
+#define PP_INT_BACKOFF_MAX      100000
+
+/**
+ * @brief The DinEvent struct  One digital input interrupt of a DAQC2.
+ */
+struct DinEvent
+{
+    /// address of the DAQC2, 32..39
+    uint8_t  address;
+
+    /// input pin 0..7 that fired
+    int      pin;
+
+    /// transport clock when ppINT was seen asserted, monotonic micro seconds
+    uint64_t timestampUs;
+};
+
+typedef std::function<void (const DinEvent &)> DinCallback;
+
+/**
+ * @brief The InterruptDispatcher class  Turns the shared ppINT line into per pin callbacks.
+ *
+ * A dedicated thread sleeps on ppINT. When a board pulls it low the thread reads the INT flag
+ * register of each registered DAQC2 once, which clears it, and calls the callbacks of the pins that
+ * fired with the time the line was seen. Nothing touches the bus while no input changes.
+ * Each stack has its own ppINT, a dispatcher serves the boards of one PlateBus. A line held low by a
+ * board nobody registered would keep the bus busy with flag reads, after PP_INT_SPURIOUS_LIMIT such
+ * wakeups in a row the pause between them doubles up to PP_INT_BACKOFF_MAX until the line goes high.
+ */
+class InterruptDispatcher
+{
+private :
+
+    struct Slot
+    {
+        DAQC2Plate*               board;
+        std::vector<DinCallback>  pins[PP_MAX_DIGITAL_IN];
+
+        Slot() : board(NULL) {}
+    };
+
+    /// the stack whose ppINT is watched
+    PlateBus&             bus;
+
+    /// one slot per DAQC2 address 32..39
+    Slot                  slots[8];
+    std::mutex            lock;
+    std::thread           worker;
+    std::atomic<bool>     running;
+    std::atomic<uint64_t> events;
+    std::atomic<uint64_t> spurious;
+
+    void run();
+
+    /// reads and clears the flags of every registered board, returns the number of callbacks made
+    int service( uint64_t timestampUs );
+
+    InterruptDispatcher( const InterruptDispatcher& );
+    InterruptDispatcher& operator=( const InterruptDispatcher& );
+
+public:
+
+    explicit InterruptDispatcher( PlateBus &x_bus = PlateBus::defaultBus() );
+
+    /// stops the thread, the boards keep their interrupt setup
+    ~InterruptDispatcher();
+
+    /// calls cb when pin 0..7 of board sees when (INT_EDGE_FALLING, INT_EDGE_RISING, INT_EDGE_BOTH),
+    /// enables the pin irq and the board interrupt, returns 0 or STATE_ERROR, also for a board on another bus
+    int onPin( DAQC2Plate* board, int pin, int when, DinCallback cb );
+
+    /// drops the callbacks of a board and disables its interrupt
+    int removeBoard( DAQC2Plate* board );
+
+    /// starts the dispatch thread
+    bool start();
+
+    /// stops and joins the dispatch thread
+    void stop();
+
+    /// number of callbacks made
+    uint64_t eventCount() const
+    {
+        return events;
+    }
+
+    /// ppINT wakeups where no registered board had a flag set
+    uint64_t spuriousCount() const
+    {
+        return spurious;
+    }
+};
+
+}
+
+#endif // INTERRUPTDISPATCHER_H
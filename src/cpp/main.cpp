@@ -4,21 +4,68 @@
 #include "spibase.h"
 #include "relayplate.h"
 #include "daqc2plate.h"
+#include "adcstream.h"
+#include "adccapture.h"
+#include "plateregistry.h"
+#include "simtransport.h"
 #include <QTime>
 
 int main(int argc, char *argv[])
 {
 
-    Q_UNUSED(argc)
-    Q_UNUSED(argv)
+    bool tune = false;
+    const char* capturePath = NULL;
+    for( int i = 1; i < argc; ++i )
+    {
+        /// --sim runs the scan against the in process simulated stack, see PIPLATE_SIM_BOARDS
+        if( strcmp(argv[i], "--sim") == 0 )
+            SPIW::SPIBase::setTransport( SPIW::SimulatedTransport::fromEnvironment() );
+
+        /// --tune searches the fastest working frame timing of every board found and saves it
+        else if( strcmp(argv[i], "--tune") == 0 )
+            tune = true;
+
+        /// --capture FILE records the one second stream below into a binary capture
+        else if( strcmp(argv[i], "--capture") == 0 && i + 1 < argc )
+            capturePath = argv[++i];
+
+        /// --replay FILE plays a capture back, no hardware needed
+        else if( strcmp(argv[i], "--replay") == 0 && i + 1 < argc )
+        {
+            SPIW::CaptureReader reader;
+            if( reader.open(argv[++i]) != 0 )
+                return 1;
+            qDebug() << "Capture of" << reader.header().id << "at" << (int)reader.header().address << "records" << (long long)reader.size();
+            uint64_t din = 0;
+            SPIW::AdcFrame last;
+            last.sequence = 0;
+            uint64_t adc = reader.replay( [&last](const SPIW::AdcFrame &frame) { last = frame; },
+                                          [&din](const SPIW::DinEvent &) { din++; } ) - din;
+            qDebug() << "Replayed ADC frames" << (long long)adc << "DIN events" << (long long)din;
+            if( adc > 0 )
+            {
+                for ( int k = 0; k < 8; ++k)
+                    qDebug() << QString("ADC[%1][%2] = %3").arg((long long)last.sequence).arg(k).arg(last.volts[k]);
+            }
+            return 0;
+        }
+    }
+
+    /// one pass over the RELAY and DAQC2 addresses, the plates are built as they are used below
+    SPIW::PlateRegistry &registry = SPIW::PlateRegistry::instance();
+    registry.discover();
+    qDebug() << "scan took usec" << (long long)registry.lastScanUs();
 
-    for ( int adr = 32; adr < 32+8; ++adr )
+    for ( int board = 0; board < PP_MAX_BOARDS; ++board )
     {
-        /// use the first one to set the ppACK, ppFRAME, Device, and ppINT for the system.. not needed again
-        if ( SPIW::DAQC2Plate::isDAQC2Valid( adr, 6,3,4,1) )
+        if ( registry.daqc2(board) != NULL )
         {
-            qDebug() << "FOUND DAQC2 at ADDRESS " << adr;
-            SPIW::DAQC2Plate adc(adr);
+            SPIW::DAQC2Plate &adc = *registry.daqc2(board);
+            if( tune )
+            {
+                SPIW::TimingProfile timing = SPIW::TimingProfiles::instance().autoTune(adc);
+                qDebug() << "DAQC2 timing setup" << timing.frameSetupUs << "hold" << timing.frameHoldUs << "byte" << timing.interByteUs;
+            }
             qDebug() << QTime::currentTime();  /// get the time of the day..
             if( adc.ValidBoard())
             {
@@ -35,6 +82,20 @@ int main(int argc, char *argv[])
                 }
                 int time = tms.elapsed() / 5; /// not take the average over 5 readings
                 qDebug() << "Elapsed ms average for 5 complete reading of all 8 adcs is: " << time;
+
+                /// one second of continuous acquisition at 100 Hz
+                SPIW::AdcStream stream(&adc);
+                SPIW::CaptureWriter capture;
+                if( capturePath != NULL && capture.open(capturePath, &adc) == 0 )
+                    stream.setCapture(&capture);
+                stream.start(100);
+                sleep(1);
+                stream.stop();
+                stream.setCapture(NULL);
+                capture.close();
+                SPIW::AdcStreamStats stats = stream.stats();
+                qDebug() << "Stream frames" << (int)stats.frames << "rate" << stats.achievedHz << "jitter usec" << stats.jitterMeanUs
+                         << "missed" << (int)stats.missed << "overruns" << (int)stats.overruns;
                 for( int k = 0; k < 5; ++k )
                 {
                     for ( int i = 0; i < 8; ++i)
@@ -107,16 +168,20 @@ int main(int argc, char *argv[])
         }
     }
 
-    for ( int adr = 24; adr < 24 +8; ++adr )
+    for ( int board = 0; board < PP_MAX_BOARDS; ++board )
     {
-        if( SPIW::RELAYPlate::isRelayValid(adr ) )
+        if( registry.relay(board) != NULL )
         {
-            qDebug() << "FOUND RELAY CARD at ADDRESS " << adr;
-            SPIW::RELAYPlate relay(adr);
+            SPIW::RELAYPlate &relay = *registry.relay(board);
             if( relay.ValidBoard())
             {
                 qDebug() << relay.getFWRevision() << "   " << relay.getHWRevision() << relay.getID();
             }
+            if( tune )
+            {
+                SPIW::TimingProfile timing = SPIW::TimingProfiles::instance().autoTune(relay);
+                qDebug() << "RELAY timing setup" << timing.frameSetupUs << "hold" << timing.frameHoldUs << "write" << timing.postWriteUs;
+            }
 
             for ( int i = 0; i < 8; ++i)
             {
@@ -133,6 +198,10 @@ int main(int argc, char *argv[])
 
 
     }
+
+    if( tune )
+        SPIW::TimingProfiles::instance().save( SPIW::TimingProfiles::path() );
+    registry.shutdown();
     return 0;
 
 }
@@ -0,0 +1,156 @@
+#include "metrics.h"
+#include <string.h>
+
+namespace SPIW {
+
+#ifdef PP_METRICS
+
+namespace {
+
+/// zero initialized as statics, no constructor runs before the first frame
+struct Counters
+{
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> ackTimeouts;
+    std::atomic<uint64_t> invalidResponses;
+    std::atomic<uint64_t> retries;
+
+    std::atomic<uint64_t> phaseCount[PhaseCount];
+    std::atomic<uint64_t> phaseSumUs[PhaseCount];
+    std::atomic<uint64_t> phaseBuckets[PhaseCount][PP_METRIC_BUCKETS];
+
+    std::atomic<uint64_t> opcodeFrames[PP_METRIC_OPCODES];
+    std::atomic<uint64_t> opcodeErrors[PP_METRIC_OPCODES];
+
+    std::atomic<uint64_t> boardFrames[PP_METRIC_BOARDS];
+    std::atomic<uint64_t> boardErrors[PP_METRIC_BOARDS];
+    std::atomic<uint64_t> boardAckTimeouts[PP_METRIC_BOARDS];
+};
+
+Counters counters;
+
+inline void bump( std::atomic<uint64_t> &counter, uint64_t by = 1 )
+{
+    counter.fetch_add(by, std::memory_order_relaxed);
+}
+
+inline uint64_t read( const std::atomic<uint64_t> &counter )
+{
+    return counter.load(std::memory_order_relaxed);
+}
+
+inline void clear( std::atomic<uint64_t> &counter )
+{
+    counter.store(0, std::memory_order_relaxed);
+}
+
+}
+
+void Metrics::phase(int phase, uint64_t usec)
+{
+    bump(counters.phaseCount[phase]);
+    bump(counters.phaseSumUs[phase], usec);
+    bump(counters.phaseBuckets[phase][bucket(usec)]);
+}
+
+void Metrics::frame(uint8_t opcode, uint8_t address, bool valid)
+{
+    int board = address & (PP_METRIC_BOARDS - 1);
+    bump(counters.frames);
+    bump(counters.opcodeFrames[opcode]);
+    bump(counters.boardFrames[board]);
+    if( !valid )
+    {
+        bump(counters.errors);
+        bump(counters.opcodeErrors[opcode]);
+        bump(counters.boardErrors[board]);
+    }
+}
+
+void Metrics::ackTimeout(uint8_t address)
+{
+    bump(counters.ackTimeouts);
+    bump(counters.boardAckTimeouts[address & (PP_METRIC_BOARDS - 1)]);
+}
+
+void Metrics::invalidResponse()
+{
+    bump(counters.invalidResponses);
+}
+
+void Metrics::retry()
+{
+    bump(counters.retries);
+}
+
+void Metrics::snapshot(MetricsSnapshot &out)
+{
+    out.enabled = true;
+    out.frames = read(counters.frames);
+    out.errors = read(counters.errors);
+    out.ackTimeouts = read(counters.ackTimeouts);
+    out.invalidResponses = read(counters.invalidResponses);
+    out.retries = read(counters.retries);
+    for( int p = 0; p < PhaseCount; ++p )
+    {
+        out.phaseCount[p] = read(counters.phaseCount[p]);
+        out.phaseSumUs[p] = read(counters.phaseSumUs[p]);
+        for( int b = 0; b < PP_METRIC_BUCKETS; ++b )
+            out.phaseBuckets[p][b] = read(counters.phaseBuckets[p][b]);
+    }
+    for( int i = 0; i < PP_METRIC_OPCODES; ++i )
+    {
+        out.opcodeFrames[i] = read(counters.opcodeFrames[i]);
+        out.opcodeErrors[i] = read(counters.opcodeErrors[i]);
+    }
+    for( int i = 0; i < PP_METRIC_BOARDS; ++i )
+    {
+        out.boardFrames[i] = read(counters.boardFrames[i]);
+        out.boardErrors[i] = read(counters.boardErrors[i]);
+        out.boardAckTimeouts[i] = read(counters.boardAckTimeouts[i]);
+    }
+}
+
+void Metrics::reset()
+{
+    clear(counters.frames);
+    clear(counters.errors);
+    clear(counters.ackTimeouts);
+    clear(counters.invalidResponses);
+    clear(counters.retries);
+    for( int p = 0; p < PhaseCount; ++p )
+    {
+        clear(counters.phaseCount[p]);
+        clear(counters.phaseSumUs[p]);
+        for( int b = 0; b < PP_METRIC_BUCKETS; ++b )
+            clear(counters.phaseBuckets[p][b]);
+    }
+    for( int i = 0; i < PP_METRIC_OPCODES; ++i )
+    {
+        clear(counters.opcodeFrames[i]);
+        clear(counters.opcodeErrors[i]);
+    }
+    for( int i = 0; i < PP_METRIC_BOARDS; ++i )
+    {
+        clear(counters.boardFrames[i]);
+        clear(counters.boardErrors[i]);
+        clear(counters.boardAckTimeouts[i]);
+    }
+}
+
+#else
+
+void Metrics::snapshot(MetricsSnapshot &out)
+{
+    ::memset(&out, 0, sizeof(out));
+    out.enabled = false;
+}
+
+void Metrics::reset()
+{
+}
+
+#endif
+
+}
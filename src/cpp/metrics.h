@@ -0,0 +1,102 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <stdint.h>
+
+namespace SPIW {
+
+/// log2 latency buckets, bucket 0 is 0 usec, bucket n holds 2^(n-1) up to 2^n - 1 usec
+#define PP_METRIC_BUCKETS       32
+
+/// opcodes and bus addresses a counter is kept for
+#define PP_METRIC_OPCODES       256
+#define PP_METRIC_BOARDS        64
+
+/// the parts of one frame that are timed, the last one is the whole frame
+enum MetricPhase
+{
+    PhaseFrameUp = 0,
+    PhaseWrite,
+    PhaseAckWait,
+    PhaseReadback,
+    PhaseFrameDown,
+    PhaseTotal,
+    PhaseCount
+};
+
+/**
+ * @brief The MetricsSnapshot struct  Copy of every counter at one moment.
+ */
+struct MetricsSnapshot
+{
+    /// false when the library was built without PP_METRICS, everything else is 0 then
+    bool     enabled;
+
+    /// errors counts every frame that came back invalid, ackTimeouts and invalidResponses say why:
+    /// no ppACK, or a readback the transport failed; retries are RELAYALL writes tried again
+    uint64_t frames;
+    uint64_t errors;
+    uint64_t ackTimeouts;
+    uint64_t invalidResponses;
+    uint64_t retries;
+
+    uint64_t phaseCount[PhaseCount];
+    uint64_t phaseSumUs[PhaseCount];
+    uint64_t phaseBuckets[PhaseCount][PP_METRIC_BUCKETS];
+
+    uint64_t opcodeFrames[PP_METRIC_OPCODES];
+    uint64_t opcodeErrors[PP_METRIC_OPCODES];
+
+    uint64_t boardFrames[PP_METRIC_BOARDS];
+    uint64_t boardErrors[PP_METRIC_BOARDS];
+    uint64_t boardAckTimeouts[PP_METRIC_BOARDS];
+};
+
+/**
+ * @brief The Metrics class  Process wide frame counters and latency histograms.
+ *
+ * Every counter is a relaxed atomic, a frame costs a handful of uncontended increments and one clock
+ * read per phase. Built without PP_METRICS (CONFIG += pp_metrics turns it on) the calls FrameProbe
+ * makes are empty inline functions and snapshot() reports enabled false.
+ */
+class Metrics
+{
+public:
+
+    /// the counters of the process
+    static void snapshot( MetricsSnapshot &out );
+
+    /// sets every counter back to 0
+    static void reset();
+
+    /// the bucket a latency falls in
+    static int bucket( uint64_t usec )
+    {
+        int n = 0;
+        while( usec != 0 && n < PP_METRIC_BUCKETS - 1 )
+        {
+            usec >>= 1;
+            n++;
+        }
+        return n;
+    }
+
+#ifdef PP_METRICS
+    static void phase( int phase, uint64_t usec );
+    static void frame( uint8_t opcode, uint8_t address, bool valid );
+    static void ackTimeout( uint8_t address );
+    static void invalidResponse();
+    static void retry();
+#else
+    static void phase( int, uint64_t ) {}
+    static void frame( uint8_t, uint8_t, bool ) {}
+    static void ackTimeout( uint8_t ) {}
+    static void invalidResponse() {}
+    static void retry() {}
+#endif
+};
+
+}
+
+#endif // METRICS_H
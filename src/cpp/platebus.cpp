@@ -0,0 +1,227 @@
+#include "platebus.h"
+#include "busexecutor.h"
+#include "simtransport.h"
+#include "spibase.h"
+#ifndef PP_NO_WIRINGPI
+#include "wiringpitransport.h"
+#endif
+
+namespace SPIW {
+
+/// every live bus, the default bus first once it exists
+static PlateBus* buses[PP_MAX_BUSES];
+static std::recursive_mutex& registryLock()
+{
+    static std::recursive_mutex lock;
+    return lock;
+}
+
+PlateBus::PlateBus()
+    : configured(false)
+    , bus(NULL)
+    , ownsTransport(false)
+    , initYet(false)
+    , running(NULL)
+    , ownExecutor(NULL)
+{
+    enroll();
+}
+
+PlateBus::PlateBus(const BusConfig &x_config, SPITransport *x_transport)
+    : config(x_config)
+    , configured(true)
+    , bus(x_transport)
+    , ownsTransport(x_transport == NULL)
+    , initYet(false)
+    , running(NULL)
+    , ownExecutor(NULL)
+{
+    if( bus == NULL )
+        bus = makeTransport(config.spiBus);
+    enroll();
+}
+
+PlateBus::~PlateBus()
+{
+    stopExecutor();
+    delete ownExecutor;
+    {
+        std::lock_guard<std::recursive_mutex> guard(registryLock());
+        for( int i = 0; i < PP_MAX_BUSES; ++i )
+        {
+            if( buses[i] == this )
+                buses[i] = NULL;
+        }
+    }
+    if( ownsTransport )
+        delete bus;
+}
+
+void PlateBus::enroll()
+{
+    std::lock_guard<std::recursive_mutex> guard(registryLock());
+    for( int i = 0; i < PP_MAX_BUSES; ++i )
+    {
+        if( buses[i] == NULL )
+        {
+            buses[i] = this;
+            return;
+        }
+    }
+    PP_WARN() << "PlateBus: more than" << PP_MAX_BUSES << "buses, forConfig will not find this one";
+}
+
+PlateBus &PlateBus::defaultBus()
+{
+    static PlateBus* first = new PlateBus();
+    return *first;
+}
+
+PlateBus *PlateBus::forConfig(const BusConfig &x_config)
+{
+    std::lock_guard<std::recursive_mutex> guard(registryLock());
+
+    // one stack processes keep the process transport, as before buses
+    PlateBus &fallback = defaultBus();
+    if( !fallback.configured )
+    {
+        fallback.config = x_config;
+        fallback.configured = true;
+        return &fallback;
+    }
+
+    int free = -1;
+    for( int i = 0; i < PP_MAX_BUSES; ++i )
+    {
+        if( buses[i] == NULL )
+        {
+            if( free < 0 )
+                free = i;
+            continue;
+        }
+        if( buses[i]->configured && buses[i]->config == x_config )
+            return buses[i];
+    }
+    if( free < 0 )
+    {
+        PP_ERROR() << "PlateBus: no room for another bus, at most" << PP_MAX_BUSES;
+        return NULL;
+    }
+
+    PP_INFO() << "PlateBus: new bus on spi" << x_config.spiBus << "device" << x_config.device << "frame pin" << x_config.pinFrame;
+    return new PlateBus(x_config);
+}
+
+SPITransport *PlateBus::makeTransport(int spiBus)
+{
+    const char* env = getenv("PIPLATE_TRANSPORT");
+#ifndef PP_NO_WIRINGPI
+    if( env == NULL || strcmp(env, "sim") != 0 )
+        return new WiringPiTransport(spiBus);
+#else
+    (void)env;
+    (void)spiBus;
+#endif
+    return SimulatedTransport::fromEnvironment();
+}
+
+SPITransport *PlateBus::makeDefaultTransport()
+{
+    std::lock_guard<std::mutex> guard(initLock);
+    if( bus != NULL )
+        return bus;
+
+    const char* env = getenv("PIPLATE_TRANSPORT");
+#ifndef PP_NO_WIRINGPI
+    if( env == NULL || strcmp(env, "sim") != 0 )
+    {
+        static WiringPiTransport wiringPiBus;
+        bus = &wiringPiBus;
+    }
+    else
+#else
+    (void)env;
+#endif
+    {
+        bus = SimulatedTransport::fromEnvironment();
+        PP_INFO() << "Using simulated piplate bus";
+    }
+    return bus;
+}
+
+void PlateBus::setTransport(SPITransport *x_transport)
+{
+    std::lock_guard<std::mutex> guard(initLock);
+    if( ownsTransport )
+        delete bus;
+    bus = x_transport;
+    ownsTransport = false;
+    initYet = false;
+}
+
+bool PlateBus::open()
+{
+    SPITransport* t = transport();
+
+    // the lines are in use now, forConfig hands other lines a bus of their own
+    if( !configured )
+    {
+        std::lock_guard<std::recursive_mutex> guard(registryLock());
+        configured = true;
+    }
+
+    std::lock_guard<std::mutex> guard(initLock);
+
+    // frame, interrupt and ack lines
+    if( !t->initPins( config.pinFrame, config.pinSRQ, config.pinACK ) )
+        return false;
+
+    if( !initYet )
+    {
+        // Initialize frame signal
+        t->setFrame(false);
+        t->delayMicroseconds(PP_DELAY);
+        if( t->getFrame() )
+        {
+            PP_ERROR() << "Unable to Disable a ppFRAME";
+            return false;
+        }
+        initYet = true;
+
+        // time to system
+        t->delayMicroseconds(PP_DELAY);
+    }
+
+    // the transport keeps an open device, this only opens it the first time or after closeDevice
+    t->openDevice(config.device, PP_SPI_BUS_SPEED);
+    return true;
+}
+
+bool PlateBus::startExecutor()
+{
+    if( ownExecutor == NULL )
+        ownExecutor = new BusExecutor(this);
+    return ownExecutor->start();
+}
+
+void PlateBus::stopExecutor()
+{
+    if( ownExecutor == NULL )
+        return;
+    // kept for the next start: a caller that loaded executor() just before the stop may still be on
+    // its way into post or submit, a stopped executor runs that request inline under the bus lock
+    ownExecutor->stop();
+}
+
+void PlateBus::attachExecutor(BusExecutor *x_executor)
+{
+    running.store(x_executor);
+}
+
+void PlateBus::detachExecutor(BusExecutor *x_executor)
+{
+    BusExecutor* self = x_executor;
+    running.compare_exchange_strong(self, NULL);
+}
+
+}
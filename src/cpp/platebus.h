@@ -0,0 +1,158 @@
+#ifndef PLATEBUS_H
+#define PLATEBUS_H
+
+#include "spitransport.h"
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+namespace SPIW {
+
+class BusExecutor;
+
+/// control lines and device of the stack the boards used before buses existed
+#define PP_DEFAULT_PIN_FRAME    6
+#define PP_DEFAULT_PIN_SRQ      3
+#define PP_DEFAULT_PIN_ACK      4
+#define PP_DEFAULT_DEVICE       1
+
+/// most buses one process drives
+#define PP_MAX_BUSES            8
+
+/**
+ * @brief The BusConfig struct  Control lines and spi device of one piplate stack.
+ */
+struct BusConfig
+{
+    /// wiringPi pin numbers of ppFRAME, ppINT and ppACK
+    uint8_t pinFrame;
+    uint8_t pinSRQ;
+    uint8_t pinACK;
+
+    /// chip select, 0 or 1 on spi0 (spidev0.0, spidev0.1), 0..2 on the auxiliary spi1
+    int     device;
+
+    /// spi controller, 0 through wiringPiSPI, 1 the auxiliary spidev1.x
+    int     spiBus;
+
+    BusConfig( uint8_t x_pinFrame = PP_DEFAULT_PIN_FRAME, uint8_t x_pinSRQ = PP_DEFAULT_PIN_SRQ,
+               uint8_t x_pinACK = PP_DEFAULT_PIN_ACK, int x_device = PP_DEFAULT_DEVICE, int x_spiBus = 0 )
+        : pinFrame(x_pinFrame)
+        , pinSRQ(x_pinSRQ)
+        , pinACK(x_pinACK)
+        , device(x_device)
+        , spiBus(x_spiBus)
+    {
+    }
+
+    bool operator==( const BusConfig &other ) const
+    {
+        return pinFrame == other.pinFrame && pinSRQ == other.pinSRQ && pinACK == other.pinACK
+            && device == other.device && spiBus == other.spiBus;
+    }
+};
+
+/**
+ * @brief The PlateBus class  One piplate stack: its control lines, spi device, transport, frame lock
+ * and bus thread.
+ *
+ * Boards are bound to a bus and only touch its transport, so stacks on spidev0.0, spidev0.1 and spi1
+ * run side by side, each with its own BusExecutor when startExecutor is called. A board built from
+ * pin numbers binds to the bus with that BusConfig, made on first use; the first such bus is the
+ * default bus, which keeps the process transport of SPIBase::setTransport. Each bus needs its own
+ * control lines, two buses on one ppFRAME would interleave frames.
+ */
+class PlateBus
+{
+private :
+
+    BusConfig       config;
+
+    /// false for the default bus until the first board names its lines or it is opened
+    bool            configured;
+
+    SPITransport*   bus;
+    bool            ownsTransport;
+
+    /// pins set, frame dropped and device opened once
+    bool            initYet;
+    std::mutex      initLock;
+
+    /// one frame at a time, held around each frame or executor request
+    std::mutex      frameLock;
+
+    /// the started executor frames route through, and the one startExecutor made, freed with the bus
+    std::atomic<BusExecutor*> running;
+    BusExecutor*    ownExecutor;
+
+    /// the default bus, configured by its first board
+    PlateBus();
+
+    /// the process transport of the default bus, wiringPi, or the simulated stack with PIPLATE_TRANSPORT=sim
+    SPITransport* makeDefaultTransport();
+
+    void enroll();
+
+    PlateBus( const PlateBus& );
+    PlateBus& operator=( const PlateBus& );
+
+public:
+
+    /// a bus on x_config, x_transport NULL makes one for its spi controller; the caller keeps ownership of a given transport
+    PlateBus( const BusConfig &x_config, SPITransport* x_transport = NULL );
+
+    /// stops and frees the executor, boards bound to the bus and threads using them must be gone
+    ~PlateBus();
+
+    /// the bus of boards that never named their lines, and of SPIBase::transport
+    static PlateBus& defaultBus();
+
+    /// the bus on x_config, the default bus if it is still free, created on first use otherwise, NULL past PP_MAX_BUSES
+    static PlateBus* forConfig( const BusConfig &x_config );
+
+    /// wiringPi on spiBus, or a simulated stack with PIPLATE_TRANSPORT=sim, owned by the caller
+    static SPITransport* makeTransport( int spiBus );
+
+    const BusConfig &getConfig() const
+    {
+        return config;
+    }
+
+    /// the backend of this bus, made on first use for the default bus
+    SPITransport* transport()
+    {
+        return bus != NULL ? bus : makeDefaultTransport();
+    }
+
+    /// installs a backend, call before the boards talk, the caller keeps ownership
+    void setTransport( SPITransport* x_transport );
+
+    /// sets the control lines, drops ppFRAME and opens the spi device, once; false on failure
+    bool open();
+
+    /// one frame at a time on this bus
+    std::mutex& lock()
+    {
+        return frameLock;
+    }
+
+    /// starts a bus thread for this bus, frames from other threads then queue to it
+    bool startExecutor();
+
+    /// drains and stops the thread startExecutor made, the executor stays until the bus is destroyed
+    void stopExecutor();
+
+    /// the running executor of this bus, NULL when frames run on the calling thread
+    BusExecutor* executor()
+    {
+        return running.load();
+    }
+
+    /// called by BusExecutor::start and stop
+    void attachExecutor( BusExecutor* x_executor );
+    void detachExecutor( BusExecutor* x_executor );
+};
+
+}
+
+#endif // PLATEBUS_H
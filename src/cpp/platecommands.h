@@ -0,0 +1,167 @@
+#ifndef PLATECOMMANDS_H
+#define PLATECOMMANDS_H
+
+#include <stdint.h>
+
+namespace SPIW {
+
+/// what the plate does between the command and its answer
+enum CommandTiming
+{
+    TimingRegister = 0,     ///< answers from a register or latch
+    TimingConversion,       ///< runs an ADC conversion first
+    TimingEeprom,           ///< reads its eeprom
+    TimingReset             ///< restarts, does not answer
+};
+
+/// every command the library sends, the index into plateCommands
+enum PlateCommand
+{
+    RelayGetAddress = 0,
+    RelayGetId,
+    RelayGetHWRevision,
+    RelayGetFWRevision,
+    RelayReset,
+    RelayOn,
+    RelayOff,
+    RelayToggle,
+    RelayAll,
+    RelayGetAll,
+    RelaySetLed,
+    RelayClearLed,
+    RelayToggleLed,
+    RelayGetLed,
+
+    Daqc2GetAddress,
+    Daqc2GetId,
+    Daqc2GetHWRevision,
+    Daqc2GetFWRevision,
+    Daqc2Reset,
+    Daqc2IntEnable,
+    Daqc2IntDisable,
+    Daqc2GetIntFlags,
+    Daqc2SetDout,
+    Daqc2ClearDout,
+    Daqc2ToggleDout,
+    Daqc2GetDin,
+    Daqc2DinIrqFalling,
+    Daqc2DinIrqRising,
+    Daqc2DinIrqBoth,
+    Daqc2DinIrqOff,
+    Daqc2GetDinAll,
+    Daqc2GetAdc,
+    Daqc2GetAdcAll,
+    Daqc2SetDac,
+    Daqc2SetLed,
+    Daqc2GetLed,
+    Daqc2ReadCal,
+
+    PlateCommandCount
+};
+
+/**
+ * @brief The CommandDescriptor struct  The shape of one command frame, as the firmware defines it.
+ *
+ * readback does not count the trailing byte a DAQC2 sends after ppACK, the frame adds it. A command
+ * with units > 1 is a run of opcodes, opcode + unit, the DAC writes 0x40..0x43.
+ */
+struct CommandDescriptor
+{
+    PlateCommand command;
+    uint8_t      opcode;
+    uint8_t      units;
+
+    /// bytes read back, a stopAt0 answer is a string of at most readback bytes trimmed at its 0
+    uint8_t      readback;
+    bool         stopAt0;
+
+    /// the plate drives ppACK (DAQC2), otherwise the post write delay stands in for it
+    bool         ack;
+    CommandTiming timing;
+
+    /// accepted argument bytes, inclusive
+    uint8_t      arg1Min;
+    uint8_t      arg1Max;
+    uint8_t      arg2Min;
+    uint8_t      arg2Max;
+
+    const char*  name;
+};
+
+/// the table, in PlateCommand order
+constexpr CommandDescriptor plateCommands[PlateCommandCount] =
+{
+    // command, opcode, units, readback, stopAt0, ack, timing, arg1 min max, arg2 min max, name
+    { RelayGetAddress,      0x00, 1,  1, false, false, TimingRegister,   0, 0,    0, 0,     "getADDR" },
+    { RelayGetId,           0x01, 1, 20, true,  false, TimingRegister,   0, 0,    0, 0,     "getID" },
+    { RelayGetHWRevision,   0x02, 1,  1, false, false, TimingRegister,   0, 0,    0, 0,     "getHWrev" },
+    { RelayGetFWRevision,   0x03, 1,  1, false, false, TimingRegister,   0, 0,    0, 0,     "getFWrev" },
+    { RelayReset,           0x0f, 1,  0, false, false, TimingReset,      0, 0,    0, 0,     "RESET" },
+    { RelayOn,              0x10, 1,  0, false, false, TimingRegister,   1, 7,    0, 0,     "relayON" },
+    { RelayOff,             0x11, 1,  0, false, false, TimingRegister,   1, 7,    0, 0,     "relayOFF" },
+    { RelayToggle,          0x12, 1,  0, false, false, TimingRegister,   1, 7,    0, 0,     "relayTOGGLE" },
+    { RelayAll,             0x13, 1,  0, false, false, TimingRegister,   0, 0x7f, 0, 0,     "relayALL" },
+    { RelayGetAll,          0x14, 1,  1, false, false, TimingRegister,   0, 0,    0, 0,     "relaySTATE" },
+    { RelaySetLed,          0x60, 1,  0, false, false, TimingRegister,   0, 1,    0, 0,     "setLED" },
+    { RelayClearLed,        0x61, 1,  0, false, false, TimingRegister,   0, 1,    0, 0,     "clrLED" },
+    { RelayToggleLed,       0x62, 1,  0, false, false, TimingRegister,   0, 1,    0, 0,     "toggleLED" },
+    { RelayGetLed,          0x63, 1,  1, false, false, TimingRegister,   0, 1,    0, 0,     "getLED" },
+
+    { Daqc2GetAddress,      0x00, 1,  1, false, true,  TimingRegister,   0, 0,    0, 0,     "getADDR" },
+    { Daqc2GetId,           0x01, 1, 20, true,  true,  TimingRegister,   0, 0,    0, 0,     "getID" },
+    { Daqc2GetHWRevision,   0x02, 1,  1, false, true,  TimingRegister,   0, 0,    0, 0,     "getHWrev" },
+    { Daqc2GetFWRevision,   0x03, 1,  1, false, true,  TimingRegister,   0, 0,    0, 0,     "getFWrev" },
+    { Daqc2Reset,           0x0f, 1,  0, false, true,  TimingReset,      0, 0,    0, 0,     "RESET" },
+    { Daqc2IntEnable,       0x04, 1,  0, false, true,  TimingRegister,   0, 0,    0, 0,     "intEnable" },
+    { Daqc2IntDisable,      0x05, 1,  0, false, true,  TimingRegister,   0, 0,    0, 0,     "intDisable" },
+    { Daqc2GetIntFlags,     0x06, 1,  2, false, true,  TimingRegister,   0, 0,    0, 0,     "getINTflags" },
+    { Daqc2SetDout,         0x10, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "setDOUTbit" },
+    { Daqc2ClearDout,       0x11, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "clrDOUTbit" },
+    { Daqc2ToggleDout,      0x12, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "toggleDOUTbit" },
+    { Daqc2GetDin,          0x20, 1,  1, false, true,  TimingRegister,   0, 7,    0, 0,     "getDINbit" },
+    { Daqc2DinIrqFalling,   0x21, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "enableDINint falling" },
+    { Daqc2DinIrqRising,    0x22, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "enableDINint rising" },
+    { Daqc2DinIrqBoth,      0x23, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "enableDINint both" },
+    { Daqc2DinIrqOff,       0x24, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "disableDINint" },
+    { Daqc2GetDinAll,       0x25, 1,  1, false, true,  TimingRegister,   0, 0,    0, 0,     "getDINall" },
+    { Daqc2GetAdc,          0x30, 1,  2, false, true,  TimingConversion, 0, 8,    0, 0,     "getADC" },
+    { Daqc2GetAdcAll,       0x31, 1, 16, false, true,  TimingConversion, 0, 0,    0, 0,     "getADCall" },
+    { Daqc2SetDac,          0x40, 4,  0, false, true,  TimingRegister,   0, 0x0f, 0, 0xff,  "setDAC" },
+    { Daqc2SetLed,          0x60, 1,  0, false, true,  TimingRegister,   0, 7,    0, 0,     "setLED" },
+    { Daqc2GetLed,          0x63, 1,  1, false, true,  TimingRegister,   0, 0,    0, 0,     "getLED" },
+    { Daqc2ReadCal,         0xfd, 1,  1, false, true,  TimingEeprom,     2, 2,    0, 0xff,  "CalGetByte" },
+};
+
+/// true when every row sits at its own index, so the table can be indexed by PlateCommand
+constexpr bool plateCommandsInOrder( int i = 0 )
+{
+    return i == PlateCommandCount || ( plateCommands[i].command == i && plateCommandsInOrder(i + 1) );
+}
+
+static_assert( plateCommandsInOrder(), "plateCommands is out of PlateCommand order" );
+
+/**
+ * @brief The CommandTraits struct  The descriptor of C as compile time constants, see SPIBase::send.
+ */
+template<PlateCommand C>
+struct CommandTraits
+{
+    static constexpr uint8_t opcode = plateCommands[C].opcode;
+    static constexpr int     readback = plateCommands[C].readback;
+    static constexpr bool    stopAt0 = plateCommands[C].stopAt0;
+    static constexpr bool    ack = plateCommands[C].ack;
+    static constexpr bool    reads = readback > 0 || stopAt0;
+
+    static constexpr bool accepts( uint8_t arg1, uint8_t arg2, uint8_t unit )
+    {
+        return arg1 >= plateCommands[C].arg1Min && arg1 <= plateCommands[C].arg1Max
+            && arg2 >= plateCommands[C].arg2Min && arg2 <= plateCommands[C].arg2Max
+            && unit < plateCommands[C].units;
+    }
+
+    static_assert( !stopAt0 || readback > 0, "a stopAt0 answer needs a bound" );
+};
+
+}
+
+#endif // PLATECOMMANDS_H
@@ -0,0 +1,438 @@
+#include "plateregistry.h"
+#include "busexecutor.h"
+#include "platesnapshot.h"
+
+namespace SPIW {
+
+PlateRegistry::PlateRegistry(PlateBus &x_bus)
+    : bus(x_bus)
+    , snapshot(&x_bus == &PlateBus::defaultBus() ? &PlateSnapshot::instance()
+                                                 : new PlateSnapshot(PlateSnapshot::path(x_bus.getConfig())))
+    , ownsSnapshot(&x_bus != &PlateBus::defaultBus())
+    , relayPresent(0)
+    , daqc2Present(0)
+    , relayCount(0)
+    , daqc2Count(0)
+    , discovered(false)
+    , fromSnapshot(false)
+    , scanUs(0)
+    , lateStop(false)
+{
+    std::fill( &relays[0], &relays[PP_MAX_BOARDS], (RELAYPlate*)NULL );
+    std::fill( &daqc2s[0], &daqc2s[PP_MAX_BOARDS], (DAQC2Plate*)NULL );
+    std::fill( &infoRead[0], &infoRead[PP_MAX_BOARDS * 2], false );
+}
+
+PlateRegistry::~PlateRegistry()
+{
+    /// the transport may already be gone at exit, only free the plates
+    clear();
+    if( ownsSnapshot )
+        delete snapshot;
+}
+
+PlateRegistry &PlateRegistry::instance()
+{
+    static PlateRegistry registry(PlateBus::defaultBus());
+    return registry;
+}
+
+/// registries of the other buses, freed at exit like the default one
+struct BusRegistries
+{
+    std::mutex lock;
+    std::map<PlateBus*, PlateRegistry*> registries;
+
+    ~BusRegistries()
+    {
+        for( std::map<PlateBus*, PlateRegistry*>::iterator it = registries.begin(); it != registries.end(); ++it )
+            delete it->second;
+    }
+};
+
+PlateRegistry &PlateRegistry::forBus(PlateBus &x_bus)
+{
+    if( &x_bus == &PlateBus::defaultBus() )
+        return instance();
+
+    static BusRegistries others;
+    std::lock_guard<std::mutex> guard(others.lock);
+    PlateRegistry* &registry = others.registries[&x_bus];
+    if( registry == NULL )
+        registry = new PlateRegistry(x_bus);
+    return *registry;
+}
+
+int PlateRegistry::discover(bool force)
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    if( discovered && !force )
+    {
+        mergeLate();
+        return relayCount + daqc2Count;
+    }
+
+    clear();
+    if( !force && warmStart() )
+        return relayCount + daqc2Count;
+    clear();
+
+    SPITransport* transport = bus.transport();
+    uint64_t start = transport->nowMicroseconds();
+    snapshot->clear();
+
+    /// RELAY and DAQC2 addresses are contiguous, one pass, one address echo each, a DAQC2 answers after ppACK
+    bool open = bus.open();
+    for( int address = PP_RELAY_BASE_ADDR; open && address < PP_DAQC2_BASE_ADDR + PP_MAX_BOARDS; ++address )
+    {
+        SPIBase probe( bus, address, address >= PP_DAQC2_BASE_ADDR );
+        if( probe.ValidBoard() )
+            markPresent( address );
+    }
+
+    scanUs = transport->nowMicroseconds() - start;
+    discovered = true;
+    snapshot->save( snapshot->file() );
+    return relayCount + daqc2Count;
+}
+
+bool PlateRegistry::warmStart()
+{
+    std::vector<uint8_t> addresses = snapshot->addresses();
+    if( addresses.empty() || !bus.open() )
+        return false;
+
+    SPITransport* transport = bus.transport();
+    uint64_t start = transport->nowMicroseconds();
+    for( size_t i = 0; i < addresses.size(); ++i )
+    {
+        uint8_t address = addresses[i];
+        if( address < PP_RELAY_BASE_ADDR || address >= PP_DAQC2_BASE_ADDR + PP_MAX_BOARDS )
+            return false;
+
+        SPIBase probe( bus, address, address >= PP_DAQC2_BASE_ADDR );
+        if( !probe.ValidBoard() )
+        {
+            PP_INFO() << "plate snapshot is stale at address" << (int)address << ", scanning";
+            return false;
+        }
+        markPresent( address );
+    }
+
+    scanUs = transport->nowMicroseconds() - start;
+    discovered = true;
+    fromSnapshot = true;
+
+    // a board added since the snapshot only answers at an address it does not list
+    lateScan = std::thread(&PlateRegistry::scanUnlisted, this, relayPresent, daqc2Present);
+    return true;
+}
+
+bool PlateRegistry::markPresent(uint8_t address)
+{
+    if( address >= PP_RELAY_BASE_ADDR && address < PP_RELAY_BASE_ADDR + PP_MAX_BOARDS )
+    {
+        relayPresent |= 1 << (address - PP_RELAY_BASE_ADDR);
+        relayCount++;
+        snapshot->setPresent( address, "RELAY" );
+        PP_INFO() << "FOUND RELAY CARD AT ADDRESS " << address;
+        return true;
+    }
+    if( address >= PP_DAQC2_BASE_ADDR && address < PP_DAQC2_BASE_ADDR + PP_MAX_BOARDS )
+    {
+        daqc2Present |= 1 << (address - PP_DAQC2_BASE_ADDR);
+        daqc2Count++;
+        snapshot->setPresent( address, "DAQC2" );
+        PP_INFO() << "FOUND DAQC2 AT ADDRESS " << address;
+        return true;
+    }
+    return false;
+}
+
+void PlateRegistry::scanUnlisted(uint8_t listedRelays, uint8_t listedDaqc2s)
+{
+    for( int address = PP_RELAY_BASE_ADDR; address < PP_DAQC2_BASE_ADDR + PP_MAX_BOARDS && !lateStop; ++address )
+    {
+        int board = (address - PP_RELAY_BASE_ADDR) % PP_MAX_BOARDS;
+        uint8_t listed = address < PP_DAQC2_BASE_ADDR ? listedRelays : listedDaqc2s;
+        if( (listed & (1 << board)) != 0 )
+            continue;
+
+        SPIBase probe( bus, address, address >= PP_DAQC2_BASE_ADDR );
+        if( !probe.ValidBoard() )
+            continue;
+        std::lock_guard<std::mutex> guard(lateLock);
+        lateFound.push_back( address );
+    }
+}
+
+void PlateRegistry::mergeLate()
+{
+    std::vector<uint8_t> found;
+    {
+        std::lock_guard<std::mutex> guard(lateLock);
+        found.swap(lateFound);
+    }
+    if( found.empty() )
+        return;
+
+    for( size_t i = 0; i < found.size(); ++i )
+        markPresent( found[i] );
+    snapshot->save( snapshot->file() );
+}
+
+bool PlateRegistry::warm()
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    return fromSnapshot;
+}
+
+uint64_t PlateRegistry::lastScanUs()
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    return scanUs;
+}
+
+bool PlateRegistry::present(uint8_t address)
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    discover();
+    if( address >= PP_RELAY_BASE_ADDR && address < PP_RELAY_BASE_ADDR + PP_MAX_BOARDS )
+        return (relayPresent & (1 << (address - PP_RELAY_BASE_ADDR))) != 0;
+    if( address >= PP_DAQC2_BASE_ADDR && address < PP_DAQC2_BASE_ADDR + PP_MAX_BOARDS )
+        return (daqc2Present & (1 << (address - PP_DAQC2_BASE_ADDR))) != 0;
+    return false;
+}
+
+bool PlateRegistry::info(uint8_t address, PlateInfo &plateInfo)
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    if( !present(address) )
+        return false;
+
+    int slot = address - PP_RELAY_BASE_ADDR;
+    if( !infoRead[slot] )
+    {
+        SPIBase* plate;
+        if( address < PP_DAQC2_BASE_ADDR )
+            plate = relay( slot );
+        else
+            plate = daqc2( slot - PP_MAX_BOARDS );
+        if( plate == NULL )
+            return false;
+
+        PlateInfo &info = infos[slot];
+        info.address = address;
+        snprintf(info.type, sizeof(info.type), "%s", plate->boardType());
+        plate->getID(info.id, sizeof(info.id));
+        plate->getFWRevision(info.fwRevision, sizeof(info.fwRevision));
+
+        // the snapshot only speaks for the board it was read from, another one swapped in at the
+        // address differs in id or firmware and is read in full
+        SnapshotPlate cached;
+        if( snapshot->find(address, cached) && cached.hasInfo && cached.id == info.id && cached.fwRevision == info.fwRevision )
+            snprintf(info.hwRevision, sizeof(info.hwRevision), "%s", cached.hwRevision.c_str());
+        else
+        {
+            plate->getHWRevision(info.hwRevision, sizeof(info.hwRevision));
+            snapshot->setInfo( address, info.id, info.hwRevision, info.fwRevision );
+            snapshot->save( snapshot->file() );
+        }
+        infoRead[slot] = true;
+    }
+    plateInfo = infos[slot];
+    return true;
+}
+
+RELAYPlate *PlateRegistry::relay(int board)
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    if( board < 0 || board >= PP_MAX_BOARDS )
+        return NULL;
+    discover();
+
+    /// built on first use, a present board costs nothing until then
+    if( relays[board] == NULL && (relayPresent & (1 << board)) != 0 )
+        relays[board] = new RELAYPlate( bus, PP_RELAY_BASE_ADDR + board );
+    return relays[board];
+}
+
+DAQC2Plate *PlateRegistry::daqc2(int board)
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    if( board < 0 || board >= PP_MAX_BOARDS )
+        return NULL;
+    discover();
+
+    if( daqc2s[board] == NULL && (daqc2Present & (1 << board)) != 0 )
+    {
+        uint8_t address = PP_DAQC2_BASE_ADDR + board;
+        DAQC2Plate* plate = new DAQC2Plate( bus, address );
+
+        /// id, firmware and four calibration bytes instead of 48 while the board is the one in the snapshot,
+        /// otherwise the plate reads it on first ADC use and the snapshot keeps it for next time
+        SnapshotPlate cached;
+        uint8_t fwByte = plate->getFWRevisionByte();
+        char id[PP_ID_SIZE] = "";
+        plate->getID(id, sizeof(id));
+        if( snapshot->find(address, cached) && cached.hasCal && cached.calFwByte == fwByte && cached.calId == id
+            && plate->matchesCalibration(cached.cal) )
+            plate->setCalibration( cached.cal );
+        else
+        {
+            PlateSnapshot* kept = snapshot;
+            std::string readFrom(id);
+            plate->onCalibrated( [kept, fwByte, readFrom](DAQC2Plate &calibratedPlate)
+            {
+                kept->setCalibration( calibratedPlate.getAddress(), fwByte, readFrom, calibratedPlate.getCalibration() );
+                kept->save( kept->file() );
+            } );
+        }
+        daqc2s[board] = plate;
+    }
+    return daqc2s[board];
+}
+
+int PlateRegistry::relaysAvailable()
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    discover();
+    return relayCount;
+}
+
+/// RELAYALL to each board, nothing between the frames
+static void sendRelayAll(RELAYPlate** boards, const uint8_t* masks, bool* valid, int count)
+{
+    for( int i = 0; i < count; ++i )
+    {
+        rtnStructure frame = boards[i]->SendCommand( boards[i]->relayAllCommand(masks[i]), 0, false );
+        valid[i] = frame.valid;
+    }
+}
+
+RelayImage PlateRegistry::relayImage()
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    discover();
+
+    RelayImage image;
+    for( int board = 0; board < PP_MAX_BOARDS; ++board )
+    {
+        RELAYPlate* plate = relay( board );
+        int mask = plate != NULL ? plate->getRelayMask() : 0;
+        if( mask < 0 )
+            mask = 0;
+        image |= RelayImage(mask) << (board * 7);
+    }
+    return image;
+}
+
+int PlateRegistry::applyImage(const RelayImage &image, int results[PP_MAX_BOARDS])
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    discover();
+
+    int rtn = 0;
+    int status[PP_MAX_BOARDS];
+    uint8_t want[PP_MAX_BOARDS];
+    RELAYPlate* changed[PP_MAX_BOARDS];
+    int changedBoard[PP_MAX_BOARDS];
+    int changedCount = 0;
+
+    /// a board to switch stays locked until its shadow has the result, a setBit or flush in between would be lost
+    std::unique_lock<std::mutex> held[PP_MAX_BOARDS];
+
+    /// everything that can cost a read happens before the first write
+    for( int board = 0; board < PP_MAX_BOARDS; ++board )
+    {
+        want[board] = (uint8_t)((image >> (board * 7)).to_ulong() & PP_RELAY_MASK);
+        RELAYPlate* plate = relay( board );
+        if( plate == NULL )
+        {
+            status[board] = PP_IMAGE_ABSENT;
+            if( want[board] != 0 )
+                rtn = SPIERROR;
+            continue;
+        }
+
+        held[board] = std::unique_lock<std::mutex>(plate->coalesceLock);
+        int have = plate->relayMaskLocked();
+        if( have == want[board] )
+        {
+            held[board].unlock();
+            status[board] = PP_IMAGE_UNCHANGED;
+            continue;
+        }
+        changed[changedCount] = plate;
+        changedBoard[changedCount] = board;
+        changedCount++;
+    }
+
+    /// the frames go out back to back, on the bus thread nothing else can get between them
+    bool valid[PP_MAX_BOARDS];
+    uint8_t masks[PP_MAX_BOARDS];
+    for( int i = 0; i < changedCount; ++i )
+        masks[i] = want[changedBoard[i]];
+    BusExecutor* executor = bus.executor();
+    if( executor != NULL && !executor->onBusThread() )
+        executor->post( [&]() { sendRelayAll(changed, masks, valid, changedCount); } ).get();
+    else
+        sendRelayAll(changed, masks, valid, changedCount);
+
+    for( int i = 0; i < changedCount; ++i )
+    {
+        int board = changedBoard[i];
+        changed[i]->noteRelayAllLocked(want[board], valid[i]);
+        status[board] = valid[i] ? PP_IMAGE_WRITTEN : SPIERROR;
+        if( !valid[i] )
+            rtn = SPIERROR;
+    }
+
+    if( results != NULL )
+        std::copy( &status[0], &status[PP_MAX_BOARDS], results );
+    return rtn;
+}
+
+int PlateRegistry::daqc2Available()
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    discover();
+    return daqc2Count;
+}
+
+void PlateRegistry::clear()
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    if( lateScan.joinable() )
+    {
+        lateStop = true;
+        lateScan.join();
+        lateStop = false;
+    }
+    lateFound.clear();
+    for( int board = 0; board < PP_MAX_BOARDS; ++board )
+    {
+        delete relays[board];
+        relays[board] = NULL;
+        delete daqc2s[board];
+        daqc2s[board] = NULL;
+    }
+    std::fill( &infoRead[0], &infoRead[PP_MAX_BOARDS * 2], false );
+    relayPresent = 0;
+    daqc2Present = 0;
+    relayCount = 0;
+    daqc2Count = 0;
+    discovered = false;
+    fromSnapshot = false;
+}
+
+void PlateRegistry::shutdown()
+{
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    bool wasOpen = discovered;
+    clear();
+    if( wasOpen )
+        bus.transport()->closeDevice();
+}
+
+}
@@ -0,0 +1,180 @@
+#ifndef PLATEREGISTRY_H
+#define PLATEREGISTRY_H
+
+#include "relayplate.h"
+#include "daqc2plate.h"
+#include <atomic>
+#include <bitset>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SPIW {
+
+class PlateSnapshot;
+
+#define PP_RELAY_BASE_ADDR      24
+#define PP_DAQC2_BASE_ADDR      32
+#define PP_MAX_BOARDS           8
+
+/// relays of a full RELAY stack, global relay p (1..56) is on board (p-1)/7
+#define PP_STACK_RELAYS         (PP_MAX_BOARDS * 7)
+
+/// per board results of applyImage, failures are SPIERROR
+#define PP_IMAGE_UNCHANGED      0
+#define PP_IMAGE_WRITTEN        1
+#define PP_IMAGE_ABSENT         2
+
+/// bit p-1 is global relay p, bits board*7..board*7+6 are the RELAYALL mask of board
+typedef std::bitset<PP_STACK_RELAYS> RelayImage;
+
+/**
+ * @brief The PlateInfo struct  What a plate says about itself, read the first time it is asked for.
+ */
+struct PlateInfo
+{
+    uint8_t address;
+    char    type[PP_REVISION_SIZE];
+    char    id[PP_ID_SIZE];
+    char    hwRevision[PP_REVISION_SIZE];
+    char    fwRevision[PP_REVISION_SIZE];
+};
+
+/**
+ * @brief The PlateRegistry class  Owner of the discovered plates of one PlateBus.
+ *
+ * The stack is scanned once, the RELAYPlate/DAQC2Plate objects and the spi fd then live until
+ * shutdown(), so exported calls no longer pay for board construction, gpio setup and a spi reopen.
+ *
+ * The scan is one address echo per address, RELAY and DAQC2 ranges in one pass. Plates are only
+ * built, and their id and revisions only read, when somebody asks for them.
+ *
+ * What a scan finds, and the metadata and calibrations read later, go to the PlateSnapshot. The next
+ * process starts warm from it and only echoes the listed addresses, any of them not answering falls
+ * back to a full scan. The other addresses are then echoed on a background thread, a board added
+ * since the snapshot joins the inventory on the next call; discover(true) rescans at once.
+ *
+ * There is one registry per bus, each with its own snapshot file; instance() is the one of the
+ * default bus. A registry lives until exit, its bus must as well.
+ */
+class PlateRegistry
+{
+private :
+
+    PlateBus&   bus;
+
+    /// PlateSnapshot::instance() on the default bus, owned otherwise
+    PlateSnapshot* snapshot;
+    bool           ownsSnapshot;
+
+    RELAYPlate* relays[PP_MAX_BOARDS];
+    DAQC2Plate* daqc2s[PP_MAX_BOARDS];
+
+    /// bit n set when board n answered the scan
+    uint8_t     relayPresent;
+    uint8_t     daqc2Present;
+    int         relayCount;
+    int         daqc2Count;
+    bool        discovered;
+    bool        fromSnapshot;
+    uint64_t    scanUs;
+
+    /// metadata per address 24..39, filled lazily
+    PlateInfo   infos[PP_MAX_BOARDS * 2];
+    bool        infoRead[PP_MAX_BOARDS * 2];
+
+    std::recursive_mutex lock;
+
+    /// the background echo of the addresses a warm start did not list, it never takes lock
+    std::thread          lateScan;
+    std::atomic<bool>    lateStop;
+    std::mutex           lateLock;
+    std::vector<uint8_t> lateFound;
+
+    void scanUnlisted( uint8_t listedRelays, uint8_t listedDaqc2s );
+
+    /// adds what the background echo found
+    void mergeLate();
+
+    /// marks address present, false outside the RELAY and DAQC2 ranges
+    bool markPresent( uint8_t address );
+
+    explicit PlateRegistry( PlateBus &x_bus );
+    ~PlateRegistry();
+
+    friend struct BusRegistries;
+
+    /// deletes the plates, leaves the bus alone
+    void clear();
+
+    /// takes the inventory from the snapshot if every listed plate still echoes its address
+    bool warmStart();
+
+    PlateRegistry( const PlateRegistry& );
+    PlateRegistry& operator=( const PlateRegistry& );
+
+public:
+
+    /// the registry of the default bus
+    static PlateRegistry& instance();
+
+    /// the registry of x_bus, made on first use
+    static PlateRegistry& forBus( PlateBus &x_bus );
+
+    /// the stack this registry scans
+    PlateBus &getBus()
+    {
+        return bus;
+    }
+
+    /// hold this while using a returned plate, shutdown() takes it before deleting the plates
+    std::recursive_mutex& mutex()
+    {
+        return lock;
+    }
+
+    /// scans RELAY (24..31) and DAQC2 (32..39) addresses once, or starts warm from the snapshot,
+    /// force rescans the whole range, returns the number of plates
+    int discover( bool force = false );
+
+    /// true if the last discover came from the snapshot
+    bool warm();
+
+    /// how long the last scan took, usec
+    uint64_t lastScanUs();
+
+    /// true if address 24..39 answered the scan
+    bool present( uint8_t address );
+
+    /// id and revisions of the plate at address, read on the first call, false if no plate is there;
+    /// the hardware revision comes from the snapshot while id and firmware match it
+    bool info( uint8_t address, PlateInfo &plateInfo );
+
+    /// the relay board 0..7 (address 24 + board), NULL if not present, discovers on first use
+    RELAYPlate* relay( int board );
+
+    /// the DAQC2 board 0..7 (address 32 + board), NULL if not present, discovers on first use
+    DAQC2Plate* daqc2( int board );
+
+    /// number of relay plates found
+    int relaysAvailable();
+
+    /// the relays of the stack as the shadows of the boards have them, absent boards read as off
+    RelayImage relayImage();
+
+    /// switches the stack to image with one RELAYALL frame per board that changes, sent back to back,
+    /// results gets one PP_IMAGE_* or SPIERROR per board, returns 0 or SPIERROR if any board failed
+    /// or an absent board was asked to switch a relay on
+    int applyImage( const RelayImage &image, int results[PP_MAX_BOARDS] = NULL );
+
+    /// number of DAQC2 plates found
+    int daqc2Available();
+
+    /// deletes all plates and closes the spi device of the bus, the next call discovers again
+    void shutdown();
+};
+
+}
+
+#endif // PLATEREGISTRY_H
@@ -0,0 +1,220 @@
+#include "platesnapshot.h"
+#include "plateregistry.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SPIW {
+
+/// RELAY and DAQC2 addresses, a line naming anything else is not from this library
+static bool plateAddress(int address)
+{
+    return address >= PP_RELAY_BASE_ADDR && address < PP_DAQC2_BASE_ADDR + PP_MAX_BOARDS;
+}
+
+PlateSnapshot::PlateSnapshot(const std::string &x_file)
+    : fileName(x_file)
+{
+    /// a missing file only means the next start is a cold one
+    load(fileName);
+}
+
+PlateSnapshot &PlateSnapshot::instance()
+{
+    static PlateSnapshot snapshot(path());
+    return snapshot;
+}
+
+std::string PlateSnapshot::path()
+{
+    const char* env = getenv("PIPLATE_SNAPSHOT_FILE");
+    if( env != NULL && *env != 0 )
+        return std::string(env);
+    return std::string(PP_SNAPSHOT_FILE);
+}
+
+std::string PlateSnapshot::path(const BusConfig &config)
+{
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".spi%d.%d.frame%d", config.spiBus, config.device, config.pinFrame);
+    return path() + suffix;
+}
+
+bool PlateSnapshot::empty()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return plates.empty();
+}
+
+std::vector<uint8_t> PlateSnapshot::addresses()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<uint8_t> list;
+    for( std::map<uint8_t, SnapshotPlate>::const_iterator it = plates.begin(); it != plates.end(); ++it )
+        list.push_back(it->first);
+    return list;
+}
+
+bool PlateSnapshot::find(uint8_t address, SnapshotPlate &plate)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<uint8_t, SnapshotPlate>::const_iterator it = plates.find(address);
+    if( it == plates.end() )
+        return false;
+    plate = it->second;
+    return true;
+}
+
+void PlateSnapshot::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    plates.clear();
+}
+
+void PlateSnapshot::setPresent(uint8_t address, const char *boardType)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    SnapshotPlate &plate = plates[address];
+    plate.address = address;
+    plate.type = boardType;
+}
+
+void PlateSnapshot::setInfo(uint8_t address, const std::string &id, const std::string &hwRevision, const std::string &fwRevision)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<uint8_t, SnapshotPlate>::iterator it = plates.find(address);
+    if( it == plates.end() )
+        return;
+    it->second.hasInfo = true;
+    it->second.id = id;
+    it->second.hwRevision = hwRevision;
+    it->second.fwRevision = fwRevision;
+}
+
+void PlateSnapshot::setCalibration(uint8_t address, uint8_t fwByte, const std::string &id, const PlateCalibration &cal)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<uint8_t, SnapshotPlate>::iterator it = plates.find(address);
+    if( it == plates.end() )
+        return;
+    it->second.hasCal = true;
+    it->second.calFwByte = fwByte;
+    it->second.calId = id;
+    it->second.cal = cal;
+}
+
+bool PlateSnapshot::load(const std::string &file)
+{
+    FILE* fp = fopen(file.c_str(), "r");
+    if( fp == NULL )
+        return false;
+
+    std::lock_guard<std::mutex> guard(lock);
+    char line[1024];
+    while( fgets(line, sizeof(line), fp) != NULL )
+    {
+        int address, fw, used;
+        char type[32], hw[32], fwRev[32];
+        if( line[0] == '#' )
+            continue;
+
+        if( sscanf(line, "PLATE %d %31s", &address, type) == 2 && plateAddress(address) )
+        {
+            plates[address].address = address;
+            plates[address].type = type;
+        }
+        else if( sscanf(line, "INFO %d %31s %31s %n", &address, hw, fwRev, &used) == 3 && plates.count(address) )
+        {
+            // the id has blanks in it, it is the rest of the line
+            std::string id(line + used);
+            while( !id.empty() && (id[id.size() - 1] == '\n' || id[id.size() - 1] == '\r') )
+                id.erase(id.size() - 1);
+            SnapshotPlate &plate = plates[address];
+            plate.hasInfo = true;
+            plate.id = id;
+            plate.hwRevision = hw;
+            plate.fwRevision = fwRev;
+        }
+        else if( sscanf(line, "CAL %d %d %n", &address, &fw, &used) == 2 && plates.count(address) )
+        {
+            PlateCalibration cal;
+            double* values[3] = { cal.scale, cal.offset, cal.dac };
+            const char* p = line + used;
+            bool complete = true;
+            for( int k = 0; k < 3 && complete; ++k )
+            {
+                for( int i = 0; i < 8 && complete; ++i )
+                {
+                    int n = 0;
+                    complete = sscanf(p, "%lf %n", &values[k][i], &n) == 1;
+                    p += n;
+                }
+            }
+            if( !complete )
+                continue;
+
+            // the id follows the values, an entry written without one never matches a board
+            std::string id(p);
+            while( !id.empty() && (id[id.size() - 1] == '\n' || id[id.size() - 1] == '\r') )
+                id.erase(id.size() - 1);
+            SnapshotPlate &plate = plates[address];
+            plate.hasCal = true;
+            plate.calFwByte = (uint8_t)fw;
+            plate.calId = id;
+            plate.cal = cal;
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+bool PlateSnapshot::save(const std::string &file)
+{
+    // make the directory, fine if it already exists
+    std::string::size_type slash = file.rfind('/');
+    if( slash != std::string::npos && slash > 0 )
+        mkdir(file.substr(0, slash).c_str(), 0755);
+
+    // written next to the file and renamed over it, a crash part way leaves the old one whole
+    std::lock_guard<std::mutex> guard(lock);
+    std::string temp = file + ".tmp";
+    FILE* fp = fopen(temp.c_str(), "w");
+    if( fp == NULL )
+    {
+        PP_WARN() << "Unable to write the plate snapshot to" << file.c_str();
+        return false;
+    }
+
+    fprintf(fp, "# PLATE address type\n");
+    fprintf(fp, "# INFO address hwRevision fwRevision id\n");
+    fprintf(fp, "# CAL address fwByte scale[8] offset[8] dac[8] id\n");
+    for( std::map<uint8_t, SnapshotPlate>::const_iterator it = plates.begin(); it != plates.end(); ++it )
+    {
+        const SnapshotPlate &plate = it->second;
+        fprintf(fp, "PLATE %d %s\n", plate.address, plate.type.c_str());
+        if( plate.hasInfo )
+            fprintf(fp, "INFO %d %s %s %s\n", plate.address, plate.hwRevision.c_str(), plate.fwRevision.c_str(), plate.id.c_str());
+        if( plate.hasCal )
+        {
+            const double* values[3] = { plate.cal.scale, plate.cal.offset, plate.cal.dac };
+            fprintf(fp, "CAL %d %d", plate.address, plate.calFwByte);
+            for( int k = 0; k < 3; ++k )
+                for( int i = 0; i < 8; ++i )
+                    fprintf(fp, " %.17g", values[k][i]);
+            fprintf(fp, " %s\n", plate.calId.c_str());
+        }
+    }
+
+    bool written = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if( fclose(fp) != 0 )
+        written = false;
+    if( !written || rename(temp.c_str(), file.c_str()) != 0 )
+    {
+        PP_WARN() << "Unable to write the plate snapshot to" << file.c_str();
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,112 @@
+#ifndef PLATESNAPSHOT_H
+#define PLATESNAPSHOT_H
+
+#include "daqc2plate.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace SPIW {
+
+/// where the inventory of the last scan is kept, PIPLATE_SNAPSHOT_FILE overrides it
+#define PP_SNAPSHOT_FILE        "/var/lib/piplates/inventory.conf"
+
+/**
+ * @brief The SnapshotPlate struct  One plate of the inventory file.
+ */
+struct SnapshotPlate
+{
+    uint8_t     address;
+    std::string type;
+
+    /// id and revisions, valid when hasInfo
+    bool        hasInfo;
+    std::string id;
+    std::string hwRevision;
+    std::string fwRevision;
+
+    /// id and raw firmware byte of the board the calibration was read from, valid when hasCal
+    bool        hasCal;
+    uint8_t     calFwByte;
+    std::string calId;
+    PlateCalibration cal;
+
+    SnapshotPlate()
+        : address(0)
+        , hasInfo(false)
+        , hasCal(false)
+        , calFwByte(0)
+    {
+    }
+};
+
+/**
+ * @brief The PlateSnapshot class  Inventory, metadata and DAQC2 calibration of the last scan, kept in PP_SNAPSHOT_FILE.
+ *
+ * PlateRegistry starts warm from it: the listed addresses are checked with one address echo each and
+ * the ids, revisions and calibrations come from the file. A DAQC2 calibration is only used while the
+ * board still reports the id and firmware it was read with and a few of its calibration bytes agree.
+ */
+class PlateSnapshot
+{
+private :
+
+    std::map<uint8_t, SnapshotPlate> plates;
+    std::mutex lock;
+    std::string fileName;
+
+    PlateSnapshot( const PlateSnapshot& );
+    PlateSnapshot& operator=( const PlateSnapshot& );
+
+public:
+
+    /// the snapshot kept in x_file, read now
+    explicit PlateSnapshot( const std::string &x_file );
+
+    /// the snapshot of the default bus, PP_SNAPSHOT_FILE is read on first use
+    static PlateSnapshot& instance();
+
+    /// path of the snapshot file of the default bus
+    static std::string path();
+
+    /// path of the snapshot file of the stack on config, next to the default one
+    static std::string path( const BusConfig &config );
+
+    /// the file this snapshot is read from and saved to
+    const std::string &file() const
+    {
+        return fileName;
+    }
+
+    /// true if no plate is listed
+    bool empty();
+
+    /// addresses of the listed plates, ascending
+    std::vector<uint8_t> addresses();
+
+    /// copies the entry of address, false if it is not listed
+    bool find( uint8_t address, SnapshotPlate &plate );
+
+    /// forgets every plate, a new scan follows
+    void clear();
+
+    /// lists a plate found by a scan
+    void setPresent( uint8_t address, const char* boardType );
+
+    /// stores id and revisions of a listed plate
+    void setInfo( uint8_t address, const std::string &id, const std::string &hwRevision, const std::string &fwRevision );
+
+    /// stores the calibration of a listed DAQC2 with the id and firmware byte it was read with
+    void setCalibration( uint8_t address, uint8_t fwByte, const std::string &id, const PlateCalibration &cal );
+
+    /// reads the snapshot file, returns false if it could not be opened; plates outside 24..39 are skipped
+    bool load( const std::string &file );
+
+    /// writes file.tmp, syncs it and renames it over file, returns false on error
+    bool save( const std::string &file );
+};
+
+}
+
+#endif // PLATESNAPSHOT_H
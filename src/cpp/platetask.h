@@ -0,0 +1,180 @@
+#ifndef PLATETASK_H
+#define PLATETASK_H
+
+#ifdef PP_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+
+namespace SPIW {
+
+/**
+ * @brief The PlateTask class  A command, or a sequence of them, running on a BusLoop, awaited with co_await.
+ *
+ * The task is lazy, it runs when it is awaited or started and resumes its awaiter when it is done, so a
+ * chain of awaits never blocks the loop thread. start() runs a task from plain code on the loop thread and
+ * hands the result to a callback. The library has no exceptions, an escaping one terminates.
+ */
+template<typename T>
+class PlateTask
+{
+public:
+
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    /// resumes the awaiter, or finishes a started task
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend( Handle h ) noexcept
+        {
+            promise_type &p = h.promise();
+            if( p.continuation )
+                return p.continuation;
+            if( p.detached )
+            {
+                std::function<void (T)> cb = std::move(p.callback);
+                T value = std::move(p.value);
+                h.destroy();
+                if( cb )
+                    cb(std::move(value));
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type
+    {
+        T                       value;
+        std::coroutine_handle<> continuation;
+
+        /// set by start(), the frame frees itself at the end
+        bool                    detached;
+        std::function<void (T)> callback;
+
+        promise_type()
+            : value()
+            , detached(false)
+        {
+        }
+
+        PlateTask get_return_object()
+        {
+            return PlateTask(Handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return std::suspend_always();
+        }
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return FinalAwaiter();
+        }
+
+        void return_value( T x_value )
+        {
+            value = std::move(x_value);
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    /// what co_await on a task suspends on
+    struct Awaiter
+    {
+        Handle handle;
+
+        bool await_ready()
+        {
+            return !handle || handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting )
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume()
+        {
+            return std::move(handle.promise().value);
+        }
+    };
+
+private :
+
+    Handle handle;
+
+    explicit PlateTask( Handle h )
+        : handle(h)
+    {
+    }
+
+    PlateTask( const PlateTask& );
+    PlateTask& operator=( const PlateTask& );
+
+public:
+
+    PlateTask( PlateTask &&other )
+        : handle(std::exchange(other.handle, Handle()))
+    {
+    }
+
+    PlateTask& operator=( PlateTask &&other )
+    {
+        if( this != &other )
+        {
+            if( handle )
+                handle.destroy();
+            handle = std::exchange(other.handle, Handle());
+        }
+        return *this;
+    }
+
+    ~PlateTask()
+    {
+        if( handle )
+            handle.destroy();
+    }
+
+    Awaiter operator co_await() &&
+    {
+        return Awaiter { handle };
+    }
+
+    Awaiter operator co_await() &
+    {
+        return Awaiter { handle };
+    }
+
+    /// runs the task from plain code, cb gets the result, call it on the loop thread or through BusLoop::post
+    void start( std::function<void (T)> cb = std::function<void (T)>() )
+    {
+        if( !handle )
+            return;
+        Handle h = std::exchange(handle, Handle());
+        h.promise().detached = true;
+        h.promise().callback = std::move(cb);
+        h.resume();
+    }
+};
+
+}
+
+#endif // PP_COROUTINES
+
+#endif // PLATETASK_H
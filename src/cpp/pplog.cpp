@@ -0,0 +1,99 @@
+#include "pplog.h"
+#include <stdio.h>
+#ifndef PP_NO_QT
+#include <QDebug>
+#endif
+
+namespace SPIW {
+
+LogLine::~LogLine()
+{
+#ifndef PP_NO_QT
+    qDebug("%s", buffer);
+#else
+    // one write, lines from several threads do not interleave
+    buffer[used] = '\n';
+    fwrite(buffer, 1, used + 1, stderr);
+#endif
+}
+
+void LogLine::append(const char *text)
+{
+    if( used > 0 && used < PP_LOG_LINE - 1 )
+        buffer[used++] = ' ';
+    while( *text != 0 && used < PP_LOG_LINE - 1 )
+        buffer[used++] = *text++;
+    buffer[used] = 0;
+}
+
+LogLine &LogLine::operator<<(const char *text)
+{
+    append(text == NULL ? "(null)" : text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(int value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%d", value);
+    append(text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(unsigned int value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%u", value);
+    append(text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(long value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", value);
+    append(text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(unsigned long value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%lu", value);
+    append(text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(long long value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%lld", value);
+    append(text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(unsigned long long value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%llu", value);
+    append(text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(double value)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%g", value);
+    append(text);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(const void *value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%p", value);
+    append(text);
+    return *this;
+}
+
+}
@@ -0,0 +1,74 @@
+#ifndef PPLOG_H
+#define PPLOG_H
+
+#include <stddef.h>
+#include <string>
+
+namespace SPIW {
+
+/// log levels, a message is compiled in when its level is at most PP_LOG_LEVEL
+#define PP_LOG_OFF              0
+#define PP_LOG_ERROR            1
+#define PP_LOG_WARN             2
+#define PP_LOG_INFO             3
+#define PP_LOG_DEBUG            4
+
+/// everything by default, the core build keeps errors and warnings only
+#ifndef PP_LOG_LEVEL
+#define PP_LOG_LEVEL            PP_LOG_DEBUG
+#endif
+
+/// longest line, longer messages are cut
+#define PP_LOG_LINE             256
+
+/**
+ * @brief The LogLine class  One log message, built on the stack and written when it goes out of scope.
+ *
+ * Items are separated by a space as qDebug did. Use it through the PP_ERROR() ... PP_DEBUG() macros,
+ * a message above PP_LOG_LEVEL sits in a constant false branch, its arguments are never evaluated and
+ * the compiler drops it. The Qt build hands the line to qDebug so message handlers still see it, the
+ * core build writes it to stderr.
+ */
+class LogLine
+{
+private :
+    char   buffer[PP_LOG_LINE];
+    size_t used;
+
+    void append( const char* text );
+
+    LogLine( const LogLine& );
+    LogLine& operator=( const LogLine& );
+
+public:
+    LogLine() : used(0) { buffer[0] = 0; }
+    ~LogLine();
+
+    LogLine& operator<<( const char* text );
+    LogLine& operator<<( const std::string &text ) { return *this << text.c_str(); }
+    LogLine& operator<<( int value );
+    LogLine& operator<<( unsigned int value );
+    LogLine& operator<<( long value );
+    LogLine& operator<<( unsigned long value );
+    LogLine& operator<<( long long value );
+    LogLine& operator<<( unsigned long long value );
+    LogLine& operator<<( double value );
+    LogLine& operator<<( const void* value );
+};
+
+/// lets both branches of PP_LOG be void, & binds looser than the << chain
+struct LogVoid
+{
+    void operator&( const LogLine& ) {}
+};
+
+}
+
+#define PP_LOG(level)   ( (level) > PP_LOG_LEVEL ) ? (void)0 : ::SPIW::LogVoid() & ::SPIW::LogLine()
+
+#define PP_ERROR()      PP_LOG(PP_LOG_ERROR)
+#define PP_WARN()       PP_LOG(PP_LOG_WARN)
+#define PP_INFO()       PP_LOG(PP_LOG_INFO)
+#define PP_DEBUG()      PP_LOG(PP_LOG_DEBUG)
+
+#endif // PPLOG_H
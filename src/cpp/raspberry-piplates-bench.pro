@@ -0,0 +1,108 @@
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+CONFIG += exceptions
+CONFIG += thread
+
+TARGET = piplates-bench
+TEMPLATE = app
+
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt whi-lwiringPich as been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# You can also make your code fail to compile if you use deprecated APIs.
+# In order to do so, uncomment the following line.
+# You can also select to disable deprecated APIs only up to a certain version of Qt.
+#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+SOURCES += benchmark.cpp \
+           spibase.cpp \
+           relayplate.cpp \
+           daqc2plate.cpp \
+           simtransport.cpp \
+           timingprofile.cpp \
+           interruptdispatcher.cpp \
+           busexecutor.cpp \
+           platebus.cpp \
+           plateregistry.cpp \
+           platesnapshot.cpp \
+           adcstream.cpp \
+           adcconvert.cpp \
+           adccapture.cpp \
+           dacwaveform.cpp \
+           metrics.cpp \
+           tracering.cpp \
+           pplog.cpp
+
+LIBS += -lcrypt -lrt
+
+# the batch ADC kernels match the scalar conversion bit for bit only without fused multiply add
+QMAKE_CXXFLAGS += -ffp-contract=off
+
+# CONFIG += pp_adc_portable builds the plain C++ ADC kernel, piplates-bench --selftest checks either one
+pp_adc_portable {
+    DEFINES += PP_ADC_PORTABLE
+}
+
+# CONFIG += pp_metrics counts and times every frame, see metrics.h, without it the hooks compile out
+pp_metrics {
+    DEFINES += PP_METRICS
+}
+
+# CONFIG += pp_coroutines adds the awaitable commands on a BusLoop (C++20), see commandawait.h
+pp_coroutines {
+    CONFIG += c++2a
+    DEFINES += PP_COROUTINES
+    SOURCES += busloop.cpp
+    HEADERS += busloop.h commandawait.h
+}
+
+# CONFIG += pp_sim_only builds without wiringPi, the simulated bus is the only transport
+pp_sim_only {
+    DEFINES += PP_NO_WIRINGPI
+} else {
+    SOURCES += wiringpitransport.cpp
+    HEADERS += wiringpitransport.h
+    LIBS += -lwiringPi
+}
+
+
+QMAKE_INCDIR +=  $$[QT_SYSROOT]/usr/local/include
+
+target.path = /home/pi/piplates-bench
+INSTALLS += target
+
+INCLUDEPATH +=  $$[QT_SYSROOT]/usr/local/include
+
+
+HEADERS += \
+    spibase.h \
+    relayplate.h \
+    daqc2plate.h \
+    spitransport.h \
+    simtransport.h \
+    timingprofile.h \
+    interruptdispatcher.h \
+    busexecutor.h \
+    platebus.h \
+    plateregistry.h \
+    platesnapshot.h \
+    adcstream.h \
+    adcconvert.h \
+    adccapture.h \
+    dacwaveform.h \
+    metrics.h \
+    tracering.h \
+    frameprobe.h \
+    pplog.h \
+    platecommands.h \
+    platetask.h \
+    commandframe.h \
+    
+
+
@@ -23,9 +23,48 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += main.cpp \
            spibase.cpp \
            relayplate.cpp \
-           daqc2plate.cpp
+           daqc2plate.cpp \
+           simtransport.cpp \
+           timingprofile.cpp \
+           interruptdispatcher.cpp \
+           busexecutor.cpp \
+           platebus.cpp \
+           plateregistry.cpp \
+           platesnapshot.cpp \
+           adcstream.cpp \
+           adcconvert.cpp \
+           adccapture.cpp \
+           dacwaveform.cpp \
+           metrics.cpp \
+           tracering.cpp \
+           pplog.cpp
 
-LIBS += -lwiringPi -lcrypt -lrt
+LIBS += -lcrypt -lrt
+
+# the batch ADC kernels match the scalar conversion bit for bit only without fused multiply add
+QMAKE_CXXFLAGS += -ffp-contract=off
+
+# CONFIG += pp_metrics counts and times every frame, see metrics.h, without it the hooks compile out
+pp_metrics {
+    DEFINES += PP_METRICS
+}
+
+# CONFIG += pp_coroutines adds the awaitable commands on a BusLoop (C++20), see commandawait.h
+pp_coroutines {
+    CONFIG += c++2a
+    DEFINES += PP_COROUTINES
+    SOURCES += busloop.cpp
+    HEADERS += busloop.h commandawait.h
+}
+
+# CONFIG += pp_sim_only builds without wiringPi, the simulated bus is the only transport
+pp_sim_only {
+    DEFINES += PP_NO_WIRINGPI
+} else {
+    SOURCES += wiringpitransport.cpp
+    HEADERS += wiringpitransport.h
+    LIBS += -lwiringPi
+}
 
 
 QMAKE_INCDIR +=  $$[QT_SYSROOT]/usr/local/include
@@ -40,6 +79,25 @@ HEADERS += \
     spibase.h \
     relayplate.h \
     daqc2plate.h \
+    spitransport.h \
+    simtransport.h \
+    timingprofile.h \
+    interruptdispatcher.h \
+    busexecutor.h \
+    platebus.h \
+    plateregistry.h \
+    platesnapshot.h \
+    adcstream.h \
+    adcconvert.h \
+    adccapture.h \
+    dacwaveform.h \
+    metrics.h \
+    tracering.h \
+    frameprobe.h \
+    pplog.h \
+    platecommands.h \
+    platetask.h \
+    commandframe.h \
     
 
 
@@ -1,32 +1,95 @@
 #include "relayplate.h"
+#include "commandframe.h"
+#ifdef PP_COROUTINES
+#include "commandawait.h"
+#endif
+#include <algorithm>
 
 namespace SPIW {
 
+RELAYPlate::~RELAYPlate()
+{
+    std::unique_lock<std::mutex> guard(coalesceLock);
+    windowUs = 0;
+    verifyMs = 0;
+    updateWorker(guard);
+    batchDepth = 0;
+    flushLocked();
+}
+
 int RELAYPlate::setBit(int pin, int state)
 {
     if( pin >= 1 && pin <=7)
         ;
     else
         return STATE_ERROR;
-    uint8_t _state;
-
     switch (state) {
     case STATE_OFF:
-        _state = 0x11;
-        break;
     case STATE_ON:
-        _state = 0x10;
-        break;
     case STATE_TOGGLE:
-        _state = 0x12;
         break;
     default:
          return( STATE_ERROR);
     }
-    cmdStructure cmd(_state, pin, 0);
-    rtnStructure rtn = SendCommand( cmd, 0, false );
+
+    uint8_t bit = 1 << (pin - 1);
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    if( windowUs > 0 || batchDepth > 0 )
+    {
+        if( !pending )
+        {
+            if( !maskKnown && readMask() != 0 )
+                return( STATE_ERROR);
+            pendingMask = relayMask;
+            pending = true;
+            deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(windowUs);
+            wake.notify_one();
+        }
+        if( state == STATE_ON )
+            pendingMask |= bit;
+        else if( state == STATE_OFF )
+            pendingMask &= ~bit;
+        else
+            pendingMask ^= bit;
+        return(state);
+    }
+
+    // a mask that failed to go out is still pending, this change goes with it
+    if( pending )
+    {
+        if( state == STATE_ON )
+            pendingMask |= bit;
+        else if( state == STATE_OFF )
+            pendingMask &= ~bit;
+        else
+            pendingMask ^= bit;
+        return flushLocked() == 0 ? state : STATE_ERROR;
+    }
+
+    // the relay is already there, the first write reads the shadow in so the next ones can tell
+    if( !maskKnown )
+        readMask();
+    if( maskKnown && state != STATE_TOGGLE && ((relayMask & bit) != 0) == (state == STATE_ON) )
+        return(state);
+
+    rtnStructure rtn;
+    if( state == STATE_ON )
+        rtn = send<RelayOn>(pin);
+    else if( state == STATE_OFF )
+        rtn = send<RelayOff>(pin);
+    else
+        rtn = send<RelayToggle>(pin);
     if( !rtn.valid)
+    {
+        maskKnown = false;
         return( STATE_ERROR);
+    }
+    if( state == STATE_ON )
+        relayMask |= bit;
+    else if( state == STATE_OFF )
+        relayMask &= ~bit;
+    else
+        relayMask ^= bit;
     return(state);
 }
 
@@ -37,11 +100,279 @@ int RELAYPlate::getPINSTATE(int pin)
     else
         return STATE_ERROR;
 
-    cmdStructure cmd(0x14, 0, 0);
-    rtnStructure rtn = SendCommand( cmd, 1, false );
+    int mask = getRelayMask();
+    if( mask < 0 )
+        return STATE_ERROR;
+    return (mask >> (pin - 1)) & 1;
+}
+
+int RELAYPlate::getRelayMask()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    return relayMaskLocked();
+}
+
+int RELAYPlate::relayMaskLocked()
+{
+    // setBit already returned the pending state, report that
+    if( pending )
+        return pendingMask;
+    if( !maskKnown && readMask() != 0 )
+        return STATE_ERROR;
+    return relayMask;
+}
+
+int RELAYPlate::refresh()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    if( flushLocked() != 0 || readMask() != 0 )
+        return STATE_ERROR;
+    return relayMask;
+}
+
+int RELAYPlate::relayAll(uint8_t mask)
+{
+    if( mask > PP_RELAY_MASK )
+        return STATE_ERROR;
+
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    if( pending )
+    {
+        // a direct write supersedes whatever was collected, its caller hears of a failure
+        pending = false;
+    }
+    if( maskKnown && mask == relayMask )
+        return 0;
+    return writeMask(mask);
+}
+
+void RELAYPlate::noteRelayAll(uint8_t mask, bool valid)
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    noteRelayAllLocked(mask, valid);
+}
+
+void RELAYPlate::noteRelayAllLocked(uint8_t mask, bool valid)
+{
+    pending = false;
+    relayMask = mask & PP_RELAY_MASK;
+    maskKnown = valid;
+}
+
+#ifdef PP_COROUTINES
+PlateTask<int> RELAYPlate::relayAllAsync(uint8_t mask)
+{
+    if( mask > PP_RELAY_MASK )
+        co_return STATE_ERROR;
+    rtnStructure rtn = co_await command<RelayAll>(mask);
+    noteRelayAll(mask, rtn.valid);
+    co_return rtn.valid ? 0 : STATE_ERROR;
+}
+#endif
+
+void RELAYPlate::setCoalesceWindow(uint32_t usec)
+{
+    std::unique_lock<std::mutex> guard(coalesceLock);
+    windowUs = usec;
+    updateWorker(guard);
+    if( windowUs == 0 && batchDepth == 0 )
+        flushLocked();
+}
+
+uint32_t RELAYPlate::getCoalesceWindow()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    return windowUs;
+}
+
+void RELAYPlate::beginBatch()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    batchDepth++;
+}
+
+int RELAYPlate::endBatch()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    if( batchDepth == 0 )
+        return STATE_ERROR;
+    if( --batchDepth > 0 )
+        return 0;
+    return flushLocked();
+}
+
+int RELAYPlate::flush()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    return flushLocked();
+}
+
+int RELAYPlate::readMask()
+{
+    rtnStructure rtn = send<RelayGetAll>();
     if( !rtn.valid)
-        return( STATE_ERROR);
-    return (int)rtn.rtn[0];
+        return STATE_ERROR;
+    relayMask = rtn.rtn[0] & PP_RELAY_MASK;
+    maskKnown = true;
+    return 0;
+}
+
+int RELAYPlate::writeMask(uint8_t mask)
+{
+    rtnStructure rtn = send<RelayAll>(mask);
+    if( !rtn.valid)
+    {
+        maskKnown = false;
+        return STATE_ERROR;
+    }
+    relayMask = mask;
+    maskKnown = true;
+    return 0;
+}
+
+int RELAYPlate::flushLocked()
+{
+    if( !pending )
+        return 0;
+
+    // nothing changed on the board, save the frame
+    if( maskKnown && pendingMask == relayMask )
+    {
+        pending = false;
+        return 0;
+    }
+    if( writeMask(pendingMask) == 0 )
+    {
+        pending = false;
+        return 0;
+    }
+
+    // setBit already returned this mask, keep it for the next flush
+    flushErrors++;
+    PP_WARN() << "RELAY at" << getAddress() << "RELAYALL" << (int)pendingMask << "failed, kept pending";
+    RelayFlushCallback cb = onFlushErrorCb;
+    if( cb )
+        cb(getAddress(), pendingMask);
+    return STATE_ERROR;
+}
+
+void RELAYPlate::setVerifyInterval(uint32_t ms)
+{
+    std::unique_lock<std::mutex> guard(coalesceLock);
+    verifyMs = ms;
+    nextVerify = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    updateWorker(guard);
+}
+
+void RELAYPlate::onDrift(RelayDriftCallback cb)
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    onDriftCb = cb;
+}
+
+uint64_t RELAYPlate::driftCount()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    return drifts;
+}
+
+void RELAYPlate::onFlushError(RelayFlushCallback cb)
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    onFlushErrorCb = cb;
+}
+
+uint64_t RELAYPlate::flushErrorCount()
+{
+    std::lock_guard<std::mutex> guard(coalesceLock);
+    return flushErrors;
+}
+
+void RELAYPlate::verifyLocked(std::unique_lock<std::mutex> &guard)
+{
+    nextVerify = std::chrono::steady_clock::now() + std::chrono::milliseconds(verifyMs);
+
+    bool known = maskKnown;
+    uint8_t expected = relayMask;
+    if( readMask() != 0 || !known || relayMask == expected )
+        return;
+
+    // the shadow now holds what the board has, tell whoever cares
+    drifts++;
+    RelayDriftEvent event;
+    event.address = getAddress();
+    event.expected = expected;
+    event.actual = relayMask;
+    RelayDriftCallback cb = onDriftCb;
+    if( cb )
+    {
+        guard.unlock();
+        cb(event);
+        guard.lock();
+    }
+}
+
+void RELAYPlate::updateWorker(std::unique_lock<std::mutex> &guard)
+{
+    // a drift callback changing the settings, the loop sees them itself and a thread cannot join itself
+    wake.notify_one();
+    if( worker.get_id() == std::this_thread::get_id() )
+        return;
+
+    // a worker that has not left its loop sees the change under this lock, it only needs joining once it has
+    bool needed = windowUs > 0 || verifyMs > 0;
+    if( worker.joinable() && (workerDone || !needed) )
+    {
+        std::thread stopping(std::move(worker));
+        guard.unlock();
+        stopping.join();
+        guard.lock();
+    }
+
+    // another caller may have started one while the lock was dropped
+    needed = windowUs > 0 || verifyMs > 0;
+    if( needed && !worker.joinable() )
+    {
+        workerDone = false;
+        worker = std::thread(&RELAYPlate::workerLoop, this);
+    }
+}
+
+void RELAYPlate::workerLoop()
+{
+    std::unique_lock<std::mutex> guard(coalesceLock);
+    bool failed = false;
+    while( windowUs > 0 || verifyMs > 0 )
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        bool flushing = pending && batchDepth == 0;
+        if( flushing && now >= deadline )
+        {
+            if( failed )
+                Metrics::retry();
+            failed = flushLocked() != 0;
+            if( failed )
+                deadline = now + std::chrono::milliseconds(PP_RELAY_RETRY_MS);
+            continue;
+        }
+        if( !pending )
+            failed = false;
+
+        // never read back over changes that are still on their way out
+        if( verifyMs > 0 && !pending && batchDepth == 0 && now >= nextVerify )
+        {
+            verifyLocked(guard);
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point until = now + std::chrono::seconds(1);
+        if( flushing )
+            until = std::min(until, deadline);
+        if( verifyMs > 0 )
+            until = std::min(until, std::max(nextVerify, now + std::chrono::milliseconds(1)));
+        wake.wait_until(guard, until);
+    }
+    workerDone = true;
 }
 
 bool RELAYPlate::isRelayValid(uint8_t addr, uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK, int Device)
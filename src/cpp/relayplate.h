@@ -2,39 +2,236 @@
 #define RELAYPLATE_H
 
 #include "spibase.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <thread>
 
 namespace SPIW {
 
+/// the seven relays of a board as a RELAYALL mask, relay n is bit n-1
+#define PP_RELAY_MASK           0x7f
+
+/// the coalescing worker tries a failed RELAYALL again after this, ms
+#define PP_RELAY_RETRY_MS       100
+
+/**
+ * @brief The RelayDriftEvent struct  The verify sweep found the relays not where the shadow had them.
+ */
+struct RelayDriftEvent
+{
+    /// address of the RELAY plate, 24..31
+    uint8_t  address;
+
+    /// shadow mask before and board mask read back
+    uint8_t  expected;
+    uint8_t  actual;
+};
+
+typedef std::function<void (const RelayDriftEvent &)> RelayDriftCallback;
+
+/// told the address and mask of a coalesced RELAYALL write that failed
+typedef std::function<void (uint8_t address, uint8_t mask)> RelayFlushCallback;
+
 /**
  * @brief The RELAYPlate class  Used an inherited class for the relay piplate board
+ *
+ * The board keeps a shadow of its relay mask: every successful write updates it, reads are served
+ * from it and writes that would not change a relay are skipped. An optional sweep re-reads the
+ * board now and then and takes over what it finds.
+ *
+ * setBit normally writes one frame per relay. With a coalescing window, or inside a batch, the changes
+ * are folded into the relay mask and written with a single RELAYALL frame. A write that fails keeps
+ * the mask pending, the worker tries it again every PP_RELAY_RETRY_MS and onFlushError hears of it.
  */
 
 class RELAYPlate : public SPIBase
 {
 private :
 
+    /// guards everything below, held across the RELAYALL write
+    std::mutex      coalesceLock;
+    std::condition_variable wake;
+
+    /// flushes the coalescing window and runs the verify sweep, only while either is on; done once
+    /// it left its loop, also when a drift callback turned both off on it
+    std::thread     worker;
+    bool            workerDone;
+
+    /// shadow, last mask read from or written to the board
+    uint8_t         relayMask;
+    bool            maskKnown;
+
+    /// mask setBit built up since the last flush
+    uint8_t         pendingMask;
+    bool            pending;
+
+    /// 0 writes every setBit at once
+    uint32_t        windowUs;
+    std::chrono::steady_clock::time_point deadline;
+
+    int             batchDepth;
+
+    /// 0 never re-reads the board
+    uint32_t        verifyMs;
+    std::chrono::steady_clock::time_point nextVerify;
+    RelayDriftCallback onDriftCb;
+    uint64_t        drifts;
+
+    RelayFlushCallback onFlushErrorCb;
+    uint64_t        flushErrors;
+
+    int readMask();
+    int writeMask( uint8_t mask );
+    int flushLocked();
+
+    /// what setBit last returned, the pending mask or the shadow, read in on first use
+    int relayMaskLocked();
+    void noteRelayAllLocked( uint8_t mask, bool valid );
+
+    /// applyImage holds coalesceLock of each board it switches from the compare to the shadow update
+    friend class PlateRegistry;
+    void verifyLocked( std::unique_lock<std::mutex> &guard );
+
+    /// starts or stops the worker after windowUs or verifyMs changed, guard is held on entry and exit
+    void updateWorker( std::unique_lock<std::mutex> &guard );
+    void workerLoop();
+
+    RELAYPlate( const RELAYPlate& );
+    RELAYPlate& operator=( const RELAYPlate& );
+
 public:
 
 
     /// constructor for the pi plate relay board
     RELAYPlate( uint8_t addr = 24,  uint8_t PinFrame = 6,   uint8_t PinSRQ = 3,  uint8_t PinACK = 4, int Device = 1 )
             :  SPIBase(addr)
+            , workerDone(false)
+            , relayMask(0)
+            , maskKnown(false)
+            , pendingMask(0)
+            , pending(false)
+            , windowUs(0)
+            , batchDepth(0)
+            , verifyMs(0)
+            , drifts(0)
+            , flushErrors(0)
     {
         initBoard( PinFrame,  PinSRQ,   PinACK,  Device);
     }
 
-    virtual ~RELAYPlate() {}
+    /// constructor for a relay board on bus
+    RELAYPlate( PlateBus &bus, uint8_t addr = 24 )
+            :  SPIBase(bus, addr)
+            , workerDone(false)
+            , relayMask(0)
+            , maskKnown(false)
+            , pendingMask(0)
+            , pending(false)
+            , windowUs(0)
+            , batchDepth(0)
+            , verifyMs(0)
+            , drifts(0)
+            , flushErrors(0)
+    {
+        initBoard();
+    }
+
+    /// writes what is still pending
+    virtual ~RELAYPlate();
 
-    /// sets a bit on to state, STATE_ON STATE_OFF
+    virtual const char* boardType(void)
+    {
+        return "RELAY";
+    }
+
+    /// sets a bit on to state, STATE_ON STATE_OFF; while coalescing or in a batch the result is
+    /// provisional, the write comes later and a failure only shows in flushErrorCount and onFlushError
     virtual int setBit( int pin, int state );
 
-    /// gets a pin state
+    /// gets a pin state 0 or 1 from the shadow, the board is only read the first time
     virtual int getPINSTATE( int pin);
 
+    /// all seven relays from the shadow, mask bit n-1 is relay n
+    int getRelayMask();
+
+    /// reads the relays from the board into the shadow, returns the mask or STATE_ERROR
+    int refresh();
+
+    /// sets all seven relays at once (RELAYALL), mask bit n-1 is relay n
+    int relayAll( uint8_t mask );
+
+    /// the RELAYALL frame for mask, for callers that send it themselves (PlateRegistry::applyImage)
+    cmdStructure relayAllCommand( uint8_t mask )
+    {
+        return cmdStructure(CommandTraits<RelayAll>::opcode, mask & PP_RELAY_MASK, 0);
+    }
+
+    /// records the outcome of a relayAllCommand frame in the shadow, drops what was still pending
+    void noteRelayAll( uint8_t mask, bool valid );
+
+#ifdef PP_COROUTINES
+    /// relayAll as an awaitable on the active BusLoop, always writes, supersedes what is pending
+    PlateTask<int> relayAllAsync( uint8_t mask );
+#endif
+
+    /// changes closer than usec apart go out as one RELAYALL write, 0 turns coalescing off
+    void setCoalesceWindow( uint32_t usec );
+
+    uint32_t getCoalesceWindow();
+
+    /// holds back every setBit until the matching endBatch, batches nest
+    void beginBatch();
+
+    /// the outermost endBatch writes the collected mask, returns 0 or STATE_ERROR
+    int endBatch();
+
+    /// writes the pending mask now, returns 0 or STATE_ERROR, the mask stays pending on failure
+    int flush();
+
+    /// re-reads the board every ms milli seconds and reconciles the shadow with it, 0 turns the sweep off
+    void setVerifyInterval( uint32_t ms );
+
+    /// called on the sweep thread when the board differed from the shadow, unlocked, cb may change
+    /// the window or the interval but must not destroy the plate
+    void onDrift( RelayDriftCallback cb );
+
+    /// number of sweeps that found drift
+    uint64_t driftCount();
+
+    /// called when a pending mask could not be written, on the thread that tried with the board locked, cb must not call into it
+    void onFlushError( RelayFlushCallback cb );
+
+    /// number of pending mask writes that failed
+    uint64_t flushErrorCount();
+
     static bool isRelayValid(uint8_t addr = 24,  uint8_t PinFrame = 6,   uint8_t PinSRQ = 3,  uint8_t PinACK = 4, int Device = 1);
 
 
 };
 
+/**
+ * @brief The RelayBatch class  Scope in which the relay changes of one board become a single RELAYALL write.
+ */
+class RelayBatch
+{
+private :
+    RELAYPlate &plate;
+
+    RelayBatch( const RelayBatch& );
+    RelayBatch& operator=( const RelayBatch& );
+
+public:
+    explicit RelayBatch( RELAYPlate &board ) : plate(board)
+    {
+        plate.beginBatch();
+    }
+
+    ~RelayBatch()
+    {
+        plate.endBatch();
+    }
+};
+
 }
 #endif // RELAYPLATE_H
@@ -0,0 +1,515 @@
+#include "simtransport.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+namespace SPIW {
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+SimPlate::SimPlate(uint8_t addr, const char *x_id, uint8_t hw, uint8_t fw, bool ack)
+    : address(addr)
+    , id(x_id)
+    , hwRev(hw)
+    , fwRev(fw)
+    , led(0)
+    , usesAck(ack)
+{
+}
+
+bool SimPlate::execute(uint8_t cmd, uint8_t arg1, uint8_t arg2, std::vector<uint8_t> &resp)
+{
+    (void)arg2;
+    switch (cmd) {
+    case 0x00:
+        resp.push_back(address);
+        return true;
+    case 0x01:
+        resp.insert(resp.end(), id.begin(), id.end());
+        resp.push_back(0);
+        return true;
+    case 0x02:
+        resp.push_back(hwRev);
+        return true;
+    case 0x03:
+        resp.push_back(fwRev);
+        return true;
+    case 0x0f:
+        led = 0;
+        return true;
+    case 0x60:
+        led |= (1 << (arg1 & 1));
+        return true;
+    case 0x61:
+        led &= ~(1 << (arg1 & 1));
+        return true;
+    case 0x62:
+        led ^= (1 << (arg1 & 1));
+        return true;
+    case 0x63:
+        resp.push_back((led >> (arg1 & 1)) & 1);
+        return true;
+    default:
+        return false;
+    }
+}
+
+SimRelayPlate::SimRelayPlate(uint8_t addr)
+    : SimPlate(addr, "Pi-Plate RELAY", 0x10, 0x15, false)
+    , relays(0)
+{
+}
+
+bool SimRelayPlate::execute(uint8_t cmd, uint8_t arg1, uint8_t arg2, std::vector<uint8_t> &resp)
+{
+    switch (cmd) {
+    case 0x0f:
+        relays = 0;
+        return SimPlate::execute(cmd, arg1, arg2, resp);
+    case 0x10:
+        if( arg1 >= 1 && arg1 <= 7)
+            relays |= (1 << (arg1 - 1));
+        return true;
+    case 0x11:
+        if( arg1 >= 1 && arg1 <= 7)
+            relays &= ~(1 << (arg1 - 1));
+        return true;
+    case 0x12:
+        if( arg1 >= 1 && arg1 <= 7)
+            relays ^= (1 << (arg1 - 1));
+        return true;
+    case 0x13:
+        relays = arg1 & 0x7f;
+        return true;
+    case 0x14:
+        resp.push_back(relays);
+        return true;
+    default:
+        return SimPlate::execute(cmd, arg1, arg2, resp);
+    }
+}
+
+SimDAQC2Plate::SimDAQC2Plate(uint8_t addr)
+    : SimPlate(addr, "Pi-Plate DAQC2", 0x10, 0x12, true)
+    , dout(0)
+    , din(0xff)
+    , irqFalling(0)
+    , irqRising(0)
+    , intEnabled(false)
+    , intFlags(0)
+{
+    for( int i = 0; i < 8; ++i)
+    {
+        /// a few hundred mV apart so channels are easy to tell apart
+        adc[i] = 32768 + i * 1000;
+
+        cal[6*i+0] = 0x00;      // scale, positive
+        cal[6*i+1] = i * 16;
+        cal[6*i+2] = 0x80;      // offset, negative
+        cal[6*i+3] = i * 8;
+        cal[6*i+4] = 0x00;      // dac, positive
+        cal[6*i+5] = i * 4;
+    }
+    adc[8] = 27307;             // 5.0V supply
+    memset(dac, 0, sizeof(dac));
+}
+
+bool SimDAQC2Plate::execute(uint8_t cmd, uint8_t arg1, uint8_t arg2, std::vector<uint8_t> &resp)
+{
+    switch (cmd) {
+    case 0x04:
+        intEnabled = true;
+        return true;
+    case 0x05:
+        intEnabled = false;
+        return true;
+    case 0x06:
+        resp.push_back(intFlags >> 8);
+        resp.push_back(intFlags & 0xff);
+        intFlags = 0;
+        return true;
+    case 0x0f:
+        dout = 0;
+        irqFalling = irqRising = 0;
+        intEnabled = false;
+        intFlags = 0;
+        return SimPlate::execute(cmd, arg1, arg2, resp);
+    case 0x10:
+        dout |= (1 << (arg1 & 7));
+        return true;
+    case 0x11:
+        dout &= ~(1 << (arg1 & 7));
+        return true;
+    case 0x12:
+        dout ^= (1 << (arg1 & 7));
+        return true;
+    case 0x13:
+        dout = arg1;
+        return true;
+    case 0x14:
+        resp.push_back(dout);
+        return true;
+    case 0x20:
+        resp.push_back((din >> (arg1 & 7)) & 1);
+        return true;
+    case 0x21:
+        irqFalling |= (1 << (arg1 & 7));
+        return true;
+    case 0x22:
+        irqRising |= (1 << (arg1 & 7));
+        return true;
+    case 0x23:
+        irqFalling |= (1 << (arg1 & 7));
+        irqRising |= (1 << (arg1 & 7));
+        return true;
+    case 0x24:
+        irqFalling &= ~(1 << (arg1 & 7));
+        irqRising &= ~(1 << (arg1 & 7));
+        return true;
+    case 0x25:
+        resp.push_back(din);
+        return true;
+    case 0x30:
+        if( arg1 > 8)
+            return false;
+        resp.push_back(adc[arg1] >> 8);
+        resp.push_back(adc[arg1] & 0xff);
+        return true;
+    case 0x31:
+        for( int i = 0; i < 8; ++i)
+        {
+            resp.push_back(adc[i] >> 8);
+            resp.push_back(adc[i] & 0xff);
+        }
+        return true;
+    case 0x40:
+    case 0x41:
+    case 0x42:
+    case 0x43:
+        dac[cmd - 0x40] = ((arg1 << 8) | arg2) & 0x0fff;
+        return true;
+    case 0x60:
+        led = arg1 & 7;
+        return true;
+    case 0x63:
+        resp.push_back(led);
+        return true;
+    case 0xfd:
+        if( arg1 != 2)
+            return false;
+        resp.push_back(arg2 < sizeof(cal) ? cal[arg2] : 0xff);
+        return true;
+    default:
+        return SimPlate::execute(cmd, arg1, arg2, resp);
+    }
+}
+
+void SimDAQC2Plate::setDIN(uint8_t value)
+{
+    uint8_t rose = ~din & value;
+    uint8_t fell = din & ~value;
+    intFlags |= (rose & irqRising) | (fell & irqFalling);
+    din = value;
+}
+
+SimulatedTransport::SimulatedTransport()
+    : realTime(false)
+    , nowNs(0)
+    , realBaseNs(0)
+    , frameHigh(false)
+    , frameRiseNs(0)
+    , frameFallNs(0)
+    , active(NULL)
+    , rdIndex(0)
+    , nextByteNs(0)
+    , ackNs(0)
+{
+    memset(plates, 0, sizeof(plates));
+}
+
+SimulatedTransport::~SimulatedTransport()
+{
+    for( int i = 0; i < 64; ++i)
+        delete plates[i];
+}
+
+void SimulatedTransport::addPlate(SimPlate *plate)
+{
+    uint8_t addr = plate->address & 0x3f;
+    delete plates[addr];
+    plates[addr] = plate;
+}
+
+SimPlate *SimulatedTransport::addPlate(uint8_t addr)
+{
+    SimPlate *p = NULL;
+    if( addr >= 24 && addr < 32)
+        p = new SimRelayPlate(addr);
+    else if( addr >= 32 && addr < 40)
+        p = new SimDAQC2Plate(addr);
+    if( p)
+        addPlate(p);
+    return p;
+}
+
+SimPlate *SimulatedTransport::plate(uint8_t addr)
+{
+    return plates[addr & 0x3f];
+}
+
+void SimulatedTransport::setRealTime(bool on)
+{
+    realTime = on;
+    realBaseNs = monotonicNs() - nowNs;
+}
+
+SimulatedTransport *SimulatedTransport::fromEnvironment()
+{
+    SimulatedTransport *sim = new SimulatedTransport();
+    const char *boards = getenv("PIPLATE_SIM_BOARDS");
+    if( boards == NULL || *boards == 0)
+        boards = "24,32";
+
+    const char *p = boards;
+    while( *p)
+    {
+        char *end;
+        long addr = strtol(p, &end, 10);
+        if( end == p)
+        {
+            ++p;
+            continue;
+        }
+        sim->addPlate((uint8_t)addr);
+        p = end;
+    }
+
+    const char *rt = getenv("PIPLATE_SIM_REALTIME");
+    if( rt != NULL && *rt == '1')
+        sim->setRealTime(true);
+    return sim;
+}
+
+void SimulatedTransport::advance(uint64_t ns)
+{
+    nowNs += ns;
+    if( realTime)
+    {
+        uint64_t target = realBaseNs + nowNs;
+        struct timespec ts;
+        ts.tv_sec = target / 1000000000ULL;
+        ts.tv_nsec = target % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+bool SimulatedTransport::initPins(uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK)
+{
+    (void)PinFrame;
+    (void)PinSRQ;
+    (void)PinACK;
+    return true;
+}
+
+int SimulatedTransport::openDevice(int Device, int speed)
+{
+    (void)Device;
+    if( speed > 0)
+        timing.busSpeed = speed;
+    return getFd();
+}
+
+int SimulatedTransport::getFd()
+{
+    /// no real device, any non negative value reads as open
+    return 0;
+}
+
+void SimulatedTransport::closeDevice()
+{
+}
+
+void SimulatedTransport::setFrame(bool high)
+{
+    advance(timing.gpioUs * 1000ULL);
+    if( high == frameHigh)
+        return;
+
+    frameHigh = high;
+    if( high)
+    {
+        frameRiseNs = nowNs;
+        stats.frames++;
+    }
+    else
+    {
+        frameFallNs = nowNs;
+        active = NULL;
+        response.clear();
+        rdIndex = 0;
+    }
+}
+
+int SimulatedTransport::getFrame()
+{
+    advance(timing.gpioUs * 1000ULL);
+    return frameHigh ? 1 : 0;
+}
+
+int SimulatedTransport::getAck()
+{
+    advance(timing.gpioUs * 1000ULL);
+    if( active && active->usesAck && nowNs >= ackNs)
+        return 0;
+    return 1;
+}
+
+bool SimulatedTransport::intAsserted()
+{
+    for( int i = 0; i < 64; ++i)
+    {
+        if( plates[i] && plates[i]->intAsserted())
+            return true;
+    }
+    return false;
+}
+
+void SimulatedTransport::setDIN(uint8_t addr, uint8_t value)
+{
+    std::lock_guard<std::mutex> guard(simLock);
+    SimDAQC2Plate *p = dynamic_cast<SimDAQC2Plate*>(plates[addr & 0x3f]);
+    if( p)
+        p->setDIN(value);
+    intChanged.notify_all();
+}
+
+int SimulatedTransport::getInt()
+{
+    advance(timing.gpioUs * 1000ULL);
+    std::lock_guard<std::mutex> guard(simLock);
+    return intAsserted() ? 0 : 1;
+}
+
+int SimulatedTransport::waitInt(uint32_t timeoutUs)
+{
+    /// inputs change on the wall clock of the test thread, so this waits in real time
+    std::unique_lock<std::mutex> guard(simLock);
+    bool asserted = intChanged.wait_for(guard, std::chrono::microseconds(timeoutUs),
+                                        [this] { return intAsserted(); });
+    return asserted ? 1 : 0;
+}
+
+int SimulatedTransport::waitAck(uint32_t timeoutUs)
+{
+    /// models the edge wakeup, the clock jumps to the edge instead of polling towards it
+    advance(timing.gpioUs * 1000ULL);
+    uint64_t deadline = nowNs + timeoutUs * 1000ULL;
+    if( active && active->usesAck)
+    {
+        if( ackNs <= nowNs)
+            return 1;
+        if( ackNs <= deadline)
+        {
+            advance(ackNs - nowNs + timing.wakeUs * 1000ULL);
+            return 1;
+        }
+    }
+    advance(deadline - nowNs);
+    return 0;
+}
+
+int SimulatedTransport::write(uint8_t *buff, int len)
+{
+    uint64_t start = nowNs;
+    advance(timing.ioctlUs * 1000ULL + len * 8000000000ULL / timing.busSpeed);
+    stats.writes++;
+
+    bool latched = frameHigh
+            && start - frameRiseNs >= timing.frameSetupUs * 1000ULL
+            && frameRiseNs - frameFallNs >= timing.frameHoldUs * 1000ULL;
+
+    std::lock_guard<std::mutex> guard(simLock);
+    active = NULL;
+    response.clear();
+    rdIndex = 0;
+    if( latched && len >= 4)
+    {
+        SimPlate *p = plates[buff[0] & 0x3f];
+        if( p && p->execute(buff[1], buff[2], buff[3], response))
+        {
+            active = p;
+            ackNs = nowNs + timing.ackUs * 1000ULL;
+            nextByteNs = nowNs + timing.responseUs * 1000ULL;
+
+            /// the DAQC2 loads its answer when it pulls ppACK, a read before that is garbage
+            if( p->usesAck)
+                nextByteNs = std::max(nextByteNs, ackNs);
+        }
+    }
+    if( !active)
+        stats.dropped++;
+
+    /// full duplex, nothing useful comes back on the command bytes
+    memset(buff, 0, len);
+    return len;
+}
+
+uint8_t SimulatedTransport::clockByte()
+{
+    advance(8000000000ULL / timing.busSpeed);
+    if( active == NULL || rdIndex >= response.size())
+        return 0x00;
+
+    if( nowNs < nextByteNs)
+    {
+        /// firmware has not loaded the byte yet, the master clocks in garbage
+        return 0xff;
+    }
+    nextByteNs = nowNs + timing.interByteUs * 1000ULL;
+    return response[rdIndex++];
+}
+
+int SimulatedTransport::read(uint8_t *buff, int len, uint32_t delay)
+{
+    advance(timing.ioctlUs * 1000ULL);
+    stats.reads++;
+
+    for( int i = 0; i < len; ++i)
+        buff[i] = clockByte();
+
+    advance(delay * 1000ULL);
+    return len;
+}
+
+int SimulatedTransport::readBytes(uint8_t *buff, int count, uint32_t delay)
+{
+    /// one ioctl, the delay follows every one byte transfer
+    advance(timing.ioctlUs * 1000ULL);
+    stats.reads++;
+
+    for( int i = 0; i < count; ++i)
+    {
+        buff[i] = clockByte();
+        advance(delay * 1000ULL);
+    }
+    return count;
+}
+
+void SimulatedTransport::delayMicroseconds(unsigned int usec)
+{
+    advance(usec * 1000ULL);
+}
+
+uint64_t SimulatedTransport::nowMicroseconds()
+{
+    return nowNs / 1000;
+}
+
+}
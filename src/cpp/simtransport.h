@@ -0,0 +1,283 @@
+#ifndef SIMTRANSPORT_H
+#define SIMTRANSPORT_H
+
+#include "spitransport.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace SPIW {
+
+/**
+ * @brief The SimTiming struct  Per phase latencies of the simulated bus, all in micro seconds.
+ * A command that does not respect the firmware minimums is dropped or read back as 0xff,
+ * the same way a real plate misbehaves when the frame timing is too tight.
+ */
+struct SimTiming
+{
+    /// ppFRAME must be high this long before the command bytes are latched
+    uint32_t frameSetupUs;
+
+    /// ppFRAME must stay low this long between two frames
+    uint32_t frameHoldUs;
+
+    /// time from the end of the command write to the first readback byte being ready, a DAQC2
+    /// has it ready no earlier than ppACK
+    uint32_t responseUs;
+
+    /// time the firmware needs to load each following readback byte
+    uint32_t interByteUs;
+
+    /// DAQC2 time from the command write until ppACK is pulled low
+    uint32_t ackUs;
+
+    /// cost of one gpio read or write
+    uint32_t gpioUs;
+
+    /// gpio edge to the waiting thread running again
+    uint32_t wakeUs;
+
+    /// cost of one spidev ioctl, not counting the bits on the wire
+    uint32_t ioctlUs;
+
+    /// spi clock in Hz
+    uint32_t busSpeed;
+
+    SimTiming()
+        : frameSetupUs(100)
+        , frameHoldUs(100)
+        , responseUs(50)
+        , interByteUs(15)
+        , ackUs(100)
+        , gpioUs(1)
+        , wakeUs(20)
+        , ioctlUs(10)
+        , busSpeed(500000)
+    {
+    }
+};
+
+/**
+ * @brief The SimPlate class  Firmware model of one piplate, answers the commands common to all plates.
+ */
+class SimPlate
+{
+public:
+
+    uint8_t     address;
+    std::string id;
+    uint8_t     hwRev;
+    uint8_t     fwRev;
+    uint8_t     led;
+
+    /// true if the firmware handshakes with ppACK (DAQC2)
+    bool        usesAck;
+
+    SimPlate( uint8_t addr, const char* x_id, uint8_t hw, uint8_t fw, bool ack );
+
+    virtual ~SimPlate() {}
+
+    /// runs one command, fills the readback bytes, returns false for unknown commands
+    virtual bool execute( uint8_t cmd, uint8_t arg1, uint8_t arg2, std::vector<uint8_t> &resp );
+
+    /// true while the plate pulls ppINT low
+    virtual bool intAsserted() const
+    {
+        return false;
+    }
+};
+
+/**
+ * @brief The SimRelayPlate class  RELAYplate firmware, seven relays in a bit mask.
+ */
+class SimRelayPlate : public SimPlate
+{
+public:
+
+    uint8_t relays;
+
+    SimRelayPlate( uint8_t addr = 24 );
+
+    virtual bool execute( uint8_t cmd, uint8_t arg1, uint8_t arg2, std::vector<uint8_t> &resp );
+};
+
+/**
+ * @brief The SimDAQC2Plate class  DAQC2plate firmware, adc, dac, digital in/out, interrupts and the calibration eeprom.
+ */
+class SimDAQC2Plate : public SimPlate
+{
+public:
+
+    /// raw adc words, channel 8 is the supply monitor
+    uint16_t adc[9];
+
+    /// factory calibration eeprom, 6 bytes per channel
+    uint8_t  cal[48];
+
+    /// last code written to each dac
+    uint16_t dac[4];
+
+    uint8_t  dout;
+    uint8_t  din;
+    uint8_t  irqFalling;
+    uint8_t  irqRising;
+    bool     intEnabled;
+    uint16_t intFlags;
+
+    SimDAQC2Plate( uint8_t addr = 32 );
+
+    virtual bool execute( uint8_t cmd, uint8_t arg1, uint8_t arg2, std::vector<uint8_t> &resp );
+
+    virtual bool intAsserted() const
+    {
+        return intEnabled && intFlags != 0;
+    }
+
+    /// drives the digital inputs, latches interrupt flags for the enabled edges
+    void setDIN( uint8_t value );
+};
+
+/**
+ * @brief The SimStats struct  Traffic counters of the simulated bus.
+ */
+struct SimStats
+{
+    uint64_t frames;
+    uint64_t writes;
+    uint64_t reads;
+    uint64_t dropped;
+
+    SimStats() : frames(0), writes(0), reads(0), dropped(0) {}
+};
+
+/**
+ * @brief The SimulatedTransport class  In process piplate stack on a virtual clock.
+ *
+ * Delays advance the virtual clock instead of sleeping, so timing and throughput of the
+ * whole library can be measured on any Linux box. setRealTime(true) makes the clock follow
+ * the wall clock for end to end runs.
+ */
+class SimulatedTransport : public SPITransport
+{
+private :
+
+    SimPlate* plates[64];
+    SimTiming timing;
+    SimStats  stats;
+    bool      realTime;
+
+    std::atomic<uint64_t> nowNs;
+    uint64_t  realBaseNs;
+
+    bool      frameHigh;
+    uint64_t  frameRiseNs;
+    uint64_t  frameFallNs;
+
+    SimPlate* active;
+    std::vector<uint8_t> response;
+    size_t    rdIndex;
+    uint64_t  nextByteNs;
+    uint64_t  ackNs;
+
+    /// guards the plate models against a test thread driving inputs while the bus runs
+    std::mutex              simLock;
+    std::condition_variable intChanged;
+
+    bool intAsserted();
+
+    void advance( uint64_t ns );
+
+    /// clocks one readback byte out of the active plate
+    uint8_t clockByte();
+
+public:
+
+    SimulatedTransport();
+
+    virtual ~SimulatedTransport();
+
+    /// adds a plate, ownership moves to the transport, replaces a plate at the same address
+    void addPlate( SimPlate* plate );
+
+    /// adds a RELAYplate (24..31) or DAQC2plate (32..39) model by address
+    SimPlate* addPlate( uint8_t addr );
+
+    /// returns the plate at an address, NULL if none
+    SimPlate* plate( uint8_t addr );
+
+    void setTiming( const SimTiming &t )
+    {
+        timing = t;
+    }
+
+    const SimTiming &getTiming() const
+    {
+        return timing;
+    }
+
+    const SimStats &getStats() const
+    {
+        return stats;
+    }
+
+    void resetStats()
+    {
+        stats = SimStats();
+    }
+
+    /// drives the digital inputs of the DAQC2 at addr and wakes waitInt, safe from any thread
+    void setDIN( uint8_t addr, uint8_t value );
+
+    /// when true every virtual delay is also slept on the wall clock
+    void setRealTime( bool on );
+
+    /// builds a stack from PIPLATE_SIM_BOARDS="24,25,32" (default "24,32") and PIPLATE_SIM_REALTIME=1
+    static SimulatedTransport* fromEnvironment();
+
+    virtual const char* name() const
+    {
+        return "sim";
+    }
+
+    virtual bool initPins( uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK );
+
+    virtual int openDevice( int Device, int speed );
+
+    virtual int getFd();
+
+    virtual void closeDevice();
+
+    virtual void setFrame( bool high );
+
+    virtual int getFrame();
+
+    virtual int getAck();
+
+    virtual int getInt();
+
+    virtual int waitAck( uint32_t timeoutUs );
+
+    virtual int waitInt( uint32_t timeoutUs );
+
+    /// the plates only see time pass through delays, even with setRealTime(true)
+    virtual bool realTimeDelays()
+    {
+        return false;
+    }
+
+    virtual int write( uint8_t* buff, int len );
+
+    virtual int read( uint8_t* buff, int len, uint32_t delay );
+
+    virtual int readBytes( uint8_t* buff, int count, uint32_t delay );
+
+    virtual void delayMicroseconds( unsigned int usec );
+
+    virtual uint64_t nowMicroseconds();
+};
+
+}
+
+#endif // SIMTRANSPORT_H
@@ -1,18 +1,21 @@
 #include "spibase.h"
 
-#include <QTime>
+#include "commandframe.h"
+#ifdef PP_COROUTINES
+#include "busloop.h"
+#endif
 
 namespace SPIW {
 
-static  uint8_t ppFRAME = -1;
-static  uint8_t ppINT   = -1;
-static  uint8_t ppACK   = -1;
-
-static  int   odevice    = -1;
-static  bool  initYet = false;
-static  bool  initWirePi = false;
-
+SPITransport *SPIBase::transport()
+{
+    return PlateBus::defaultBus().transport();
+}
 
+void SPIBase::setTransport(SPITransport *x_transport)
+{
+    PlateBus::defaultBus().setTransport(x_transport);
+}
 
 int SPIBase::spiError(int code, const char *message, ...)
 {
@@ -21,144 +24,101 @@ int SPIBase::spiError(int code, const char *message, ...)
     va_start(argp, message) ;
     vsnprintf(buffer, 1023, message, argp) ;
     va_end(argp) ;
-    qDebug() << buffer ;
+    PP_ERROR() << buffer ;
     return (code * -1);
 }
 
-int SPIBase::spiRead(int fd, const uint8_t *buff, size_t len, uint32_t speed, uint32_t mode, uint32_t delay)
+bool SPIBase::initBoard(void)
 {
-    struct spi_ioc_transfer spi;
-    memset(&spi, 0, sizeof(spi));
-
-    spi.tx_buf = (unsigned long) NULL;
-    spi.rx_buf = (unsigned long) buff;
-    spi.len = len;
-    spi.delay_usecs = delay;
-    spi.speed_hz = speed;
-    spi.bits_per_word = 8;
-    spi.cs_change = 0;
-
-    // adapted from py_spidev/spidev_module
-#ifdef SPI_IOC_WR_MODE32
-    spi.tx_nbits = 0;
-#endif
-#ifdef SPI_IOC_RD_MODE32
-    spi.rx_nbits = 0;
-#endif
-
-    int ret = ioctl(fd, SPI_IOC_MESSAGE(1), &spi);
-    if(ret < 1)
-    {
-        return spiError(1100, "spiRead(): Can't send spi message");
-    }
-
-    if(mode & SPI_CS_HIGH)
+    bool rtn = _bus->open();
+    if(rtn)
     {
-        ret = read(fd, (void*) &buff[0], 0);
+        // only ask for the firmware when there is a tuned profile to pick from
+        TimingProfiles &profiles = TimingProfiles::instance();
+        if( !profiles.empty() )
+            _timing = profiles.lookup( boardType(), getFWRevisionByte() );
     }
 
-    // success
-    return ret;
+    return rtn;
 }
 
-
-
-bool SPIBase::initBoard(void)
+bool SPIBase::initBus(uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK, int Device)
 {
-    if( !initWirePi )
-    {
-        wiringPiSetupGpio(); // BCM pin layout root mode
-        initWirePi = true;
-    }
-
-    if( !initYet )
-    {
-        // Initialize frame signal
-        pinMode(ppFRAME, OUTPUT);
-        if(disableFrame() < 0)
-        {
-            return false;
-        }
-
-        // Initialize interrupt control
-        pinMode( ppINT, INPUT);
-        pullUpDnControl( ppINT, PUD_UP);
-
-        // Initialize ACK
-        pinMode( ppACK, INPUT);
-        pullUpDnControl( ppACK, PUD_UP);
-        initYet = true;
-
-        // time to system
-        usleep(PP_DELAY);
-
-    }
-    return initYet;
+    // other lines are another stack, the boards already on this bus keep theirs
+    PlateBus* x_bus = PlateBus::forConfig( BusConfig( PinFrame, PinSRQ, PinACK, Device ) );
+    if( x_bus == NULL )
+        return false;
+    _bus = x_bus;
+    return _bus->open();
 }
 
 bool SPIBase::initBoard(uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK, int Device)
 {
-    ppFRAME =  wpiPinToGpio( PinFrame );
-    ppINT   =  wpiPinToGpio( PinSRQ  );
-    ppACK   =  wpiPinToGpio( PinACK );
-
-    odevice  = Device;
-    bool rtn = initBoard();
-    if(rtn)
-        wiringPiSPISetup (odevice, PP_SPI_BUS_SPEED);
-
-    return rtn;
+    PlateBus* x_bus = PlateBus::forConfig( BusConfig( PinFrame, PinSRQ, PinACK, Device ) );
+    if( x_bus == NULL )
+        return false;
+    _bus = x_bus;
+    return initBoard();
 }
 
 uint8_t SPIBase::getBoardAddress(void)
 {
-    cmdStructure cmd;
-    rtnStructure rtn = SendCommand( cmd, 1);
+    rtnStructure rtn = _ackLine ? send<Daqc2GetAddress>() : send<RelayGetAddress>();
     if( rtn.valid)
         return rtn.rtn[0];
     return 0xff;
 
 }
 
-QString  SPIBase::getID(void )
+int SPIBase::getID(char *id, size_t size)
 {
-    char strtemp[256];
-
-    cmdStructure cmd(1);
-
-    rtnStructure rtn = SendCommand( cmd, 20, true );
+    rtnStructure rtn = _ackLine ? send<Daqc2GetId>() : send<RelayGetId>();
 
     if( rtn.valid) {
-        snprintf(strtemp, sizeof(strtemp) - 1, "%s", rtn.rtn);
-        return QString(strtemp);
+        // the plate stops at its 0, a full readback has none
+        int length = snprintf(id, size, "%.*s", rtn.nbr_rtn, (const char*)rtn.rtn);
+        return (size_t)length < size ? length : (int)size - 1;
     }
-    return QString("Not Valid Request");
+    snprintf(id, size, "Not Valid Request");
+    return SPIERROR;
 }
 
-QString SPIBase::getHWRevision()
+/// "major.minor" from a revision byte, major in the high nibble
+static int formatRevision(const rtnStructure &rtn, char *revision, size_t size)
 {
-    uint8_t value = 0;
-    cmdStructure cmd(0x02);
-    rtnStructure rtn = SendCommand(cmd,1,false);
-    value = rtn.rtn[0];
-    double whole = (double)(value >> 4);
-    double point = (double)(value & 0x0F);
+    uint8_t value = rtn.rtn[0];
+    int length = snprintf(revision, size, "%d.%d", value >> 4, value & 0x0F);
+    if( !rtn.valid)
+        return SPIERROR;
+    return (size_t)length < size ? length : (int)size - 1;
+}
 
-    QString rev = QString("%1.%2").arg(whole).arg(point);
+int SPIBase::getHWRevision(char *revision, size_t size)
+{
+    rtnStructure rtn = _ackLine ? send<Daqc2GetHWRevision>() : send<RelayGetHWRevision>();
+    return formatRevision(rtn, revision, size);
+}
 
-    return rev;
+uint8_t SPIBase::getHWRevisionByte()
+{
+    rtnStructure rtn = _ackLine ? send<Daqc2GetHWRevision>() : send<RelayGetHWRevision>();
+    if( !rtn.valid)
+        return 0;
+    return rtn.rtn[0];
 }
 
-QString SPIBase::getFWRevision()
+uint8_t SPIBase::getFWRevisionByte()
 {
-    uint8_t value = 0;
-    cmdStructure cmd(0x03);
-    rtnStructure rtn = SendCommand(cmd,1,false);
-    value = rtn.rtn[0];
-    double whole = (double)(value >> 4);
-    double point = (double)(value & 0x0F);
-    QString rev = QString("%1.%2").arg(whole).arg(point);
-    return rev;
+    rtnStructure rtn = _ackLine ? send<Daqc2GetFWRevision>() : send<RelayGetFWRevision>();
+    if( !rtn.valid)
+        return 0;
+    return rtn.rtn[0];
+}
+
+int SPIBase::getFWRevision(char *revision, size_t size)
+{
+    rtnStructure rtn = _ackLine ? send<Daqc2GetFWRevision>() : send<RelayGetFWRevision>();
+    return formatRevision(rtn, revision, size);
 }
 
 int SPIBase::updateLED(const uint8_t led, const uint8_t state)
@@ -168,36 +128,38 @@ int SPIBase::updateLED(const uint8_t led, const uint8_t state)
     else
         return 1;
 
-    uint8_t  command = 0x00;
+    // the DAQC2 has one colour LED, see DAQC2Plate::setLedCondition
+    if( _ackLine )
+        return SPIERROR;
+
+    rtnStructure rtn;
     switch(state)
     {
         // set
         case STATE_ON:
         {
-            command = 0x60;
+            rtn = send<RelaySetLed>(led);
             break;
         }
         // clear
         case STATE_OFF:
         {
-            command = 0x61;
+            rtn = send<RelayClearLed>(led);
             break;
         }
         // toggle
         case STATE_TOGGLE:
         {
-            command = 0x62;
+            rtn = send<RelayToggleLed>(led);
             break;
         }
         default:
         {
-            qDebug() << "Invalid LED state value %d." << state;
+            PP_ERROR() << "Invalid LED state value" << state;
             return -1;
         }
     }
 
-    cmdStructure cmd(command,led);
-    rtnStructure rtn = SendCommand(cmd,0,false);
     if( rtn.valid)
         return 0;
 
@@ -211,8 +173,7 @@ bool SPIBase::getLEDState(const uint8_t led)
     else
         return false;
 
-    cmdStructure cmd(0x63, led, 0);
-    rtnStructure rtn = SendCommand(cmd,1,false);
+    rtnStructure rtn = _ackLine ? send<Daqc2GetLed>() : send<RelayGetLed>(led);
 
     if( rtn.rtn[0] == 0)
         return false;
@@ -222,8 +183,8 @@ bool SPIBase::getLEDState(const uint8_t led)
 
 int SPIBase::setBit(int  bit, const int state)
 {
-    Q_UNUSED(bit)
-    Q_UNUSED(state)
+    (void)bit;
+    (void)state;
     return STATE_ERROR;
 }
 
@@ -239,18 +200,20 @@ bool SPIBase::ValidBoard()
 }
 
 
-int SPIBase::enableFrame(void)
+int SPIBase::enableFrame(FrameProbe* probe)
 {
     // enable SPI frame transfer
-    digitalWrite(ppFRAME, HIGH);
+    busTransport()->setFrame(true);
 
     // time to system
-    usleep(PP_DELAY);
+    busTransport()->delayMicroseconds(_timing.frameSetupUs);
+    if( probe != NULL )
+        probe->split(TraceFrameRaise);
 
     // check bit has raised
-    if(!digitalRead(ppFRAME))
+    if(!busTransport()->getFrame())
     {
-        qDebug() << "Unable to Enable a ppFRAME";
+        PP_ERROR() << "Unable to Enable a ppFRAME";
         return SPIERROR;
     }
     return 0;
@@ -259,15 +222,15 @@ int SPIBase::enableFrame(void)
 int SPIBase::disableFrame(void)
 {
     // enable SPI frame transfer
-    digitalWrite(ppFRAME, LOW);
+    busTransport()->setFrame(false);
 
     // time to system
-    usleep(PP_DELAY);
+    busTransport()->delayMicroseconds(_timing.frameHoldUs);
 
     // check bit has released
-    if(digitalRead(ppFRAME))
+    if(busTransport()->getFrame())
     {
-        qDebug() << "Unable to Disable a ppFRAME";
+        PP_ERROR() << "Unable to Disable a ppFRAME";
         return SPIERROR;
     }
     return 0;
@@ -275,90 +238,91 @@ int SPIBase::disableFrame(void)
 
 int SPIBase::getODevice()
 {
-    return odevice;
+    return _bus->getConfig().device;
 }
 
-SPIBase::SPIBase(uint8_t x_address) :
+SPIBase::SPIBase(uint8_t x_address, bool x_ackLine) :
      _address(x_address)
     ,_ioAddress(0xfe)
+    ,_ackLine(x_ackLine)
+    ,_bus(&PlateBus::defaultBus())
+{
+}
+
+SPIBase::SPIBase(PlateBus &x_bus, uint8_t x_address, bool x_ackLine) :
+     _address(x_address)
+    ,_ioAddress(0xfe)
+    ,_ackLine(x_ackLine)
+    ,_bus(&x_bus)
 {
-    if( !initWirePi )
-    {
-        wiringPiSetupGpio(); // BCM pin layout root mode
-        initWirePi = true;
-    }
 }
 
 
 int SPIBase::getAckPin()
 {
-    return (int)digitalRead(ppACK);
+    return busTransport()->getAck();
 }
 
 
-rtnStructure SPIBase::SendCommand(cmdStructure cmd, int readbackBytes, bool stopAt0)
+int SPIBase::readResponse(rtnStructure &rtn, int count, bool stopAt0)
 {
-    rtnStructure rtn(readbackBytes);
-    cmd.txbuff[0] += getAddress();
-    enableFrame();
-    //int fd =  wiringPiSPISetup (getODevice(), PP_SPI_BUS_SPEED);
-    int fd =  wiringPiSPIGetFd (getODevice());
-    if(fd < 0)
+    if( count > rtn.maxRtnSize() )
+        count = rtn.maxRtnSize();
+
+    // the whole response in one message, the inter byte delay still separates the bytes
+    if( busTransport()->readBytes(rtn.rtn, count, _timing.interByteUs) < 0 )
     {
         rtn.nbr_rtn = 0;
         rtn.valid = false;
-        qDebug() << 1400 << "Unable to open SPI bus device. Make sure SPI is enabled by raspi-config tool.";
-        return rtn;
+        return SPIERROR;
     }
-    else
+    rtn.nbr_rtn = count;
+
+    if( stopAt0 )
     {
-        int rw = wiringPiSPIDataRW(getODevice(), cmd.txbuff, cmd.cmdSize());
-        if( rw < 0)
+        // bounded read, trim at the zero terminator and keep the one byte after it
+        const uint8_t* end = (const uint8_t*)memchr(rtn.rtn, 0, count);
+        if( end != NULL )
         {
-            qDebug() << " DAQC2 failed wiringPiSPIDataRW(getODevice(), cmd.txbuff, cmd.cmdSize());";
-            rtn.valid = false;
-            return rtn;
+            int i = end - rtn.rtn;
+            rtn.nbr_rtn = i;
+            if( i + 2 < count )
+                ::memset(&rtn.rtn[i + 2], 0, count - i - 2);
         }
-        usleep(70);
+    }
+    return rtn.nbr_rtn;
+}
 
-        if( readbackBytes > 0  || stopAt0 )
-        {
-            int i = 0;
-            uint8_t byte[1] = {0x00};
-            uint32_t mode = SPI_CPHA | SPI_RX_DUAL | SPI_TX_DUAL | SPI_NO_CS;
-            while(i < readbackBytes && i < rtn.maxRtnSize() )
-            {
-                if ( spiRead(fd, &byte[0], 1, PP_SPI_BUS_SPEED, mode, 20) < 0)
-                {
-                    rtn.nbr_rtn = i;
-                    break;
-                }
-
-                // stop at zero terminator
-                if((byte[0] == 0x0) && stopAt0)
-                {
-                    rtn.nbr_rtn = i;
-                    rtn.rtn[i] = byte[0];
-                    break;
-
-                }
-                rtn.rtn[i] = byte[0];
-                i++;
-            }
-        }
-        else
-        {
-           rtn.nbr_rtn = 0;
-        }
+rtnStructure SPIBase::SendCommand(cmdStructure cmd, int readbackBytes, bool stopAt0)
+{
+    // the same frames send<> builds, picked at runtime
+    if( readbackBytes <= 0 && !stopAt0 )
+        return _ackLine ? route<true, false, false>(cmd, 0) : route<false, false, false>(cmd, 0);
+    if( stopAt0 )
+        return _ackLine ? route<true, true, true>(cmd, readbackBytes) : route<false, true, true>(cmd, readbackBytes);
+    return _ackLine ? route<true, true, false>(cmd, readbackBytes) : route<false, true, false>(cmd, readbackBytes);
+}
+
+void SPIBase::exclusive(const std::function<void ()> &job)
+{
+    BusExecutor* executor = _bus->executor();
+    if( executor != NULL && !executor->onBusThread() )
+    {
+        executor->post(job).get();
+        return;
     }
-    disableFrame();
-    return rtn;
+    if( BusExecutor::holdsLock(_bus) )
+    {
+        job();
+        return;
+    }
+    std::lock_guard<std::mutex> guard(busLock());
+    job();
 }
 
 int SPIBase::reset()
 {
-    cmdStructure cmd(0x0f);
-    rtnStructure rtn = SendCommand( cmd, 0);
+    rtnStructure rtn = _ackLine ? send<Daqc2Reset>() : send<RelayReset>();
     if( !rtn.valid)
         return SPIERROR;
     return 0;
@@ -368,9 +332,61 @@ int SPIBase::reset()
 
 bool SPIBase::waitOnAck(int usec)
 {
-    usec = usec;
-    return true;
+    // sleep on the falling edge when the bus has edge events
+    int rtn = busTransport()->waitAck(usec);
+    if( rtn >= 0 )
+        return rtn > 0;
+
+    // no events, spin a short while, then poll with short sleeps up to the deadline
+    uint64_t start = busTransport()->nowMicroseconds();
+    uint64_t deadline = start + usec;
+    while( true )
+    {
+        if( !getAckPin() )
+        {
+           return true;
+        }
+        uint64_t now = busTransport()->nowMicroseconds();
+        if( now >= deadline )
+        {
+           break;
+        }
+        if( now - start > PP_ACK_SPIN )
+        {
+            struct timespec ts = { 0, PP_ACK_POLL * 1000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return false;
+}
+
+#ifdef PP_COROUTINES
+PlateTask<bool> SPIBase::waitOnAckAsync(BusLoop &loop, int usec)
+{
+    // a virtual bus clock jumps straight to the edge, nothing to sleep on
+    if( !busTransport()->realTimeDelays() )
+        co_return waitOnAck(usec);
+
+    int fd = busTransport()->ackEventFd();
+    uint64_t deadline = busTransport()->nowMicroseconds() + usec;
+    while( true )
+    {
+        // stale edges out first, then the level decides, an edge after it wakes the wait below
+        if( fd >= 0 )
+            busTransport()->clearAckEvents();
+        if( !getAckPin() )
+            co_return true;
+        uint64_t now = busTransport()->nowMicroseconds();
+        if( now >= deadline )
+            co_return false;
+
+        if( fd >= 0 )
+            co_await loop.readable(fd, deadline - now);
+        else
+            co_await loop.sleep(deadline - now < PP_ACK_POLL ? deadline - now : PP_ACK_POLL);
+    }
 }
+#endif
 
 }
 
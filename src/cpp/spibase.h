@@ -1,14 +1,18 @@
 #ifndef SPIBASE_H
 #define SPIBASE_H
 
-#include <QDebug>
+#ifndef PP_NO_QT
+#include <QString>
+#endif
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/spi/spidev.h>
 #include <linux/types.h>
+#include <functional>
 #include <math.h>
+#include <mutex>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -19,19 +23,58 @@
 #include <sys/ioctl.h>
 #include <time.h>
 #include <unistd.h>
+#ifndef PP_NO_WIRINGPI
 #include <wiringPi.h>
 #include <wiringPiSPI.h>
+#else
+/// edge selectors as wiringPi defines them, used by DAQC2Plate::enableDinIRQ
+#define INT_EDGE_SETUP          0
+#define INT_EDGE_FALLING        1
+#define INT_EDGE_RISING         2
+#define INT_EDGE_BOTH           3
+#endif
 // #include <bcm2835.h>
 
+#include "platebus.h"
+#include "platecommands.h"
+#include "platetask.h"
+#include "pplog.h"
+#include "spitransport.h"
+#include "timingprofile.h"
+
 
 namespace SPIW {
 
+class FrameProbe;
+#ifdef PP_COROUTINES
+class BusLoop;
+#endif
 
 /* SPI device initialization parameters */
 #define PP_SPI_BUS_SPEED		500000
 
 #define PP_DELAY 1000
 
+/// most bytes a command can read back
+#define PP_MAX_READBACK         40
+
+/// usec to wait for ppACK after a command, the old millisecond compare really waited 50 ms
+#define PP_ACK_TIMEOUT          50000
+
+/// usec to wait for ppACK before the readback
+#define PP_ACK_READ_TIMEOUT     80000
+
+/// usec waitOnAck spins before it starts sleeping between polls, when the bus has no edge events
+#define PP_ACK_SPIN             100
+
+/// usec slept between ppACK polls after the spin
+#define PP_ACK_POLL             50
+
+/// buffers that hold any plate id, or a "major.minor" revision, with the terminator
+#define PP_ID_SIZE              32
+#define PP_REVISION_SIZE        8
+
+
 #define PP_MAX_RELAYS 			8
 #define PP_MAX_DIGITAL_IN		8
 #define PP_MAX_ANALOG_IN		8
@@ -82,7 +125,7 @@ struct rtnStructure
     int nbr_rtn;
 
     /// make a lot of bytes, incase needed later
-    uint8_t rtn[40];
+    uint8_t rtn[PP_MAX_READBACK];
 
     /// true if data was send back correctly from piplate hardware
     bool valid;
@@ -122,16 +165,77 @@ protected :
     uint8_t  _address;
     uint8_t _ioAddress;
 
+    /// the plate drives ppACK (DAQC2), picks the DAQC2 rows of plateCommands for the common commands
+    bool     _ackLine;
+
+    /// the stack this board is on, the default bus until initBus names its lines
+    PlateBus* _bus;
+
+    /// frame, write and readback delays used by SendCommand
+    TimingProfile _timing;
+
     int spiError(int code, const char* message, ...);
-    int spiRead(int fd, uint8_t const* buff, size_t len, uint32_t speed, uint32_t mode, uint32_t delay);
+
+    /// one frame at a time on the bus, held around each frame or executor request
+    std::mutex& busLock()
+    {
+        return _bus->lock();
+    }
+
+    /// the backend of the bus this board is on
+    SPITransport* busTransport()
+    {
+        return _bus->transport();
+    }
+
+    /*
+     * The typed send path, defined in commandframe.h. The frame shape is a template argument taken from
+     * the plateCommands row, a write only command has no readback code and nothing is called virtually.
+     */
+
+    /// one framed exchange with the plate on the calling thread
+    template<bool Ack, bool Reads, bool StopAt0>
+    rtnStructure frame( cmdStructure cmd, int readbackBytes );
+
+    /// frame under the bus lock, or queued to the BusExecutor when one owns the bus
+    template<bool Ack, bool Reads, bool StopAt0>
+    rtnStructure route( const cmdStructure &cmd, int readbackBytes );
+
+    /// command C with runtime arguments, one outside its plateCommands row never reaches the bus
+    template<PlateCommand C>
+    rtnStructure send( uint8_t arg1 = 0, uint8_t arg2 = 0, uint8_t unit = 0 );
+
+    /// command C with constant arguments, checked at compile time
+    template<PlateCommand C, uint8_t Arg1, uint8_t Arg2 = 0>
+    rtnStructure send();
+
+    /// command C inside exclusive(), the bus is already held
+    template<PlateCommand C>
+    rtnStructure exchange( uint8_t arg1 = 0, uint8_t arg2 = 0, uint8_t unit = 0 );
+
+    /// runs job with the bus to itself, the frames inside go through exchange back to back
+    void exclusive( const std::function<void ()> &job );
+
+#ifdef PP_COROUTINES
+    /// frame with the delays and the ack wait as suspensions on loop, holds the bus of the loop from raise to drop, see commandawait.h
+    template<bool Ack, bool Reads, bool StopAt0>
+    PlateTask<rtnStructure> frameAsync( BusLoop &loop, cmdStructure cmd, int readbackBytes );
+
+    /// waitOnAck on loop, sleeps on the ppACK edge fd or on poll timers
+    PlateTask<bool> waitOnAckAsync( BusLoop &loop, int usec );
+#endif
+
+    /// reads count response bytes in one bus message, stopAt0 trims at the zero terminator, returns bytes or SPIERROR
+    int readResponse(rtnStructure &rtn, int count, bool stopAt0);
 
     /**
      * Enable frame signal to transmit commands to the
      * board through the SPI bus.
      * @param pBoard Handle of the PI-Plates board
+     * @param probe times the raise apart from the check when given
      * @return 0 success otherwise signal an error
      */
-    int enableFrame(void);
+    int enableFrame(FrameProbe* probe = NULL);
 
     /**
      * Disable frame signal to prevent transmission
@@ -146,20 +250,44 @@ protected :
 
 public:
 
-    /// constructor
-    SPIBase(  uint8_t  x_address );
+    /// the backend of the default bus, wiringPi unless PIPLATE_TRANSPORT=sim or setTransport was called
+    static SPITransport* transport();
 
-    /// inits the board, once pins and such already set..
+    /// installs the backend of the default bus, call before constructing boards, the caller keeps ownership
+    static void setTransport( SPITransport* x_transport );
+
+    /// constructor on the default bus, x_ackLine for plates that drive ppACK
+    SPIBase(  uint8_t  x_address, bool x_ackLine = false );
+
+    /// constructor on x_bus
+    SPIBase( PlateBus &x_bus, uint8_t x_address, bool x_ackLine = false );
+
+    /// opens the bus of the board and picks its timing profile
     bool initBoard(void);
 
+    /// binds the board to the bus on these lines and opens it, no frame goes to this board
+    bool initBus( uint8_t PinFrame,   uint8_t PinSRQ,  uint8_t PinACK, int Device);
+
     /// normal way to init the board
     bool initBoard( uint8_t PinFrame,   uint8_t PinSRQ,  uint8_t PinACK, int Device);
 
+    /// the stack this board is on
+    PlateBus &getBus(void)
+    {
+        return *_bus;
+    }
+
 
 
 
-    /// exchange with piplate hardware
-    virtual rtnStructure SendCommand( cmdStructure cmd, int readbackBytes, bool stopAt0 = false );
+    /// exchange shaped at runtime, for frames outside plateCommands, goes through the BusExecutor when one is running
+    rtnStructure SendCommand( cmdStructure cmd, int readbackBytes, bool stopAt0 = false );
+
+#ifdef PP_COROUTINES
+    /// command C as an awaitable on the active BusLoop, see commandawait.h, an argument outside its row completes invalid
+    template<PlateCommand C>
+    PlateTask<rtnStructure> command( uint8_t arg1 = 0, uint8_t arg2 = 0, uint8_t unit = 0 );
+#endif
 
     /// reset the boards
     virtual int reset();
@@ -172,8 +300,8 @@ public:
         return true;
     }
 
-    /// could be added to other boards later, so make this vitual so others can implement, used by DAQC2
-    virtual bool waitOnAck( int usec);
+    /// waits up to usec micro seconds for ppACK low, true on ack, frames of ack plates only
+    bool waitOnAck( int usec);
 
     /// getAck pin for new DACQ2
     int getAckPin(void);
@@ -181,14 +309,62 @@ public:
     /// gets the hardware address for the board.. does the io to get board address
     virtual uint8_t getBoardAddress( void);
 
-    /// get the who is this board
-    virtual QString     getID(void);
+    /// get the who is this board into id, returns its length or SPIERROR with id "Not Valid Request"
+    virtual int getID( char* id, size_t size );
+
+    /// gets the hardware revision as "major.minor", returns its length or SPIERROR
+    virtual int getHWRevision( char* revision, size_t size );
+
+    /// gets the firmware revision as "major.minor", returns its length or SPIERROR
+    virtual int getFWRevision( char* revision, size_t size );
+
+    /// gets the hardware revision as the raw byte, major in the high nibble, 0 on error
+    virtual uint8_t getHWRevisionByte(void);
+
+    /// gets the firmware revision as the raw byte, major in the high nibble, 0 on error
+    virtual uint8_t getFWRevisionByte(void);
+
+#ifndef PP_NO_QT
+    /// Qt layer, the same reads as QString
+    QString getID(void)
+    {
+        char id[PP_ID_SIZE];
+        getID(id, sizeof(id));
+        return QString(id);
+    }
+
+    QString getHWRevision(void)
+    {
+        char revision[PP_REVISION_SIZE];
+        getHWRevision(revision, sizeof(revision));
+        return QString(revision);
+    }
+
+    QString getFWRevision(void)
+    {
+        char revision[PP_REVISION_SIZE];
+        getFWRevision(revision, sizeof(revision));
+        return QString(revision);
+    }
+#endif
+
+    /// board type used to pick a timing profile, "RELAY", "DAQC2"
+    virtual const char* boardType(void)
+    {
+        return "PLATE";
+    }
 
-    /// gets the hardware revision
-    virtual QString getHWRevision(void);
+    /// the frame timing in use
+    const TimingProfile &getTiming(void) const
+    {
+        return _timing;
+    }
 
-    /// gets the firmware revision
-    virtual QString getFWRevision(void);
+    /// replaces the frame timing, see TimingProfiles::autoTune
+    void setTiming( const TimingProfile &timing )
+    {
+        _timing = timing;
+    }
 
     /// updates the LED
     virtual int     updateLED(const uint8_t led, const uint8_t state);
@@ -0,0 +1,100 @@
+#ifndef SPITRANSPORT_H
+#define SPITRANSPORT_H
+
+#include <stdint.h>
+
+namespace SPIW {
+
+/**
+ * @brief The SPITransport class  The physical side of the piplate bus, the gpio control lines
+ * (ppFRAME, ppINT, ppACK), the spi device and the clock used for the frame timing.
+ *
+ * SPIBase talks only to this interface, so the same board classes run on the real
+ * wiringPi/spidev bus or on the simulated stack in simtransport.h.
+ */
+class SPITransport
+{
+public:
+
+    virtual ~SPITransport() {}
+
+    /// short name of the backend, "wiringpi", "sim"
+    virtual const char* name() const = 0;
+
+    /// sets up the frame, interrupt and ack pins (wiringPi pin numbers), returns false on failure
+    virtual bool initPins( uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK ) = 0;
+
+    /// opens the spi device 0 or 1, returns the fd or < 0 on error
+    virtual int openDevice( int Device, int speed ) = 0;
+
+    /// returns the fd of the open spi device or < 0 if not open
+    virtual int getFd() = 0;
+
+    /// closes the spi device, the next openDevice reopens it
+    virtual void closeDevice() = 0;
+
+    /// drives ppFRAME high or low
+    virtual void setFrame( bool high ) = 0;
+
+    /// reads back the ppFRAME line
+    virtual int getFrame() = 0;
+
+    /// reads the ppACK line, low means the DAQC2 has acknowledged
+    virtual int getAck() = 0;
+
+    /// reads the ppINT line, low means a board is asserting an interrupt
+    virtual int getInt() = 0;
+
+    /// blocks until ppACK is low or timeoutUs passes without burning the cpu,
+    /// returns 1 on ack, 0 on timeout, < 0 if the backend has no edge events and the caller must poll
+    virtual int waitAck( uint32_t timeoutUs )
+    {
+        (void)timeoutUs;
+        return -1;
+    }
+
+    /// blocks until ppINT is low (a board asserts an interrupt) or timeoutUs passes,
+    /// returns 1 when asserted, 0 on timeout, < 0 if the caller must poll getInt
+    virtual int waitInt( uint32_t timeoutUs )
+    {
+        (void)timeoutUs;
+        return -1;
+    }
+
+    /// fd that turns readable on a ppACK falling edge, for an event loop to wait on instead of waitAck,
+    /// < 0 if the backend has none and the loop must poll getAck
+    virtual int ackEventFd()
+    {
+        return -1;
+    }
+
+    /// drops the edges queued on ackEventFd, they say nothing about the next command
+    virtual void clearAckEvents()
+    {
+    }
+
+    /// false when the bus clock only moves through delayMicroseconds, an event loop then delays inline instead of on a timer
+    virtual bool realTimeDelays()
+    {
+        return true;
+    }
+
+    /// full duplex write of the command bytes, returns the byte count or < 0 on error
+    virtual int write( uint8_t* buff, int len ) = 0;
+
+    /// one spi transfer reading len bytes, delay is the post transfer delay in usec, returns < 0 on error
+    virtual int read( uint8_t* buff, int len, uint32_t delay ) = 0;
+
+    /// count one byte transfers submitted as a single message, delay is the gap after each byte, returns < 0 on error
+    virtual int readBytes( uint8_t* buff, int count, uint32_t delay ) = 0;
+
+    /// waits the given micro seconds on the transport clock
+    virtual void delayMicroseconds( unsigned int usec ) = 0;
+
+    /// monotonic transport clock in micro seconds
+    virtual uint64_t nowMicroseconds() = 0;
+};
+
+}
+
+#endif // SPITRANSPORT_H
@@ -0,0 +1,174 @@
+#include "timingprofile.h"
+#include "spibase.h"
+
+#include <sys/stat.h>
+
+namespace SPIW {
+
+/// binary search stops when the window is this narrow, usec
+#define PP_TUNE_RESOLUTION      2
+
+TimingProfiles::TimingProfiles()
+{
+    /// a missing file just means nothing has been tuned yet
+    load(path());
+}
+
+TimingProfiles &TimingProfiles::instance()
+{
+    static TimingProfiles table;
+    return table;
+}
+
+std::string TimingProfiles::path()
+{
+    const char* env = getenv("PIPLATE_TIMING_FILE");
+    if( env != NULL && *env != 0 )
+        return std::string(env);
+    return std::string(PP_TIMING_FILE);
+}
+
+std::string TimingProfiles::key(const char *boardType, uint8_t fwRev)
+{
+    char buff[64];
+    snprintf(buff, sizeof(buff), "%s %d", boardType, fwRev);
+    return std::string(buff);
+}
+
+bool TimingProfiles::empty()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return profiles.empty();
+}
+
+TimingProfile TimingProfiles::lookup(const char *boardType, uint8_t fwRev)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, TimingProfile>::const_iterator it = profiles.find(key(boardType, fwRev));
+    if( it == profiles.end() )
+        it = profiles.find(key(boardType, 0));
+    if( it == profiles.end() )
+        return TimingProfile();
+    return it->second;
+}
+
+void TimingProfiles::set(const char *boardType, uint8_t fwRev, const TimingProfile &timing)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    profiles[key(boardType, fwRev)] = timing;
+}
+
+bool TimingProfiles::load(const std::string &file)
+{
+    FILE* fp = fopen(file.c_str(), "r");
+    if( fp == NULL )
+        return false;
+
+    char line[256];
+    while( fgets(line, sizeof(line), fp) != NULL )
+    {
+        char type[32];
+        int fw;
+        unsigned int setup, hold, postWrite, interByte;
+        if( line[0] == '#' )
+            continue;
+        if( sscanf(line, "%31s %d %u %u %u %u", type, &fw, &setup, &hold, &postWrite, &interByte) == 6 )
+            set(type, (uint8_t)fw, TimingProfile(setup, hold, postWrite, interByte));
+    }
+    fclose(fp);
+    return true;
+}
+
+bool TimingProfiles::save(const std::string &file)
+{
+    // make the directory, fine if it already exists
+    std::string::size_type slash = file.rfind('/');
+    if( slash != std::string::npos && slash > 0 )
+        mkdir(file.substr(0, slash).c_str(), 0755);
+
+    FILE* fp = fopen(file.c_str(), "w");
+    if( fp == NULL )
+    {
+        PP_WARN() << "Unable to write timing profiles to" << file.c_str();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    fprintf(fp, "# board fw frameSetupUs frameHoldUs postWriteUs interByteUs\n");
+    for( std::map<std::string, TimingProfile>::const_iterator it = profiles.begin(); it != profiles.end(); ++it )
+    {
+        const TimingProfile &t = it->second;
+        fprintf(fp, "%s %u %u %u %u\n", it->first.c_str(), t.frameSetupUs, t.frameHoldUs, t.postWriteUs, t.interByteUs);
+    }
+    fclose(fp);
+    return true;
+}
+
+bool TimingProfiles::timingWorks(SPIBase &board, const TimingProfile &timing, const std::string &id, int count)
+{
+    board.setTiming(timing);
+    for( int i = 0; i < count; ++i )
+    {
+        if( board.getBoardAddress() != board.getAddress() )
+            return false;
+    }
+    // the id is the only long readback, it checks the byte gap
+    char read[PP_ID_SIZE];
+    board.getID(read, sizeof(read));
+    return id == read;
+}
+
+TimingProfile TimingProfiles::autoTune(SPIBase &board, int trials)
+{
+    const TimingProfile legacy;
+    uint32_t TimingProfile::* fields[4] = {
+        &TimingProfile::frameSetupUs,
+        &TimingProfile::frameHoldUs,
+        &TimingProfile::postWriteUs,
+        &TimingProfile::interByteUs
+    };
+
+    board.setTiming(legacy);
+    char legacyId[PP_ID_SIZE];
+    board.getID(legacyId, sizeof(legacyId));
+    std::string id = legacyId;
+    if( !timingWorks(board, legacy, id, trials) )
+    {
+        PP_WARN() << "autoTune: board" << board.getAddress() << "does not answer with the legacy timing";
+        board.setTiming(legacy);
+        return legacy;
+    }
+
+    TimingProfile best = legacy;
+    for( int f = 0; f < 4; ++f )
+    {
+        // hi always works, lo is the largest value seen failing
+        uint32_t lo = 0;
+        uint32_t hi = best.*fields[f];
+        while( hi - lo > PP_TUNE_RESOLUTION )
+        {
+            TimingProfile t = best;
+            t.*fields[f] = (lo + hi) / 2;
+            if( timingWorks(board, t, id, trials) )
+                hi = t.*fields[f];
+            else
+                lo = t.*fields[f];
+        }
+
+        // a quarter plus a little on top for jitter, never above the legacy value
+        uint32_t tuned = hi + hi / 4 + PP_TUNE_RESOLUTION;
+        best.*fields[f] = tuned < legacy.*fields[f] ? tuned : legacy.*fields[f];
+    }
+
+    if( !timingWorks(board, best, id, trials * 4) )
+    {
+        PP_WARN() << "autoTune: tuned timing failed verification, keeping the legacy timing";
+        best = legacy;
+    }
+
+    board.setTiming(best);
+    set(board.boardType(), board.getFWRevisionByte(), best);
+    return best;
+}
+
+}
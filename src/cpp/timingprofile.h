@@ -0,0 +1,99 @@
+#ifndef TIMINGPROFILE_H
+#define TIMINGPROFILE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <mutex>
+
+namespace SPIW {
+
+class SPIBase;
+
+/// where tuned profiles are kept, PIPLATE_TIMING_FILE overrides it
+#define PP_TIMING_FILE          "/var/lib/piplates/timing.conf"
+
+/**
+ * @brief The TimingProfile struct  Frame timing used by SendCommand, all in micro seconds.
+ */
+struct TimingProfile
+{
+    /// ppFRAME high to command write
+    uint32_t frameSetupUs;
+
+    /// ppFRAME low before the next frame may start
+    uint32_t frameHoldUs;
+
+    /// command write to first readback byte, plates without ppACK only
+    uint32_t postWriteUs;
+
+    /// gap after each readback byte
+    uint32_t interByteUs;
+
+    /// the fixed timing the library always used, PP_DELAY around the frame, 70 after the write, 20 per byte
+    TimingProfile()
+        : frameSetupUs(1000)
+        , frameHoldUs(1000)
+        , postWriteUs(70)
+        , interByteUs(20)
+    {
+    }
+
+    TimingProfile( uint32_t setup, uint32_t hold, uint32_t postWrite, uint32_t interByte )
+        : frameSetupUs(setup)
+        , frameHoldUs(hold)
+        , postWriteUs(postWrite)
+        , interByteUs(interByte)
+    {
+    }
+};
+
+/**
+ * @brief The TimingProfiles class  Profiles per board type and firmware revision, loaded from and saved to PP_TIMING_FILE.
+ *
+ * A board without an entry for its firmware uses the entry of its board type with fw 0, then the legacy timing.
+ */
+class TimingProfiles
+{
+private :
+
+    std::map<std::string, TimingProfile> profiles;
+    std::mutex lock;
+
+    TimingProfiles();
+
+    static std::string key( const char* boardType, uint8_t fwRev );
+
+    /// true if the board echoes its address and id correctly count times with the timing
+    static bool timingWorks( SPIBase &board, const TimingProfile &timing, const std::string &id, int count );
+
+public:
+
+    /// the table of the process, PP_TIMING_FILE is read on first use
+    static TimingProfiles& instance();
+
+    /// path of the profile file
+    static std::string path();
+
+    /// true if any profile is known, lets boards skip the firmware query when there is nothing to pick
+    bool empty();
+
+    /// the profile for a board type ("RELAY", "DAQC2") and raw firmware revision byte
+    TimingProfile lookup( const char* boardType, uint8_t fwRev );
+
+    /// stores a profile, fwRev 0 is the default of the board type
+    void set( const char* boardType, uint8_t fwRev, const TimingProfile &timing );
+
+    /// reads the profile file, returns false if it could not be opened
+    bool load( const std::string &file );
+
+    /// writes the profile file, returns false on error
+    bool save( const std::string &file );
+
+    /// searches the smallest delays the board still answers correctly, installs them on the board and in the table
+    TimingProfile autoTune( SPIBase &board, int trials = 16 );
+};
+
+}
+
+#endif // TIMINGPROFILE_H
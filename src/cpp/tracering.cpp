@@ -0,0 +1,134 @@
+#include "tracering.h"
+#include "pplog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace SPIW {
+
+TraceRing::TraceRing()
+    : slots(PP_TRACE_CAPACITY)
+    , head(0)
+    , on(false)
+{
+    for( size_t i = 0; i < slots.size(); ++i )
+        slots[i].seq.store(0, std::memory_order_relaxed);
+
+    const char* env = getenv("PIPLATE_TRACE");
+    if( env != NULL && *env == '1' )
+        on = true;
+}
+
+TraceRing &TraceRing::instance()
+{
+    static TraceRing ring;
+    return ring;
+}
+
+void TraceRing::clear()
+{
+    for( size_t i = 0; i < slots.size(); ++i )
+        slots[i].seq.store(0, std::memory_order_relaxed);
+    head.store(0, std::memory_order_release);
+}
+
+void TraceRing::record(const TraceEvent &event)
+{
+    uint64_t n = head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = slots[n & (slots.size() - 1)];
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event = event;
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+size_t TraceRing::collect(std::vector<TraceEvent> &events) const
+{
+    events.clear();
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > slots.size() ? end - slots.size() : 0;
+    events.reserve(end - begin);
+    for( uint64_t n = begin; n < end; ++n )
+    {
+        const Slot &slot = slots[n & (slots.size() - 1)];
+        uint64_t before = slot.seq.load(std::memory_order_acquire);
+        TraceEvent event = slot.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // still being written, or already reused for a newer event
+        if( before != 2 * n + 2 || slot.seq.load(std::memory_order_relaxed) != before )
+            continue;
+        events.push_back(event);
+    }
+    return events.size();
+}
+
+const char *TraceRing::phaseName(int phase)
+{
+    static const char* names[] = { "bus wait", "frame raise", "frame check", "spi write", "ack wait", "readback", "frame drop", "frame" };
+    if( phase < 0 || phase > TraceFrame )
+        return "unknown";
+    return names[phase];
+}
+
+uint32_t TraceRing::threadId()
+{
+    static thread_local uint32_t tid = (uint32_t)syscall(SYS_gettid);
+    return tid;
+}
+
+std::string TraceRing::chromeJson() const
+{
+    std::vector<TraceEvent> events;
+    collect(events);
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"piplates bus\"}}";
+    char line[512];
+    for( size_t i = 0; i < events.size(); ++i )
+    {
+        const TraceEvent &e = events[i];
+        if( e.phase == TraceFrame )
+        {
+            char rx[3 * PP_TRACE_RX + 1] = "";
+            int keep = e.rxLen < PP_TRACE_RX ? e.rxLen : PP_TRACE_RX;
+            for( int k = 0; k < keep; ++k )
+                snprintf(rx + 3 * k, 4, "%02x ", e.rx[k]);
+            if( keep > 0 )
+                rx[3 * keep - 1] = 0;
+            snprintf(line, sizeof(line),
+                     ",\n{\"name\":\"cmd 0x%02x\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"address\":%d,\"opcode\":\"0x%02x\",\"valid\":%s,\"tx\":\"%02x %02x %02x %02x\",\"rxLen\":%d,\"rx\":\"%s\"}}",
+                     e.opcode, (unsigned long long)e.timestampUs, e.durationUs, e.thread,
+                     e.address, e.opcode, e.valid ? "true" : "false", e.tx[0], e.tx[1], e.tx[2], e.tx[3], e.rxLen, rx);
+        }
+        else
+        {
+            snprintf(line, sizeof(line),
+                     ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"address\":%d,\"opcode\":\"0x%02x\"}}",
+                     phaseName(e.phase), (unsigned long long)e.timestampUs, e.durationUs, e.thread, e.address, e.opcode);
+        }
+        json += line;
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+int TraceRing::dumpChrome(const char *path) const
+{
+    FILE* out = fopen(path, "w");
+    if( out == NULL )
+    {
+        PP_ERROR() << "Unable to write trace" << path;
+        return -1;
+    }
+    std::string json = chromeJson();
+    size_t written = fwrite(json.data(), 1, json.size(), out);
+    fclose(out);
+    return written == json.size() ? 0 : -1;
+}
+
+}
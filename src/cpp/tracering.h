@@ -0,0 +1,121 @@
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace SPIW {
+
+/// events the ring keeps, a power of two, the oldest are overwritten
+#define PP_TRACE_CAPACITY       16384
+
+/// readback bytes kept with a frame event
+#define PP_TRACE_RX             16
+
+/// parts of a command the trace tells apart, TraceFrame is the whole transaction
+enum TracePhase
+{
+    TraceBusWait = 0,
+    TraceFrameRaise,
+    TraceFrameCheck,
+    TraceWrite,
+    TraceAckWait,
+    TraceReadback,
+    TraceFrameDrop,
+    TraceFrame
+};
+
+/**
+ * @brief The TraceEvent struct  One timed span of a command on the bus.
+ */
+struct TraceEvent
+{
+    /// bus clock at the start, and the length, usec
+    uint64_t timestampUs;
+    uint32_t durationUs;
+
+    /// kernel thread id of the caller
+    uint32_t thread;
+
+    uint8_t  phase;
+    uint8_t  opcode;
+    uint8_t  address;
+
+    /// TraceFrame only: result, the 4 command bytes, the readback length and its first PP_TRACE_RX bytes
+    uint8_t  valid;
+    uint8_t  tx[4];
+    uint8_t  rxLen;
+    uint8_t  rx[PP_TRACE_RX];
+};
+
+/**
+ * @brief The TraceRing class  Process wide ring of the last bus transactions, phase by phase.
+ *
+ * Always built in, off until enable(true) or PIPLATE_TRACE=1; while off a command pays one relaxed
+ * load. Writers claim a slot with one atomic add and never wait, a slot being rewritten while the
+ * ring is read is skipped. dumpChrome writes the chrome://tracing / Perfetto JSON format, one lane
+ * per thread, the phases nested in their frame.
+ */
+class TraceRing
+{
+private :
+
+    struct Slot
+    {
+        /// 2n+1 while event n is written, 2n+2 once it is complete
+        std::atomic<uint64_t> seq;
+        TraceEvent            event;
+    };
+
+    std::vector<Slot>     slots;
+    std::atomic<uint64_t> head;
+    std::atomic<bool>     on;
+
+    TraceRing();
+
+    TraceRing( const TraceRing& );
+    TraceRing& operator=( const TraceRing& );
+
+public:
+
+    /// the ring of the process
+    static TraceRing& instance();
+
+    /// true while commands are recorded
+    static bool enabled()
+    {
+        return instance().on.load(std::memory_order_relaxed);
+    }
+
+    /// starts or stops recording, what is in the ring stays
+    void enable( bool x_on )
+    {
+        on.store(x_on, std::memory_order_relaxed);
+    }
+
+    void clear();
+
+    /// adds event, overwriting the oldest one when full
+    void record( const TraceEvent &event );
+
+    /// copies the complete events, oldest first, returns how many
+    size_t collect( std::vector<TraceEvent> &events ) const;
+
+    /// the ring as chrome trace event JSON
+    std::string chromeJson() const;
+
+    /// writes chromeJson to path, returns 0 or -1
+    int dumpChrome( const char* path ) const;
+
+    /// name of a phase in the trace
+    static const char* phaseName( int phase );
+
+    /// kernel thread id of the calling thread
+    static uint32_t threadId();
+};
+
+}
+
+#endif // TRACERING_H
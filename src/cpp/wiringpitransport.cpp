@@ -0,0 +1,359 @@
+#include "wiringpitransport.h"
+#include "spibase.h"
+
+#include <linux/gpio.h>
+#include <poll.h>
+
+namespace SPIW {
+
+WiringPiTransport::WiringPiTransport(int x_spiBus)
+    : ppFRAME(-1)
+    , ppINT(-1)
+    , ppACK(-1)
+    , odevice(-1)
+    , spiBus(x_spiBus)
+    , spiFd(-1)
+    , initWirePi(false)
+    , initPinsYet(false)
+    , ackFd(-1)
+    , intFd(-1)
+{
+}
+
+WiringPiTransport::~WiringPiTransport()
+{
+    if( ackFd >= 0 )
+        ::close(ackFd);
+    if( intFd >= 0 )
+        ::close(intFd);
+}
+
+int WiringPiTransport::openLineEvents(uint8_t gpio, uint32_t eventFlags, const char *label)
+{
+    const char* chipPath = getenv("PIPLATE_GPIOCHIP");
+    if( chipPath == NULL || *chipPath == 0 )
+        chipPath = PP_GPIO_CHIP;
+
+    int chip = ::open(chipPath, O_RDONLY | O_CLOEXEC);
+    if( chip < 0 )
+        return -1;
+
+    struct gpioevent_request req;
+    memset(&req, 0, sizeof(req));
+    req.lineoffset = gpio;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = eventFlags;
+    strncpy(req.consumer_label, label, sizeof(req.consumer_label) - 1);
+
+    int rc = ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &req);
+    ::close(chip);
+    if( rc < 0 )
+        return -1;
+
+    fcntl(req.fd, F_SETFL, O_NONBLOCK);
+    return req.fd;
+}
+
+int WiringPiTransport::spiRead(int fd, const uint8_t *buff, size_t len, uint32_t speed, uint32_t mode, uint32_t delay)
+{
+    struct spi_ioc_transfer spi;
+    memset(&spi, 0, sizeof(spi));
+
+    spi.tx_buf = (unsigned long) NULL;
+    spi.rx_buf = (unsigned long) buff;
+    spi.len = len;
+    spi.delay_usecs = delay;
+    spi.speed_hz = speed;
+    spi.bits_per_word = 8;
+    spi.cs_change = 0;
+
+    // adapted from py_spidev/spidev_module
+#ifdef SPI_IOC_WR_MODE32
+    spi.tx_nbits = 0;
+#endif
+#ifdef SPI_IOC_RD_MODE32
+    spi.rx_nbits = 0;
+#endif
+
+    int ret = ioctl(fd, SPI_IOC_MESSAGE(1), &spi);
+    if(ret < 1)
+    {
+        PP_ERROR() << 1100 << "spiRead(): Can't send spi message";
+        return -1100;
+    }
+
+    if(mode & SPI_CS_HIGH)
+    {
+        ret = ::read(fd, (void*) &buff[0], 0);
+    }
+
+    // success
+    return ret;
+}
+
+bool WiringPiTransport::initPins(uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK)
+{
+    if( !initWirePi )
+    {
+        wiringPiSetupGpio(); // BCM pin layout root mode
+        initWirePi = true;
+    }
+
+    uint8_t frame = wpiPinToGpio( PinFrame );
+    uint8_t srq   = wpiPinToGpio( PinSRQ  );
+    uint8_t ack   = wpiPinToGpio( PinACK );
+
+    // same lines as last time, nothing to set up again
+    if( initPinsYet && frame == ppFRAME && srq == ppINT && ack == ppACK )
+        return true;
+
+    ppFRAME =  frame;
+    ppINT   =  srq;
+    ppACK   =  ack;
+
+    // the line events follow the pins
+    if( ackFd >= 0 )
+        ::close(ackFd);
+    ackFd = -1;
+    if( intFd >= 0 )
+        ::close(intFd);
+    intFd = -1;
+
+    // Initialize frame signal
+    pinMode(ppFRAME, OUTPUT);
+
+    // Initialize interrupt control
+    pinMode( ppINT, INPUT);
+    pullUpDnControl( ppINT, PUD_UP);
+
+    // Initialize ACK
+    pinMode( ppACK, INPUT);
+    pullUpDnControl( ppACK, PUD_UP);
+    initPinsYet = true;
+    return true;
+}
+
+int WiringPiTransport::openDevice(int Device, int speed)
+{
+    // keep the fd open for the life of the process, wiringPiSPISetup leaks the old one
+    if( spiFd >= 0 && Device == odevice )
+        return spiFd;
+
+    closeDevice();
+    odevice = Device;
+    if( spiBus == 0 )
+    {
+        spiFd = wiringPiSPISetup (odevice, speed);
+        return spiFd;
+    }
+
+    // mode 0, 8 bit words, as wiringPiSPISetup sets spi0 up
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/spidev%d.%d", spiBus, odevice);
+    spiFd = ::open(path, O_RDWR | O_CLOEXEC);
+    if( spiFd < 0 )
+    {
+        PP_ERROR() << "Unable to open" << path << "errno" << errno;
+        return spiFd;
+    }
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    uint32_t maxSpeed = speed;
+    if( ioctl(spiFd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(spiFd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0
+        || ioctl(spiFd, SPI_IOC_WR_MAX_SPEED_HZ, &maxSpeed) < 0 )
+    {
+        PP_ERROR() << "Unable to set up" << path << "errno" << errno;
+        closeDevice();
+    }
+    return spiFd;
+}
+
+int WiringPiTransport::getFd()
+{
+    return spiFd;
+}
+
+void WiringPiTransport::closeDevice()
+{
+    if( spiFd >= 0 )
+        ::close(spiFd);
+    spiFd = -1;
+}
+
+void WiringPiTransport::setFrame(bool high)
+{
+    digitalWrite(ppFRAME, high ? HIGH : LOW);
+}
+
+int WiringPiTransport::getFrame()
+{
+    return digitalRead(ppFRAME);
+}
+
+int WiringPiTransport::getAck()
+{
+    return digitalRead(ppACK);
+}
+
+int WiringPiTransport::getInt()
+{
+    return digitalRead(ppINT);
+}
+
+int WiringPiTransport::lineEvents(int &fd, uint8_t gpio, const char *label)
+{
+    if( fd == -1 )
+    {
+        fd = openLineEvents(gpio, GPIOEVENT_REQUEST_FALLING_EDGE, label);
+        if( fd < 0 )
+        {
+            PP_WARN() << "No gpio edge events for" << label << ", falling back to polling";
+            fd = -2;
+        }
+    }
+    return fd;
+}
+
+int WiringPiTransport::waitLineLow(int &fd, uint8_t gpio, const char *label, uint32_t timeoutUs)
+{
+    if( lineEvents(fd, gpio, label) < 0 )
+        return -1;
+
+    uint64_t deadline = nowMicroseconds() + timeoutUs;
+    struct gpioevent_data event;
+
+    // edges queued by earlier commands say nothing about this one
+    while( ::read(fd, &event, sizeof(event)) == (ssize_t)sizeof(event) )
+        ;
+
+    while( true )
+    {
+        // the edge may have come before we got here, the level decides
+        struct gpiohandle_data data;
+        if( ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0 )
+            return -1;
+        if( data.values[0] == 0 )
+            return 1;
+
+        uint64_t now = nowMicroseconds();
+        if( now >= deadline )
+            return 0;
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN | POLLPRI;
+        pfd.revents = 0;
+
+        struct timespec ts;
+        ts.tv_sec = (deadline - now) / 1000000ULL;
+        ts.tv_nsec = ((deadline - now) % 1000000ULL) * 1000;
+
+        int rc = ppoll(&pfd, 1, &ts, NULL);
+        if( rc < 0 && errno != EINTR )
+            return -1;
+        while( rc > 0 && ::read(fd, &event, sizeof(event)) == (ssize_t)sizeof(event) )
+            ;
+    }
+}
+
+int WiringPiTransport::waitAck(uint32_t timeoutUs)
+{
+    return waitLineLow(ackFd, ppACK, "piplates-ack", timeoutUs);
+}
+
+int WiringPiTransport::waitInt(uint32_t timeoutUs)
+{
+    return waitLineLow(intFd, ppINT, "piplates-int", timeoutUs);
+}
+
+int WiringPiTransport::ackEventFd()
+{
+    return lineEvents(ackFd, ppACK, "piplates-ack");
+}
+
+void WiringPiTransport::clearAckEvents()
+{
+    if( ackFd < 0 )
+        return;
+    struct gpioevent_data event;
+    while( ::read(ackFd, &event, sizeof(event)) == (ssize_t)sizeof(event) )
+        ;
+}
+
+int WiringPiTransport::write(uint8_t *buff, int len)
+{
+    if( spiBus == 0 )
+        return wiringPiSPIDataRW(odevice, buff, len);
+
+    // full duplex in place, what wiringPiSPIDataRW does on spi0
+    struct spi_ioc_transfer spi;
+    memset(&spi, 0, sizeof(spi));
+    spi.tx_buf = (unsigned long) buff;
+    spi.rx_buf = (unsigned long) buff;
+    spi.len = len;
+    spi.speed_hz = PP_SPI_BUS_SPEED;
+    spi.bits_per_word = 8;
+    return ioctl(getFd(), SPI_IOC_MESSAGE(1), &spi);
+}
+
+int WiringPiTransport::read(uint8_t *buff, int len, uint32_t delay)
+{
+    uint32_t mode = SPI_CPHA | SPI_RX_DUAL | SPI_TX_DUAL | SPI_NO_CS;
+    return spiRead(getFd(), buff, len, PP_SPI_BUS_SPEED, mode, delay);
+}
+
+int WiringPiTransport::readBytes(uint8_t *buff, int count, uint32_t delay)
+{
+    struct spi_ioc_transfer spi[PP_MAX_READBACK];
+
+    if( count <= 0 )
+        return 0;
+    if( count > PP_MAX_READBACK )
+        count = PP_MAX_READBACK;
+
+    memset(spi, 0, sizeof(spi[0]) * count);
+    for( int i = 0; i < count; ++i )
+    {
+        spi[i].tx_buf = (unsigned long) NULL;
+        spi[i].rx_buf = (unsigned long) &buff[i];
+        spi[i].len = 1;
+        spi[i].delay_usecs = delay;
+        spi[i].speed_hz = PP_SPI_BUS_SPEED;
+        spi[i].bits_per_word = 8;
+        spi[i].cs_change = 0;
+    }
+
+    // SPI_IOC_MESSAGE(count) spelled out, the macro only takes a constant
+    int ret = ioctl(getFd(), _IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0, SPI_MSGSIZE(count)), spi);
+    if(ret < 1)
+    {
+        PP_ERROR() << 1100 << "readBytes(): Can't send spi message";
+        return -1100;
+    }
+    return count;
+}
+
+void WiringPiTransport::delayMicroseconds(unsigned int usec)
+{
+    // usleep alone overshoots by 50 to 100 usec, sleep most of the way and spin the rest
+    uint64_t deadline = nowMicroseconds() + usec;
+    if( usec > PP_SPIN_THRESHOLD )
+    {
+        uint64_t wake = deadline - PP_SPIN_THRESHOLD;
+        struct timespec ts;
+        ts.tv_sec = wake / 1000000ULL;
+        ts.tv_nsec = (wake % 1000000ULL) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    while( nowMicroseconds() < deadline )
+        ;
+}
+
+uint64_t WiringPiTransport::nowMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+}
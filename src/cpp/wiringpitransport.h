@@ -0,0 +1,99 @@
+#ifndef WIRINGPITRANSPORT_H
+#define WIRINGPITRANSPORT_H
+
+#include "spitransport.h"
+#include <stddef.h>
+
+namespace SPIW {
+
+/// gpio character device the BCM lines live on, PIPLATE_GPIOCHIP overrides it
+#define PP_GPIO_CHIP            "/dev/gpiochip0"
+
+/// delays shorter than this are spun, longer ones sleep until this close to the deadline, usec
+#define PP_SPIN_THRESHOLD       80
+
+/**
+ * @brief The WiringPiTransport class  Real hardware backend, gpio through wiringPi and the spi
+ * bus through wiringPiSPI plus raw spidev ioctls for the readback. wiringPiSPI only knows spi0,
+ * other controllers go through spidev ioctls alone.
+ */
+class WiringPiTransport : public SPITransport
+{
+private :
+
+    uint8_t  ppFRAME;
+    uint8_t  ppINT;
+    uint8_t  ppACK;
+    int      odevice;
+
+    /// spi controller, 0 through wiringPiSPI, otherwise spidev<spiBus>.<device> opened directly
+    int      spiBus;
+    int      spiFd;
+    bool     initWirePi;
+    bool     initPinsYet;
+
+    /// line event fds of ppACK and ppINT, -1 not opened yet, -2 edge events not available
+    int      ackFd;
+    int      intFd;
+
+    /// requests edge events for a BCM line, returns the event fd or < 0
+    int openLineEvents( uint8_t gpio, uint32_t eventFlags, const char* label );
+
+    /// the event fd of a line, opened on first use, < 0 when the kernel has no edge events for it
+    int lineEvents( int &fd, uint8_t gpio, const char* label );
+
+    /// waits on the falling edge of a line, opens its events on first use, see SPITransport::waitAck
+    int waitLineLow( int &fd, uint8_t gpio, const char* label, uint32_t timeoutUs );
+
+    int spiRead(int fd, uint8_t const* buff, size_t len, uint32_t speed, uint32_t mode, uint32_t delay);
+
+public:
+
+    /// constructor, x_spiBus 1 for the auxiliary spi1
+    WiringPiTransport( int x_spiBus = 0 );
+
+    virtual ~WiringPiTransport();
+
+    virtual const char* name() const
+    {
+        return "wiringpi";
+    }
+
+    virtual bool initPins( uint8_t PinFrame, uint8_t PinSRQ, uint8_t PinACK );
+
+    virtual int openDevice( int Device, int speed );
+
+    virtual int getFd();
+
+    virtual void closeDevice();
+
+    virtual void setFrame( bool high );
+
+    virtual int getFrame();
+
+    virtual int getAck();
+
+    virtual int getInt();
+
+    virtual int waitAck( uint32_t timeoutUs );
+
+    virtual int waitInt( uint32_t timeoutUs );
+
+    virtual int ackEventFd();
+
+    virtual void clearAckEvents();
+
+    virtual int write( uint8_t* buff, int len );
+
+    virtual int read( uint8_t* buff, int len, uint32_t delay );
+
+    virtual int readBytes( uint8_t* buff, int count, uint32_t delay );
+
+    virtual void delayMicroseconds( unsigned int usec );
+
+    virtual uint64_t nowMicroseconds();
+};
+
+}
+
+#endif // WIRINGPITRANSPORT_H
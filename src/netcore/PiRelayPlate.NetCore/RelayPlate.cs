@@ -13,6 +13,8 @@ namespace PiRelayPlate.NetCore
 
         private static int _platesAvailable = -1;
 
+        private static IntPtr _context = IntPtr.Zero;
+
         static RelayPlate()
         {
             try
@@ -27,6 +29,29 @@ namespace PiRelayPlate.NetCore
 
         public const byte MaxPinsPerRelayBoard = 7;
 
+        public const int MaxRelayBoards = 8;
+
+        /// <summary>
+        /// One relay change of a batch, laid out as PiPlatesRelayOp of coreexports.h.
+        /// State 0 is off, 1 on, 2 toggle.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        public struct RelayOp
+        {
+            public byte Board;
+            public byte Pin;
+            public byte State;
+            public byte Reserved;
+
+            public RelayOp(byte board, byte pin, byte state)
+            {
+                Board = board;
+                Pin = pin;
+                State = state;
+                Reserved = 0;
+            }
+        }
+
         /// <summary>
         /// Its important that we don't call this method while its currently executing another
         /// command. Because of this, we have made this a synchronized call. 
@@ -111,12 +136,149 @@ namespace PiRelayPlate.NetCore
             _platesAvailable = RelaysAvailableImpl();
             return _platesAvailable;
         }
+
+        /// <summary>
+        /// Scans every address of the stack again, for relay boards added since the last start.
+        /// The inventory snapshot is rewritten, returns the number of relay boards found.
+        /// </summary>
+        [MethodImpl(MethodImplOptions.Synchronized)]
+        public static int Rescan()
+        {
+            if (Directory.GetFiles("/dev", "spidev*").Length == 0)
+            {
+                Console.WriteLine("No SPI Devices in /dev!");
+                return 0;
+            }
+
+            _platesAvailable = RescanRelaysImpl();
+            return _platesAvailable;
+        }
+
+        /// <summary>
+        /// Switches the whole stack with one RELAYALL frame per board that changes.
+        /// masks holds one 7 bit relay mask per board (bit n-1 is relay n), results gets
+        /// 0 unchanged, 1 written, 2 absent or -1 failed per board.
+        /// </summary>
+        [MethodImpl(MethodImplOptions.Synchronized)]
+        public static bool ApplyImage(byte[] masks, int[] results = null)
+        {
+            if (masks == null || masks.Length != MaxRelayBoards)
+            {
+                Console.WriteLine($"ApplyImage needs {MaxRelayBoards} board masks");
+                return false;
+            }
+
+            if (Directory.GetFiles("/dev", "spidev*").Length == 0)
+            {
+                Console.WriteLine("No SPI Devices in /dev!");
+                return false;
+            }
+
+            var boardResults = results ?? new int[MaxRelayBoards];
+            if (boardResults.Length < MaxRelayBoards)
+            {
+                Console.WriteLine($"ApplyImage needs room for {MaxRelayBoards} results");
+                return false;
+            }
+
+            return ApplyRelayImageImpl(masks, boardResults) == 0;
+        }
+
+        /// <summary>
+        /// Applies a whole batch of relay changes in one native call, the boards that change get one
+        /// RELAYALL frame each. status, when given, gets 0 or -1 per op.
+        /// </summary>
+        [MethodImpl(MethodImplOptions.Synchronized)]
+        public static bool SetPinStates(RelayOp[] ops, int[] status = null)
+        {
+            if (ops == null || (status != null && status.Length < ops.Length))
+            {
+                return false;
+            }
+
+            var context = OpenContext();
+            if (context == IntPtr.Zero)
+            {
+                return false;
+            }
+
+            return PlatesSetRelaysImpl(context, ops, ops.Length, status) == 0;
+        }
+
+        /// <summary>
+        /// Reads the relay masks of all boards (bit n-1 is relay n, absent boards 0) in one native call.
+        /// </summary>
+        [MethodImpl(MethodImplOptions.Synchronized)]
+        public static byte[] GetRelayStates()
+        {
+            var context = OpenContext();
+            if (context == IntPtr.Zero)
+            {
+                return null;
+            }
+
+            var masks = new byte[MaxRelayBoards];
+            return PlatesGetRelaysImpl(context, masks, masks.Length) < 0 ? null : masks;
+        }
+
+        private static IntPtr OpenContext()
+        {
+            if (_context != IntPtr.Zero)
+            {
+                return _context;
+            }
+
+            if (Directory.GetFiles("/dev", "spidev*").Length == 0)
+            {
+                Console.WriteLine("No SPI Devices in /dev!");
+                return IntPtr.Zero;
+            }
+
+            _context = PlatesOpenImpl();
+            return _context;
+        }
+
+        /// <summary>
+        /// Releases the cached plates and the SPI device held by the native library.
+        /// The next call discovers the stack again.
+        /// </summary>
+        [MethodImpl(MethodImplOptions.Synchronized)]
+        public static void Shutdown()
+        {
+            if (_context != IntPtr.Zero)
+            {
+                PlatesCloseImpl(_context);
+                _context = IntPtr.Zero;
+            }
+            ShutdownImpl();
+            _platesAvailable = -1;
+        }
     
-        // TODO: fix mangled name on c export
-        [DllImport(LibFileName, EntryPoint = "_Z11SetPinStatehhh", CallingConvention = CallingConvention.StdCall, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        [DllImport(LibFileName, EntryPoint = "SetPinState", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
         private static extern int SetPinStateImpl(byte boardId, byte pin, byte state);
 
-        [DllImport(LibFileName, EntryPoint = "_Z15RelaysAvailablev", CallingConvention = CallingConvention.StdCall, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        [DllImport(LibFileName, EntryPoint = "RelaysAvailable", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
         private static extern int RelaysAvailableImpl();
+
+        [DllImport(LibFileName, EntryPoint = "RescanRelays", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        private static extern int RescanRelaysImpl();
+
+        [DllImport(LibFileName, EntryPoint = "ApplyRelayImage", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        private static extern int ApplyRelayImageImpl(byte[] masks, [Out] int[] results);
+
+        [DllImport(LibFileName, EntryPoint = "ShutdownPlates", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        private static extern void ShutdownImpl();
+
+        [DllImport(LibFileName, EntryPoint = "PlatesOpen", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        private static extern IntPtr PlatesOpenImpl();
+
+        [DllImport(LibFileName, EntryPoint = "PlatesClose", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        private static extern void PlatesCloseImpl(IntPtr context);
+
+        [DllImport(LibFileName, EntryPoint = "PlatesSetRelays", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        private static extern int PlatesSetRelaysImpl(IntPtr context, RelayOp[] ops, int count, [Out] int[] status);
+
+        [DllImport(LibFileName, EntryPoint = "PlatesGetRelays", CallingConvention = CallingConvention.Cdecl, PreserveSig = true), SuppressUnmanagedCodeSecurity]
+        private static extern int PlatesGetRelaysImpl(IntPtr context, [Out] byte[] masks, int count);
     }
 }